@@ -0,0 +1,112 @@
+/**
+ * WSPing Analyze...
+ *
+ * Example usage of wsping log analysis, recomputes the per target
+ * stats of probe logs (see wsping-sweep -w) over a time range.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wsping.h"
+
+static void wsping_error(void* udata, const char* msg)
+{
+	(void)udata;
+	fprintf(stderr, "WSPing Error: %s\n", msg);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] log...\n"
+		"  -j threads   threads reading a log (default one per CPU)\n"
+		"  -s start     leave out records before this time, in seconds since 1970\n"
+		"  -e end       and from this time on\n"
+		"  -H           no RTT percentiles, saves 30 KB per target and thread\n"
+		"  -q           only print the summary\n"
+		"Logs are read in the order given, oldest first.\n",
+		name);
+}
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+	wsping_analysis_options_t opts = {0};
+	bool quiet = false;
+	int c;
+
+	opts.histograms = true;
+	while ((c = getopt(argc, argv, "j:s:e:Hqh")) != -1) {
+		switch (c) {
+			case 'j': opts.threads = (uint32_t)atoi(optarg); break;
+			case 's': opts.start_ns = (uint64_t)(atof(optarg) * 1e9); break;
+			case 'e': opts.end_ns = (uint64_t)(atof(optarg) * 1e9); break;
+			case 'H': opts.histograms = false; break;
+			case 'q': quiet = true; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	wsping_analysis_t* a = wsping_analysis_create(&opts, wsping_error, NULL);
+	if (!a) {
+		return 1;
+	}
+
+	uint64_t start = now_ns();
+	for (int i = optind; i < argc; i++) {
+		if (!wsping_analysis_add_log(a, argv[i])) {
+			wsping_analysis_destroy(a);
+			return 1;
+		}
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	// Print the results
+	uint64_t successful = 0;
+	for (int i = 0; i < wsping_analysis_get_target_count(a); i++) {
+		const wsping_analysis_result_t* r = wsping_analysis_get_result(a, i);
+		const wsping_stats_t* st = &r->stats;
+		successful += st->echos_successful;
+		if (quiet) {
+			continue;
+		}
+		printf("target %u: sent %llu, received %llu, loss %.2f%%", r->target,
+			(unsigned long long)st->echos_sent, (unsigned long long)st->echos_successful,
+			100.0 * (double)(st->echos_sent - st->echos_successful) / (double)st->echos_sent);
+		if (st->echos_successful > 0) {
+			printf(", rtt min/avg/max/mdev %.3f/%.3f/%.3f/%.3f ms, jitter %.3f ms",
+				st->rtt_min_ns / 1e6, st->rtt_mean_ns / 1e6, st->rtt_max_ns / 1e6,
+				st->rtt_mdev_ns / 1e6, st->jitter_ns / 1e6);
+		}
+		if (r->histogram) {
+			printf(", p50/p90/p99 %.3f/%.3f/%.3f ms",
+				wsping_histogram_percentile(r->histogram, 50) / 1e6,
+				wsping_histogram_percentile(r->histogram, 90) / 1e6,
+				wsping_histogram_percentile(r->histogram, 99) / 1e6);
+		}
+		printf("\n");
+	}
+
+	uint64_t records = wsping_analysis_get_records(a);
+	printf("%d targets, %llu records, %llu successful, %.1f ms, %.1f M records/sec\n",
+		wsping_analysis_get_target_count(a), (unsigned long long)records,
+		(unsigned long long)successful, elapsed / 1e6, records * 1e3 / (double)(elapsed ? elapsed : 1));
+
+	wsping_analysis_destroy(a);
+	return 0;
+}
@@ -0,0 +1,659 @@
+/**
+ * WSPing Benchmarks...
+ *
+ * Microbenchmarks for the wsping hot paths, run against loopback.
+ * Usage: wsping-bench [benchmark...], runs every benchmark by default.
+ *
+ * Heap allocations are counted by wrapping malloc and friends at link
+ * time (-Wl,--wrap=malloc,...), see the bench target in the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "wsping.h"
+
+/*------------------------*
+ | Heap Allocation Counter |
+ *------------------------*/
+
+static size_t heap_allocs = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+	heap_allocs++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+	heap_allocs++;
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+	heap_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+/*------------------*
+ | Benchmark Helpers |
+ *------------------*/
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void wsping_error(void* udata, const char* msg)
+{
+	(void)udata;
+	fprintf(stderr, "WSPing Error: %s\n", msg);
+}
+
+static wsping_session_t* start_session(const char* target, wsping_ip_version_t version, uint32_t size, uint32_t window)
+{
+	wsping_session_t* s = wsping_session_create(wsping_error, NULL);
+	if (!s) {
+		return NULL;
+	}
+
+	wsping_options_t opts = {0};
+	opts.target_site = target;
+	opts.ip_version = version;
+	opts.request_size = size;
+	opts.window = window;
+	opts.timeout = 1000;
+	if (!wsping_session_start(s, &opts)) {
+		wsping_session_destroy(s);
+		return NULL;
+	}
+	return s;
+}
+
+/*------------*
+ | Benchmarks |
+ *------------*/
+
+// Heap allocations and cost per probe of wsping_session_refresh()
+// and of the send/poll pipeline, once the session is warmed up
+static void bench_alloc()
+{
+	static const struct { const char* target; wsping_ip_version_t version; uint32_t size; } cases[] = {
+		{ "127.0.0.1", wsping_ipv4, 32 },
+		{ "127.0.0.1", wsping_ipv4, 65500 },
+		{ "::1",       wsping_ipv6, 32 },
+		{ "::1",       wsping_ipv6, 65500 },
+	};
+	const int probes = 20000;
+	wsping_reply_t replies[WSPING_MAX_WINDOW];
+
+	printf("%-10s %-6s %-8s %12s %14s\n", "target", "size", "path", "ns/probe", "allocs/probe");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		// Blocking refresh
+		wsping_session_t* s = start_session(cases[i].target, cases[i].version, cases[i].size, 1);
+		if (!s) {
+			continue;
+		}
+		for (int p = 0; p < 100; p++) {
+			wsping_session_refresh(s);
+		}
+		size_t allocs = heap_allocs;
+		uint64_t start = now_ns();
+		for (int p = 0; p < probes; p++) {
+			wsping_session_refresh(s);
+		}
+		uint64_t elapsed = now_ns() - start;
+		printf("%-10s %-6u %-8s %12.0f %14.3f\n", cases[i].target, cases[i].size, "refresh",
+			(double)elapsed / probes, (double)(heap_allocs - allocs) / probes);
+		wsping_session_destroy(s);
+
+		// Send/poll pipeline with a full window
+		s = start_session(cases[i].target, cases[i].version, cases[i].size, WSPING_MAX_WINDOW);
+		if (!s) {
+			continue;
+		}
+		allocs = heap_allocs;
+		start = now_ns();
+		int sent = 0;
+		int done = 0;
+		while (done < probes) {
+			while (sent < probes && wsping_session_send(s) >= 0) {
+				sent++;
+			}
+			done += wsping_session_poll(s, replies, WSPING_MAX_WINDOW, 1000);
+		}
+		elapsed = now_ns() - start;
+		printf("%-10s %-6u %-8s %12.0f %14.3f\n", cases[i].target, cases[i].size, "pipeline",
+			(double)elapsed / probes, (double)(heap_allocs - allocs) / probes);
+		wsping_session_destroy(s);
+	}
+}
+
+// Accuracy of the background scheduler at short intervals
+static void bench_sched()
+{
+	static const uint32_t intervals[] = { 1, 2, 5, 10 };
+	const uint32_t duration = 2000;
+
+	printf("%-10s %10s %10s %14s %8s\n", "interval", "requested", "achieved", "late max (us)", "skipped");
+	for (size_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+		wsping_session_t* s = wsping_session_create(wsping_error, NULL);
+		if (!s) {
+			continue;
+		}
+
+		wsping_options_t opts = {0};
+		opts.target_site = "127.0.0.1";
+		opts.interval = intervals[i];
+		opts.count = duration / intervals[i];
+		if (wsping_session_start(s, &opts) && wsping_session_run(s, NULL, NULL)) {
+			wsping_session_wait(s);
+
+			wsping_stats_t stats;
+			wsping_session_get_stats(s, &stats);
+			printf("%-10u %10.1f %10.1f %14.1f %8llu\n", intervals[i], stats.rate_requested, stats.rate_achieved,
+				stats.send_late_max_ns / 1000.0, (unsigned long long)stats.echos_skipped);
+		}
+		wsping_session_destroy(s);
+	}
+}
+
+// Cost of recording into the latency histogram, with round trip
+// times spread over several powers of two like a real network
+static void bench_hist()
+{
+	static wsping_histogram_t h;
+	static wsping_histogram_t merged;
+	static uint64_t values[1 << 16];
+	const int rounds = 200;
+
+	// xorshift, 20 us to ~11 ms
+	uint64_t x = 88172645463325252ULL;
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		values[i] = (20000 + (x & 0xffff)) << (x >> 60 & 7);
+	}
+
+	uint64_t start = now_ns();
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+			wsping_histogram_record(&h, values[i]);
+		}
+	}
+	uint64_t elapsed = now_ns() - start;
+	double inserts = (double)rounds * (sizeof(values) / sizeof(values[0]));
+	printf("%-12s %10.2f ns/op\n", "record", (double)elapsed / inserts);
+
+	volatile uint64_t sink = 0;
+	start = now_ns();
+	for (int r = 0; r < 1000; r++) {
+		sink += wsping_histogram_percentile(&h, 99.9);
+	}
+	printf("%-12s %10.0f ns/op\n", "percentile", (double)(now_ns() - start) / 1000);
+
+	start = now_ns();
+	for (int r = 0; r < 1000; r++) {
+		wsping_histogram_merge(&merged, &h);
+	}
+	printf("%-12s %10.0f ns/op\n", "merge", (double)(now_ns() - start) / 1000);
+
+	printf("p50 %.1f us, p99 %.1f us, p99.9 %.1f us over %.0f values\n",
+		wsping_histogram_percentile(&h, 50) / 1000.0,
+		wsping_histogram_percentile(&h, 99) / 1000.0,
+		wsping_histogram_percentile(&h, 99.9) / 1000.0, inserts);
+}
+
+// Byte at a time reference for the payload check
+static size_t mismatch_bytes(const uint8_t* a, const uint8_t* b, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (a[i] != b[i]) {
+			return i;
+		}
+	}
+	return size;
+}
+
+// Throughput of checking echoed data against the request, for
+// request sizes from a small ping to the largest one
+static void bench_payload()
+{
+	static uint8_t expected[65536];
+	static uint8_t echoed[65536];
+	const size_t total = (size_t)1 << 30;   // Bytes checked per size
+
+	wsping_payload_fill(expected, sizeof(expected), wsping_payload_random, 1, NULL, 0);
+	memcpy(echoed, expected, sizeof(echoed));
+
+	printf("%-8s %12s %12s %12s %10s\n", "size", "wsping GB/s", "bytes GB/s", "memcmp GB/s", "ns/check");
+	for (size_t size = 64; size <= sizeof(expected); size *= 4) {
+		size_t rounds = total / size;
+		volatile size_t sink = 0;
+
+		// Read back every round so no call is hoisted out of the loop
+		const uint8_t* volatile data = echoed;
+
+		uint64_t start = now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			sink += wsping_payload_mismatch(expected, data, size);
+		}
+		uint64_t simd = now_ns() - start;
+
+		// Fewer rounds for the slow reference
+		size_t slow_rounds = rounds / 8;
+		start = now_ns();
+		for (size_t r = 0; r < slow_rounds; r++) {
+			sink += mismatch_bytes(expected, data, size);
+		}
+		uint64_t bytes = now_ns() - start;
+
+		start = now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			sink += (size_t)memcmp(expected, data, size);
+		}
+		uint64_t libc = now_ns() - start;
+
+		printf("%-8zu %12.2f %12.2f %12.2f %10.1f\n", size,
+			(double)size * rounds / (double)simd,
+			(double)size * slow_rounds / (double)bytes,
+			(double)size * rounds / (double)libc,
+			(double)simd / (double)rounds);
+	}
+}
+
+// RFC 1071 reference, one 16-bit word at a time
+static uint16_t checksum_words(const uint8_t* p, size_t size)
+{
+	uint32_t sum = 0;
+	for (; size >= 2; p += 2, size -= 2) {
+		uint16_t word;
+		memcpy(&word, p, 2);
+		sum += word;
+	}
+	if (size == 1) {
+		uint8_t last[2] = { p[0], 0 };
+		uint16_t word;
+		memcpy(&word, last, 2);
+		sum += word;
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (uint16_t)~sum;
+}
+
+// Full checksum throughput against the word loop, and the cost of
+// patching a prebuilt packet instead
+static void bench_checksum()
+{
+	static uint8_t packet[65536];
+	const size_t total = (size_t)1 << 30;   // Bytes summed per size
+
+	wsping_payload_fill(packet, sizeof(packet), wsping_payload_random, 1, NULL, 0);
+
+	printf("%-8s %12s %12s %10s\n", "size", "wsping GB/s", "words GB/s", "ns/packet");
+	for (size_t size = 64; size <= sizeof(packet); size *= 4) {
+		size_t rounds = total / size;
+		volatile uint16_t sink = 0;
+		const uint8_t* volatile data = packet;
+
+		uint64_t start = now_ns();
+		for (size_t r = 0; r < rounds; r++) {
+			sink ^= wsping_checksum(data, size);
+		}
+		uint64_t simd = now_ns() - start;
+
+		size_t slow_rounds = rounds / 8;
+		start = now_ns();
+		for (size_t r = 0; r < slow_rounds; r++) {
+			sink ^= checksum_words(data, size);
+		}
+		uint64_t words = now_ns() - start;
+
+		if (wsping_checksum(packet, size) != checksum_words(packet, size)) {
+			printf("checksum mismatch at %zu bytes\n", size);
+		}
+		printf("%-8zu %12.2f %12.2f %10.1f\n", size,
+			(double)size * rounds / (double)simd,
+			(double)size * slow_rounds / (double)words,
+			(double)simd / (double)rounds);
+	}
+
+	// Sequence number patch of a template, any size
+	const int updates = 100000000;
+	uint16_t seq = 0;
+	memcpy(packet, &seq, 2);
+	uint16_t checksum = wsping_checksum(packet, 1024);
+	uint64_t start = now_ns();
+	for (int i = 0; i < updates; i++) {
+		uint16_t next = (uint16_t)(seq + 1);
+		checksum = wsping_checksum_adjust(checksum, seq, next);
+		seq = next;
+	}
+	uint64_t elapsed = now_ns() - start;
+	memcpy(packet, &seq, 2);
+	printf("incremental update: %.2f ns, %s\n", (double)elapsed / updates,
+		checksum == wsping_checksum(packet, 1024) ? "matches" : "DIFFERS from full checksum");
+}
+
+// Append cost and size of probe log records, like a sweep of 10k
+// targets at 1 ms steps would write them
+static void bench_record()
+{
+	const char* path = "wsping-bench.log";
+	const int records = 20000000;
+
+	wsping_recorder_t* r = wsping_recorder_create(path, NULL, wsping_error, NULL);
+	if (!r) {
+		return;
+	}
+
+	wsping_record_t rec = {0};
+	rec.time_ns = 1700000000000000000ULL;
+	rec.size = 32;
+	rec.ttl = 64;
+	size_t allocs = heap_allocs;
+	uint64_t start = now_ns();
+	for (int i = 0; i < records; i++) {
+		rec.time_ns += 100000;
+		rec.target = (uint32_t)(i % 10000);
+		rec.sequence = (uint16_t)i;
+		rec.status = (i % 50) == 0 ? wsping_reply_timed_out : wsping_reply_ok;
+		rec.rtt_ns = rec.status == wsping_reply_ok ? 200000 + (uint64_t)(i % 977) * 1000 : 0;
+		wsping_recorder_append(r, &rec);
+	}
+	uint64_t elapsed = now_ns() - start;
+	uint64_t size = wsping_recorder_get_size(r);
+	wsping_recorder_destroy(r);
+	remove(path);
+
+	printf("%d records, %.1f ns/record, %.2f bytes/record, %.1f M records/sec, %zu allocs\n",
+		records, (double)elapsed / records, (double)size / records,
+		records * 1e3 / (double)elapsed, heap_allocs - allocs);
+}
+
+// Log analysis throughput with one thread and with one per CPU, the
+// merged stats have to come out the same either way
+static void bench_analyze()
+{
+	const char* path = "wsping-bench.log";
+	const int records = 20000000;
+	const int targets = 1000;
+
+	wsping_recorder_t* r = wsping_recorder_create(path, NULL, wsping_error, NULL);
+	if (!r) {
+		return;
+	}
+	wsping_record_t rec = {0};
+	rec.time_ns = 1700000000000000000ULL;
+	rec.size = 32;
+	for (int i = 0; i < records; i++) {
+		rec.time_ns += 10000;
+		rec.target = (uint32_t)(i % targets);
+		rec.sequence = (uint16_t)i;
+		rec.status = (i % 97) == 0 ? wsping_reply_timed_out : wsping_reply_ok;
+		rec.rtt_ns = rec.status == wsping_reply_ok ? 200000 + (uint64_t)i * 7919 % 100003 * 10 : 0;
+		wsping_recorder_append(r, &rec);
+	}
+	uint64_t size = wsping_recorder_get_size(r);
+	wsping_recorder_destroy(r);
+
+	printf("%d records, %.0f MB\n", records, size / 1e6);
+	// 0 threads is one per CPU
+	static const uint32_t threads[] = { 1, 4, 0 };
+	wsping_analysis_t* single = NULL;
+	printf("%-8s %10s %14s %10s %8s\n", "threads", "ms", "M records/s", "GB/s", "same");
+	for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		wsping_analysis_options_t opts = {0};
+		opts.threads = threads[t];
+		opts.histograms = true;
+		wsping_analysis_t* a = wsping_analysis_create(&opts, wsping_error, NULL);
+		if (!a) {
+			break;
+		}
+		uint64_t start = now_ns();
+		bool ok = wsping_analysis_add_log(a, path);
+		uint64_t elapsed = now_ns() - start;
+		if (!ok) {
+			wsping_analysis_destroy(a);
+			break;
+		}
+
+		bool same = true;
+		for (int i = 0; single && i < wsping_analysis_get_target_count(a); i++) {
+			const wsping_analysis_result_t* x = wsping_analysis_get_result(single, i);
+			const wsping_analysis_result_t* y = wsping_analysis_get_result(a, i);
+			same = same && x->stats.echos_successful == y->stats.echos_successful &&
+				x->stats.rtt_total_ns == y->stats.rtt_total_ns &&
+				fabs(x->stats.rtt_stddev_ns - y->stats.rtt_stddev_ns) <= 1e-9 * x->stats.rtt_stddev_ns &&
+				fabs(x->stats.jitter_ns - y->stats.jitter_ns) <= 1e-9 * x->stats.jitter_ns &&
+				memcmp(x->histogram, y->histogram, sizeof(wsping_histogram_t)) == 0;
+		}
+		char label[16];
+		snprintf(label, sizeof(label), threads[t] ? "%u" : "per CPU", threads[t]);
+		printf("%-8s %10.1f %14.1f %10.2f %8s\n", label, elapsed / 1e6,
+			records * 1e3 / (double)elapsed, (double)size / (double)elapsed, single ? (same ? "yes" : "NO") : "-");
+		if (single) {
+			wsping_analysis_destroy(a);
+		} else {
+			single = a;
+		}
+	}
+	wsping_analysis_destroy(single);
+	remove(path);
+}
+
+// A scrape sends the pieces as they are, nothing is copied
+static void count_piece(void* udata, const char* text, size_t size)
+{
+	(void)text;
+	(void)size;
+	(*(size_t*)udata)++;
+}
+
+// Observe cost and scrape rendering time for a large sweep, the first
+// render builds the text of every target, later ones only of the
+// targets that had results since
+static void bench_exporter()
+{
+	const int targets = 50000;
+	const int observations = 10000000;
+
+	wsping_exporter_options_t opts = {0};
+	opts.port = 19464;
+	wsping_exporter_t* e = wsping_exporter_create(&opts, wsping_error, NULL);
+	if (!e) {
+		return;
+	}
+	char name[32];
+	for (int i = 0; i < targets; i++) {
+		snprintf(name, sizeof(name), "10.%d.%d.%d", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+		wsping_exporter_add_target(e, name, name);
+	}
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < observations; i++) {
+		wsping_reply_status_t status = (i % 50) == 0 ? wsping_reply_timed_out : wsping_reply_ok;
+		wsping_exporter_observe(e, i % targets, status, 200000 + (uint64_t)(i % 977) * 10000);
+	}
+	uint64_t elapsed = now_ns() - start;
+	printf("%d targets, observe %.1f ns\n", targets, (double)elapsed / observations);
+
+	printf("%-24s %10s %10s %8s %8s\n", "render", "ms", "MB", "pieces", "allocs");
+	for (int pass = 0; pass < 3; pass++) {
+		// One percent of the targets changed before the second pass
+		if (pass == 1) {
+			for (int i = 0; i < targets; i += 100) {
+				wsping_exporter_observe(e, i, wsping_reply_ok, 300000);
+			}
+		}
+		size_t allocs = heap_allocs;
+		size_t pieces = 0;
+		start = now_ns();
+		size_t size = wsping_exporter_render(e, count_piece, &pieces);
+		elapsed = now_ns() - start;
+		static const char* const labels[] = { "full", "1% of targets changed", "unchanged" };
+		printf("%-24s %10.3f %10.1f %8zu %8zu\n", labels[pass], elapsed / 1e6, size / 1e6, pieces, heap_allocs - allocs);
+	}
+	wsping_exporter_destroy(e);
+}
+
+// Cost per result line of the JSON Lines and CSV output written to
+// a file, next to the same JSON line through fprintf()
+static void bench_output()
+{
+	const char* path = "wsping-bench.out";
+	const int records = 2000000;
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		return;
+	}
+
+	wsping_record_t rec = {0};
+	rec.size = 32;
+	rec.ttl = 56;
+	char names[100][32];
+	for (int i = 0; i < 100; i++) {
+		snprintf(names[i], sizeof(names[i]), "10.0.%d.%d", i / 10, i);
+	}
+
+	printf("%-10s %10s %10s %12s %8s\n", "format", "ns/line", "MB/s", "lines/sec", "allocs");
+	for (int f = 0; f < 3; f++) {
+		wsping_output_options_t opts = {0};
+		opts.format = f == 1 ? wsping_output_csv : wsping_output_json;
+		wsping_output_t* o = f < 2 ? wsping_output_create(file, &opts, wsping_error, NULL) : NULL;
+		if (f < 2 && !o) {
+			break;
+		}
+		long before = ftell(file);
+		rec.time_ns = 1700000000000000000ULL;
+		size_t allocs = heap_allocs;
+		uint64_t start = now_ns();
+		for (int i = 0; i < records; i++) {
+			rec.time_ns += 10000;
+			rec.target = (uint32_t)(i % 100);
+			rec.sequence = (uint16_t)i;
+			rec.status = (i % 50) == 0 ? wsping_reply_timed_out : wsping_reply_ok;
+			rec.rtt_ns = rec.status == wsping_reply_ok ? 200000 + (uint64_t)(i % 977) * 1000 : 0;
+			if (o) {
+				wsping_output_write(o, &rec, names[rec.target], names[rec.target]);
+			} else {
+				fprintf(file, "{\"time\":%.6f,\"id\":%u,\"target\":\"%s\",\"address\":\"%s\",\"seq\":%u,"
+					"\"status\":\"%s\",\"rtt_ns\":%llu,\"ttl\":%u,\"size\":%u}\n",
+					rec.time_ns / 1e9, rec.target, names[rec.target], names[rec.target], rec.sequence,
+					rec.status == wsping_reply_ok ? "ok" : "timed_out", (unsigned long long)rec.rtt_ns, rec.ttl, rec.size);
+			}
+		}
+		wsping_output_destroy(o);
+		fflush(file);
+		uint64_t elapsed = now_ns() - start;
+		allocs = heap_allocs - allocs;
+		long bytes = ftell(file) - before;
+
+		static const char* const labels[] = { "json", "csv", "fprintf" };
+		printf("%-10s %10.1f %10.1f %12.0f %8zu\n", labels[f], (double)elapsed / records,
+			bytes * 1e3 / (double)elapsed, records * 1e9 / (double)elapsed, allocs);
+	}
+	fclose(file);
+	remove(path);
+}
+
+// A sweep with far more than 65536 probes in flight within one
+// timeout, answered loopback targets mixed with lost ones, has to
+// complete every probe. Raw sockets when running as root
+static void bench_sweep()
+{
+	const int lost = 256;
+	const int targets = lost + 4 * 65536;
+	static char names[4 * 65536 + 256][24];
+	static const char* list[4 * 65536 + 256];
+	for (int i = 0; i < targets; i++) {
+		if (i < lost) {
+			snprintf(names[i], sizeof(names[i]), "10.255.255.%d", i & 255);
+		} else {
+			int n = i - lost;
+			snprintf(names[i], sizeof(names[i]), "127.%d.%d.%d", (n >> 16) & 255, (n >> 8) & 255, n & 255);
+		}
+		list[i] = names[i];
+	}
+
+	wsping_sweep_options_t opts = {0};
+	opts.count = 2;
+	opts.interval = 100;
+	opts.timeout = 1000;
+	opts.sockets = 2;
+	opts.raw_sockets = geteuid() == 0;
+	wsping_sweep_t* sw = wsping_sweep_create(&opts, wsping_error, NULL);
+	if (!sw) {
+		return;
+	}
+	uint64_t start = now_ns();
+	if (!wsping_sweep_add_targets(sw, list, targets) || !wsping_sweep_run(sw)) {
+		wsping_sweep_destroy(sw);
+		return;
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	uint64_t sent = 0;
+	uint64_t replies = 0;
+	for (int i = 0; i < wsping_sweep_get_target_count(sw); i++) {
+		const wsping_sweep_result_t* r = wsping_sweep_get_result(sw, i);
+		sent += r->sent;
+		replies += r->successful;
+	}
+	printf("%d targets, %llu probes, %llu replies, %.0f probes/sec, %.1f s, %s\n", targets,
+		(unsigned long long)sent, (unsigned long long)replies, wsping_sweep_get_probe_rate(sw),
+		elapsed / 1e9, sent == (uint64_t)targets * opts.count ? "all completed" : "INCOMPLETE");
+	wsping_sweep_destroy(sw);
+}
+
+static const struct
+{
+	const char* name;
+	void (*run)();
+	const char* desc;
+}
+benchmarks[] = {
+	{ "alloc", bench_alloc, "heap allocations and ns per probe in steady state" },
+	{ "analyze", bench_analyze, "probe log analysis throughput, single vs all threads" },
+	{ "checksum", bench_checksum, "Internet checksum throughput, 64 B to 64 KB, and template updates" },
+	{ "exporter", bench_exporter, "metrics observe cost and full vs incremental scrape rendering" },
+	{ "hist",  bench_hist,  "latency histogram record, percentile and merge cost" },
+	{ "output", bench_output, "JSON Lines and CSV formatting cost per result, against fprintf" },
+	{ "payload", bench_payload, "echoed data check throughput, 64 B to 64 KB" },
+	{ "record", bench_record, "probe log append cost and record size" },
+	{ "sched", bench_sched, "requested vs achieved rate of the background scheduler" },
+	{ "sweep", bench_sweep, "sweep with more probes in flight than one socket has sequence numbers" },
+};
+
+int main(int argc, char** argv)
+{
+	const int count = (int)(sizeof(benchmarks) / sizeof(benchmarks[0]));
+	for (int i = 0; i < count; i++) {
+		bool selected = argc == 1;
+		for (int a = 1; a < argc; a++) {
+			selected = selected || strcmp(argv[a], benchmarks[i].name) == 0;
+		}
+		if (selected) {
+			printf("== %s: %s\n", benchmarks[i].name, benchmarks[i].desc);
+			benchmarks[i].run();
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -4,12 +4,19 @@
  * Example basic usage of wsping with STD C++ library. 
  */
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <csignal>
+#include <unistd.h>
+#endif
 
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+#include <mutex>
 
 #include "wsping.h"
 
@@ -24,21 +31,37 @@ public:
 	static AppState instance;
 
 private:
+#ifdef _WIN32
 	static BOOL WINAPI ConsoleCtrlHandler(DWORD ctrltype);
+	typedef WORD text_color;
+#else
+	static void SignalHandler(int signum);
+	typedef const char* text_color;
+#endif
 	static void wsping_error(void* udata, const char* msg);
+	static void wsping_reply(void* udata, const wsping_reply_t* reply);
+	static void set_text_color(text_color color);
+	static void sleep_ms(int ms);
+	static bool error_reported();
+	static void check_error();
 
 	void init();
 	void start_pinging();
 	void stop_pinging();
 	void print_stats();
-	void ping_once();
+	void print_reply(const wsping_reply_t* reply);
 
 	// Ping options
 	int _timeout = 4000;
 	int _request_size = 32;
 	int _ttl = 128;
+	int _interval = 1000;
+	int _count = 0;
+	int _metrics_port = 0;
 	bool _ping_started = false;
 	std::string _target_site;
+	std::string _payload;
+	wsping_exporter_t* _exporter = nullptr;
 
 	// Ping stats
 	// Common info
@@ -48,16 +71,10 @@ private:
 	int data_size = 0;
 	int ttl = 0;
 	int reply_time = 0;
-	// Packets
-	uint32_t sent = 0;
-	uint32_t received = 0;
-	uint32_t lost = 0;
-	uint32_t percent_lost = 0;
-	// Round trip time
-	uint32_t rt_min = 0;
-	uint32_t rt_max = 0;
-	uint32_t rt_avg = 0;
+	// Round trip times, too large for the stack of a signal thread
+	wsping_histogram_t rtt_hist = {};
 
+#ifdef _WIN32
 	// Native handle for Stdout console, its recommended
 	// for using static variable for all Winapi stuff if we use C++
 	// to prevent runtime errors.
@@ -69,18 +86,69 @@ private:
 	static constexpr WORD YELLOW_TEXT = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
 	static constexpr WORD CYAN_TEXT   = FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
 	static constexpr WORD NORMAL_TEXT = FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+#else
+	// Ctrl+\ asks the ping loop to print the stats, printing
+	// from inside a signal handler is not safe
+	static volatile sig_atomic_t print_requested;
+
+	// ANSI escape sequences for the same console colors
+	static constexpr text_color GREEN_TEXT  = "\033[1;32m";
+	static constexpr text_color RED_TEXT    = "\033[1;31m";
+	static constexpr text_color YELLOW_TEXT = "\033[1;33m";
+	static constexpr text_color CYAN_TEXT   = "\033[1;36m";
+	static constexpr text_color NORMAL_TEXT = "\033[0m";
+#endif
+
+	// First error reported by wsping, the callback may run on the
+	// wsping thread or the exporter's listener thread, so only the
+	// main thread throws it
+	static std::mutex error_lock;
+	static std::string error_text;
 };
 
-// Static initializers
+// Static initializers, the error ones come first since
+// the constructor of instance may already report an error
+std::mutex  AppState::error_lock;
+std::string AppState::error_text;
 AppState AppState::instance;
+#ifdef _WIN32
 HANDLE   AppState::hStdout;
-
-// WSPing error callback
+#else
+volatile sig_atomic_t AppState::print_requested = 0;
+constexpr AppState::text_color AppState::GREEN_TEXT;
+constexpr AppState::text_color AppState::RED_TEXT;
+constexpr AppState::text_color AppState::YELLOW_TEXT;
+constexpr AppState::text_color AppState::CYAN_TEXT;
+constexpr AppState::text_color AppState::NORMAL_TEXT;
+#endif
+
+// WSPing error callback, an exception must not escape into
+// wsping or end a thread of its own, so keep the message
 void AppState::wsping_error(void* udata, const char* msg)
 {
-	std::stringstream buf;
-	buf << "WSPing Error: " << msg << std::endl;
-	throw std::runtime_error(buf.str());
+	std::lock_guard<std::mutex> lock(error_lock);
+	if (error_text.empty()) {
+		error_text = std::string("WSPing Error: ") + msg;
+	}
+}
+
+bool AppState::error_reported()
+{
+	std::lock_guard<std::mutex> lock(error_lock);
+	return !error_text.empty();
+}
+
+// Throw the error reported by wsping, on the main thread only
+void AppState::check_error()
+{
+	std::string msg;
+	{
+		std::lock_guard<std::mutex> lock(error_lock);
+		msg.swap(error_text);
+	}
+	if (!msg.empty()) {
+		throw std::runtime_error(msg);
+	}
 }
 
 // We can put WSPing initializer and deinitializer
@@ -90,6 +158,7 @@ AppState::AppState()
 	instance = *this;
 
 	if (!wsping_init(wsping_error, this)) {
+		std::cerr << error_text << std::endl;
 		exit(1);
 	}	
 }
@@ -97,6 +166,7 @@ AppState::AppState()
 AppState::~AppState()
 {
 	wsping_shutdown();
+	wsping_exporter_destroy(_exporter);
 }
 
 // Macro for set default value from stdin, if the user
@@ -111,6 +181,28 @@ AppState::~AppState()
 		(var) = (def); \
 	}
 
+// Change the color of the next console output
+void AppState::set_text_color(text_color color)
+{
+#ifdef _WIN32
+	SetConsoleTextAttribute(hStdout, color);
+#else
+	std::cout << color;
+#endif
+}
+
+// Wait between two requests
+void AppState::sleep_ms(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	// Interrupted early when a signal arrives, that is fine
+	usleep(ms * 1000);
+#endif
+}
+
+#ifdef _WIN32
 // Callback function for Ctrl key press
 BOOL WINAPI AppState::ConsoleCtrlHandler(DWORD ctype)
 {
@@ -134,12 +226,26 @@ BOOL WINAPI AppState::ConsoleCtrlHandler(DWORD ctype)
 
 	return FALSE;
 }
+#else
+// Callback function for Ctrl+C (SIGINT) and Ctrl+\ (SIGQUIT)
+void AppState::SignalHandler(int signum)
+{
+	if (signum == SIGQUIT) {
+		// Ctrl+\ = Print stats, but continue pinging the site
+		print_requested = 1;
+	} else {
+		// Ctrl+C = Stop pinging, the stats are printed after the loop
+		instance.stop_pinging();
+	}
+}
+#endif
 
 // Main initialization function
 void AppState::init()
 {
 	std::stringstream msgbuf;
 
+#ifdef _WIN32
 	// Get the handle for stdout console
 	hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
 	if (hStdout == INVALID_HANDLE_VALUE) {
@@ -154,16 +260,25 @@ void AppState::init()
 		msgbuf << "Failed to set Ctrl handler: " << GetLastError();
 		throw std::runtime_error(msgbuf.str());
 	}
+#else
+	// Set the signal handlers for Ctrl key press
+	std::signal(SIGINT, AppState::SignalHandler);
+	std::signal(SIGQUIT, AppState::SignalHandler);
+#endif
 
 	// Show application console
-	SetConsoleTextAttribute(hStdout, CYAN_TEXT);
+	set_text_color(CYAN_TEXT);
 	std::cout << "*************************************" << std::endl;
 	std::cout << "* WSPing Interactive Console v0.0.1 *" << std::endl;
 	std::cout << "*************************************" << std::endl;
 	std::cout << std::endl;
 
-	SetConsoleTextAttribute(hStdout, NORMAL_TEXT);
+	set_text_color(NORMAL_TEXT);
+#ifdef _WIN32
 	std::cout << "Hint: Press Ctrl+C to quit, Ctrl+Break to show statistics." << std::endl;
+#else
+	std::cout << "Hint: Press Ctrl+C to quit, Ctrl+\\ to show statistics." << std::endl;
+#endif
 	std::cout << std::endl;
 	std::cout << "Ping Configuration (Press enter to skip)" << std::endl;
 
@@ -174,6 +289,18 @@ void AppState::init()
 	std_cin_default_prompt(input, _timeout,      4000,             ">> Timeout in milliseconds (default 4000): ");
 	std_cin_default_prompt(input, _request_size, 32,               ">> Send buffer size (default 32): ");
 	std_cin_default_prompt(input, _ttl,          128,              ">> TTL (default 128): ");
+	std_cin_default_prompt(input, _interval,     1000,             ">> Interval in milliseconds (default 1000): ");
+	std_cin_default_prompt(input, _count,        0,                ">> Number of requests (default 0, until stopped): ");
+	std_cin_default_prompt(input, _payload,      "zero",           ">> Data pattern, zero, increment or random (default zero): ");
+	std_cin_default_prompt(input, _metrics_port, 0,                ">> Metrics port (default 0, none): ");
+
+	// Prometheus can scrape the results from http://127.0.0.1:port/metrics
+	if (_metrics_port > 0) {
+		wsping_exporter_options_t export_opts = {};
+		export_opts.port = (uint16_t)_metrics_port;
+		_exporter = wsping_exporter_create(&export_opts, wsping_error, this);
+		check_error();
+	}
 
 	// Start wsping library
 	wsping_options_t opts = {};
@@ -183,34 +310,40 @@ void AppState::init()
 	opts.timeout = _timeout;
 	opts.request_size = _request_size;
 	opts.ttl = _ttl;
+	opts.interval = _interval;
+	opts.count = _count;
+	if (_payload == "increment") {
+		opts.payload = wsping_payload_increment;
+	} else if (_payload == "random") {
+		opts.payload = wsping_payload_random;
+	}
+	opts.exporter = _exporter;
 	_ping_started = wsping_start(&opts);
+	check_error();
 }
 
-// Send ping request to target site once
-void AppState::ping_once()
+// Called on the wsping thread for every completed request
+void AppState::wsping_reply(void* udata, const wsping_reply_t* reply)
 {
-	// Send a request to the target site
-	wsping_refresh();
+	AppState* app = (AppState*)udata;
+	app->print_reply(reply);
+}
 
+// Print the result of the last request
+void AppState::print_reply(const wsping_reply_t* reply)
+{
 	// Update the stats
-	status = wsping_get_status();
-	data_size = wsping_get_data_size();
-	reply_time = wsping_get_reply_time();
-	ttl = wsping_get_ttl();
-	sent = wsping_get_data_sent();
-	received = wsping_get_data_received();
-	lost = sent - received;
-	percent_lost = (uint32_t)((lost / (double)sent) * 100.0);
-	rt_min = wsping_get_rtt_min();
-	rt_max = wsping_get_rtt_max();
-	if (wsping_get_data_successful() > 0) {
-		rt_avg = wsping_get_rtt_total() / wsping_get_data_successful();
-	}
+	wsping_stats_t stats;
+	wsping_get_stats(&stats);
+	status = stats.status_text;
+	data_size = stats.data_size;
+	reply_time = stats.reply_time;
+	ttl = stats.ttl;
 	
 	if (status == "OK") {
 		// Pinging the target site was successful, 
 		// print the reply message in green text
-		SetConsoleTextAttribute(hStdout, GREEN_TEXT);
+		set_text_color(GREEN_TEXT);
 		std::cout << "Reply from " << ip << ":";
 		std::cout << " bytes=" << data_size;
 		if (reply_time == 1) {
@@ -218,11 +351,15 @@ void AppState::ping_once()
 		} else {
 			std::cout << " time=" << reply_time << "ms";
 		}
-		std::cout << " TTL=" << ttl << std::endl;
+		std::cout << " TTL=" << ttl;
+		if (reply->corrupted) {
+			std::cout << " (echoed data corrupted)";
+		}
+		std::cout << std::endl;
 	} else { 
 		// Something wrong happened, 
 		// print status message in red text
-		SetConsoleTextAttribute(hStdout, RED_TEXT);
+		set_text_color(RED_TEXT);
 		std::cout << status << "." << std::endl;
 	}
 }
@@ -235,7 +372,7 @@ void AppState::start_pinging()
 	ip   = wsping_get_target_ip_address();
 	
 	// Print the initial site info
-	SetConsoleTextAttribute(hStdout, YELLOW_TEXT);
+	set_text_color(YELLOW_TEXT);
 	if (!site.empty()) {
 		std::cout << "\nPinging " << site << " [" << ip << "] ";
 	} else {
@@ -243,22 +380,31 @@ void AppState::start_pinging()
 	}
 	std::cout << "with " << _request_size << " bytes of data:" << std::endl << std::endl;
 
-	// Loop until ping stopped
-	while (true) {
-		if (_ping_started) {
-			// Pinging the site once
-			ping_once();			
-		} else {
-			break;
-		}
+	// Send requests once per interval, keep it at a second or
+	// more for sites you don't own, we won't do a DDoS attack
+	// to the target site... it's illegal XD
+	if (!wsping_run(AppState::wsping_reply, this)) {
+		check_error();
+		return;
+	}
 
-		// Ensure we only send a request once per second, 
-		// we won't do a DDoS attack to the target site...
-		// it's illegal XD
-		Sleep(1000); 
+	// The replies are printed from the wsping thread,
+	// just wait here until ping stopped, all requests are done
+	// or something went wrong
+	while (_ping_started && wsping_is_running() && !error_reported()) {
+		sleep_ms(100);
+
+#ifndef _WIN32
+		if (print_requested) {
+			print_requested = 0;
+			print_stats();
+		}
+#endif
 	}
 
+	wsping_stop();
 	print_stats();
+	check_error();
 }
 
 // This function called when user press close button or Ctrl+C
@@ -270,8 +416,18 @@ void AppState::stop_pinging()
 // Print ping detail results to stdout
 void AppState::print_stats()
 {
+	// This may run on the console control thread while pinging,
+	// so take one consistent snapshot of the stats
+	wsping_stats_t stats;
+	wsping_get_stats(&stats);
+	uint64_t sent = stats.echos_sent;
+	uint64_t received = stats.echos_received;
+	uint64_t lost = sent - received;
+	uint32_t percent_lost = sent > 0 ? (uint32_t)((lost / (double)sent) * 100.0) : 0;
+	uint64_t rt_avg = stats.echos_successful > 0 ? stats.rtt_total / stats.echos_successful : 0;
+
 	// Change text to yellow
-	SetConsoleTextAttribute(hStdout, YELLOW_TEXT);
+	set_text_color(YELLOW_TEXT);
 	
 	// Echos sent
 	std::cout << std::endl;
@@ -280,16 +436,46 @@ void AppState::print_stats()
 		      << ", Received = " << received 
 		      << ", Lost = " << lost << " (" << percent_lost << "% loss)" 
 		      << std::endl;
+	std::cout << "\tEchoed data: Corrupted = " << stats.echos_corrupted
+		      << ", Truncated = " << stats.echos_truncated << std::endl;
 
 	// Round trip time
 	std::cout << "Approximate round-trip time in milliseconds:" << std::endl;
-	std::cout << "\tMinimum = " << rt_min << "ms" 
-		      << ", Maximum = " << rt_max << "ms"
+	std::cout << "\tMinimum = " << stats.rtt_min << "ms" 
+		      << ", Maximum = " << stats.rtt_max << "ms"
 		      << ", Average = " << rt_avg << "ms" << std::endl;
 
+	// Round trip time distribution and variation
+	wsping_get_histogram(&rtt_hist);
+	std::cout << "Round-trip time distribution in milliseconds:" << std::endl;
+	std::cout << "\tp50 = " << wsping_histogram_percentile(&rtt_hist, 50.0) / 1e6
+		      << "ms, p99 = " << wsping_histogram_percentile(&rtt_hist, 99.0) / 1e6
+		      << "ms, p99.9 = " << wsping_histogram_percentile(&rtt_hist, 99.9) / 1e6 << "ms" << std::endl;
+	std::cout << "\tMean = " << stats.rtt_mean_ns / 1e6
+		      << "ms, Mdev = " << stats.rtt_mdev_ns / 1e6
+		      << "ms, Jitter = " << stats.jitter_ns / 1e6 << "ms" << std::endl;
+
+	// Same for the most recent requests only, shows an outage
+	// that the totals above would hide after a long run
+	if (stats.recent_probes > 0) {
+		uint32_t recent_lost = stats.recent_probes - stats.recent_successful;
+		std::cout << "Last " << stats.recent_probes << " requests:" << std::endl;
+		std::cout << "\tLost = " << recent_lost << " (" << recent_lost * 100 / stats.recent_probes << "% loss)"
+			      << ", Minimum = " << stats.recent_rtt_min_ns / 1e6
+			      << "ms, Maximum = " << stats.recent_rtt_max_ns / 1e6
+			      << "ms, Average = " << stats.recent_rtt_mean_ns / 1e6 << "ms" << std::endl;
+	}
+
+	// Achieved request rate, drops below the requested one
+	// when requests are late or the window is full
+	std::cout << "Requests per second:" << std::endl;
+	std::cout << "\tRequested = " << stats.rate_requested
+		      << ", Achieved = " << stats.rate_achieved
+		      << ", Skipped = " << stats.echos_skipped << std::endl;
+
 	// Then falling back to normal color if we close the application
 	if (!_ping_started) {
-		SetConsoleTextAttribute(hStdout, NORMAL_TEXT);
+		set_text_color(NORMAL_TEXT);
 	}
 }
 
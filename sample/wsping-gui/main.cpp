@@ -71,10 +71,13 @@ private:
 	int _timeout = 2000;
 	int _request_size = 32;
 	int _ttl = 128;
+	int _interval = 1000;
 	bool _ping_started = false;
 	char _target_site[256] = "";
 
 	// Ping stats
+	wsping_stats_t stats = {};
+	wsping_histogram_t rtt_hist = {};
 	// Common info
 	const char* status = "Ping Stopped";
 	const char* site = "";
@@ -83,20 +86,16 @@ private:
 	int ttl = 0;
 	int reply_time = 0;
 	// Packets
-	uint32_t sent = 0;
-	uint32_t received = 0;
-	uint32_t lost = 0;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t lost = 0;
 	uint32_t percent_lost = 0;
 	// Round trip time
 	uint32_t rt_min = 0;
 	uint32_t rt_max = 0;
-	uint32_t rt_avg = 0;
+	uint64_t rt_avg = 0;
 
 	const char* errormsg = "";
-
-	// Variable to ensure we refresh ping every 1 second
-	bool refresh_now = false;
-	uint64_t last_refresh_time = 0;
 };
 
 static AppState state;
@@ -170,6 +169,7 @@ void AppState::event(const vapp_event* e)
 			_app->quit();
 		} else if (e->modifiers == vapp_kmod_ctrl && e->key_code == vapp_key_c) {
 			// Like original ping application Ctrl+C = stop pinging
+			wsping_stop();
 			_ping_started = false;
 		}
 	}
@@ -186,18 +186,6 @@ void AppState::update()
 	const double dt = _tm->seconds(_tm->delta_time(&_last_time));
 	_imgui->new_frame(width, height, dt);
 
-	// Reload wsping stats
-	if (_ping_started && refresh_now) {
-		wsping_refresh();
-		refresh_now = false;
-	}
-
-	// Ensure to reload wsping every 1 second
-	if (_tm->seconds(_tm->now() - last_refresh_time) >= 1.0) {
-		last_refresh_time = _tm->now();
-		refresh_now = true;
-	}
-
 	// Create the GUI
 	make_gui();
 }
@@ -227,6 +215,8 @@ void AppState::reset_stats()
 	rt_min = 0;
 	rt_max = 0;
 	rt_avg = 0;
+	stats = {};
+	wsping_histogram_reset(&rtt_hist);
 	wsping_reset();
 }
 
@@ -247,7 +237,7 @@ void AppState::create_help_marker(const char* desc)
 void AppState::make_gui()
 {
 	// Set ImGui window's size same as with the our application window's size
-	ImGui::SetNextWindowSize({420, 180}, ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize({420, 200}, ImGuiCond_FirstUseEver);
 	ImGui::SetNextWindowPos({10, 10}, ImGuiCond_FirstUseEver);
 	int winflags = ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove;
 
@@ -258,8 +248,9 @@ void AppState::make_gui()
 		
 		ImGui::SliderInt("Timeout (ms)", &_timeout, 1000, 4000); 
 		ImGui::SameLine();
-		create_help_marker("To prevent GUI's 'Request Timed Out' lagging\nbug, set timeout value to 1000-2000 ms");
+		create_help_marker("Pinging runs on its own thread, a long timeout\nonly delays the 'Request Timed Out' status");
 		
+		ImGui::SliderInt("Interval (ms)", &_interval, 1, 2000);
 		ImGui::SliderInt("Send buffer size", &_request_size, 0, 65500);
 		ImGui::SliderInt("TTL", &_ttl, 1, UCHAR_MAX);
 		ImGui::Separator();
@@ -278,42 +269,50 @@ void AppState::make_gui()
 				opts.request_size = _request_size;
 				opts.ip_version = wsping_ipv4;
 				opts.ttl = _ttl;
+				opts.interval = _interval;
 				_ping_started = wsping_start(&opts);
 
-				// Set starting refresh time
-				last_refresh_time = _tm->now();
-				refresh_now = true;
+				// Ping every interval on the wsping thread,
+				// so a timeout never freezes the GUI. The name
+				// stays the same until the next start
+				if (_ping_started) {
+					site = wsping_get_target_canonical_name();
+					_ping_started = wsping_run(NULL, NULL);
+				}
 			}
 		} else {
 			if (ImGui::Button("Stop Pinging")) {
+				wsping_stop();
 				_ping_started = false;
 			}
 		}
 	}
 	ImGui::End();
 
-	ImGui::SetNextWindowSize({420, 250}, ImGuiCond_FirstUseEver);
-	ImGui::SetNextWindowPos({10, 200}, ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize({420, 345}, ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowPos({10, 220}, ImGuiCond_FirstUseEver);
 
 	// Build statistics window
 	if (ImGui::Begin("Statistics", nullptr, winflags)) {
 		// Get ping datas from wsping
 		if (_ping_started) {
-			status = wsping_get_status();
-			site = wsping_get_target_canonical_name();
-			ip = wsping_get_target_ip_address();
-			data_size = wsping_get_data_size();
-			ttl = wsping_get_ttl();
-			reply_time = wsping_get_reply_time();
-			sent = wsping_get_data_sent();
-			received = wsping_get_data_received();
+			// One snapshot per frame, so the numbers agree with each other
+			wsping_get_stats(&stats);
+			wsping_get_histogram(&rtt_hist);
+			status = stats.status_text;
+			ip = stats.ip_address;
+			data_size = stats.data_size;
+			ttl = stats.ttl;
+			reply_time = stats.reply_time;
+			sent = stats.echos_sent;
+			received = stats.echos_received;
 			lost = sent - received;
 			percent_lost = (ULONG)((lost / (double)sent) * 100.0);
-			rt_min = wsping_get_rtt_min();
-			rt_max = wsping_get_rtt_max();
-			if (wsping_get_data_successful() != 0) { 
+			rt_min = stats.rtt_min;
+			rt_max = stats.rtt_max;
+			if (stats.echos_successful != 0) { 
 				// To prevent divide by zero error
-				rt_avg = wsping_get_rtt_total() / wsping_get_data_successful();
+				rt_avg = stats.rtt_total / stats.echos_successful;
 			}
 		}
 
@@ -325,13 +324,24 @@ void AppState::make_gui()
 		ImGui::Text("Time to live: %d", ttl);
 		ImGui::Text("Reply time: %lums", reply_time);
 		ImGui::Separator();
-		ImGui::Text("Packets sent: %d", sent);
-		ImGui::Text("Packets received: %d", received);
-		ImGui::Text("Packets lost: %d (%d%% loss)", lost, percent_lost);
+		ImGui::Text("Packets sent: %llu", (unsigned long long)sent);
+		ImGui::Text("Packets received: %llu", (unsigned long long)received);
+		ImGui::Text("Packets lost: %llu (%u%% loss)", (unsigned long long)lost, percent_lost);
 		ImGui::Separator();
 		ImGui::Text("Round trip time minimum: %lums", rt_min);
 		ImGui::Text("Round trip time maximum: %lums", rt_max);
-		ImGui::Text("Average round trip time: %lums", rt_avg);
+		ImGui::Text("Average round trip time: %llums", (unsigned long long)rt_avg);
+		ImGui::Text("Round trip time p50 / p99 / p99.9: %.2f / %.2f / %.2fms",
+			wsping_histogram_percentile(&rtt_hist, 50.0) / 1e6,
+			wsping_histogram_percentile(&rtt_hist, 99.0) / 1e6,
+			wsping_histogram_percentile(&rtt_hist, 99.9) / 1e6);
+		ImGui::Text("Round trip time mdev: %.3fms, jitter: %.3fms", stats.rtt_mdev_ns / 1e6, stats.jitter_ns / 1e6);
+		ImGui::Separator();
+		ImGui::Text("Last %u requests: %u lost, %.2f / %.2f / %.2fms", stats.recent_probes,
+			stats.recent_probes - stats.recent_successful, stats.recent_rtt_min_ns / 1e6,
+			stats.recent_rtt_mean_ns / 1e6, stats.recent_rtt_max_ns / 1e6);
+		ImGui::Separator();
+		ImGui::Text("Requests per second: %.1f (requested %.1f)", stats.rate_achieved, stats.rate_requested);
 	}
 	ImGui::End();
 
@@ -0,0 +1,116 @@
+/**
+ * WSPing MTU...
+ *
+ * Example usage of wsping path MTU discovery, every target is
+ * probed by its own session on its own thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "wsping.h"
+
+typedef struct _mtu_job
+{
+	wsping_options_t opts;
+	uint32_t max_size;
+	char address[WSPING_ADDRESS_SIZE];
+	wsping_mtu_t result;
+	bool ok;
+	pthread_t thread;
+}
+mtu_job_t;
+
+static void wsping_error(void* udata, const char* msg)
+{
+	mtu_job_t* job = (mtu_job_t*)udata;
+	fprintf(stderr, "WSPing Error: %s: %s\n", job->opts.target_site, msg);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] target...\n"
+		"  -m size      largest send buffer size to try (default 65500)\n"
+		"  -t timeout   timeout in milliseconds (default 1000)\n"
+		"  -6           use IPv6\n",
+		name);
+}
+
+static void* discover(void* arg)
+{
+	mtu_job_t* job = (mtu_job_t*)arg;
+	wsping_session_t* s = wsping_session_create(wsping_error, job);
+	if (s && wsping_session_start(s, &job->opts)) {
+		snprintf(job->address, sizeof(job->address), "%s", wsping_session_get_target_ip_address(s));
+		job->ok = wsping_session_discover_mtu(s, job->max_size, &job->result);
+	}
+	wsping_session_destroy(s);
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	wsping_options_t opts = {0};
+	uint32_t max_size = 0;
+	int c;
+
+	opts.timeout = 1000;
+	while ((c = getopt(argc, argv, "m:t:6h")) != -1) {
+		switch (c) {
+			case 'm': max_size = (uint32_t)atoi(optarg); break;
+			case 't': opts.timeout = (uint32_t)atoi(optarg); break;
+			case '6': opts.ip_version = wsping_ipv6; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int count = argc - optind;
+	mtu_job_t* jobs = (mtu_job_t*)calloc(count, sizeof(mtu_job_t));
+	if (!jobs) {
+		return 1;
+	}
+	for (int i = 0; i < count; i++) {
+		jobs[i].opts = opts;
+		jobs[i].opts.target_site = argv[optind + i];
+		jobs[i].max_size = max_size;
+		if (pthread_create(&jobs[i].thread, NULL, discover, &jobs[i]) != 0) {
+			discover(&jobs[i]);
+			jobs[i].thread = pthread_self();
+		}
+	}
+
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		mtu_job_t* job = &jobs[i];
+		if (!pthread_equal(job->thread, pthread_self())) {
+			pthread_join(job->thread, NULL);
+		}
+		if (!job->ok) {
+			printf("%s: no reply\n", job->opts.target_site);
+			failed++;
+			continue;
+		}
+
+		const wsping_mtu_t* r = &job->result;
+		printf("%s [%s]: path MTU %u (send buffer size %u), %u probes in %u rounds",
+			job->opts.target_site, job->address, r->mtu, r->payload, r->probes, r->rounds);
+		if (r->reported_mtu != 0) {
+			printf(", next hop MTU %u reported", r->reported_mtu);
+		}
+		if (r->black_hole) {
+			printf(", larger packets are dropped silently (black hole)");
+		}
+		printf("\n");
+	}
+
+	free(jobs);
+	return failed == count ? 1 : 0;
+}
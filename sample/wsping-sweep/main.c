@@ -0,0 +1,279 @@
+/**
+ * WSPing Sweep...
+ *
+ * Example usage of wsping sweep mode, pings a list of targets
+ * (names, addresses or IPv4 ranges like 127.0.0.0/16) and
+ * prints the per target results and probe rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "wsping.h"
+
+static void wsping_error(void* udata, const char* msg)
+{
+	(void)udata;
+	fprintf(stderr, "WSPing Error: %s\n", msg);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] target...\n"
+		"  -c count     probes per target (default 1)\n"
+		"  -i interval  milliseconds between probes to a target (default 1000)\n"
+		"  -r rate      maximum probes per second (default unlimited)\n"
+		"  -t timeout   timeout in milliseconds (default 1000)\n"
+		"  -s size      send buffer size (default 32)\n"
+		"  -n sockets   sockets per IP version (default 1)\n"
+		"  -R           send IPv4 probes through raw sockets (needs CAP_NET_RAW)\n"
+		"  -f file      read targets from file, one per line\n"
+		"  -w log       append every probe result to a binary probe log\n"
+		"  -m port      serve metrics on this port, sweeping again until interrupted\n"
+		"  -o format    stream every probe result to stdout as json or csv lines,\n"
+		"               the results and summary then go to stderr\n"
+		"  -6           use IPv6\n"
+		"  -q           only print the summary\n"
+		"Targets can be IPv4 ranges in CIDR notation, like 127.0.0.0/16.\n",
+		name);
+}
+
+// Targets collected from the command line and file, added in one
+// batch so their names are resolved in parallel
+typedef struct _target_list
+{
+	char** items;
+	int count;
+	int cap;
+}
+target_list_t;
+
+static bool push_target(target_list_t* list, const char* target)
+{
+	if (list->count == list->cap) {
+		int cap = list->cap ? list->cap * 2 : 64;
+		char** items = (char**)realloc(list->items, cap * sizeof(char*));
+		if (!items) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+		list->items = items;
+		list->cap = cap;
+	}
+	list->items[list->count] = strdup(target);
+	if (!list->items[list->count]) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	list->count++;
+	return true;
+}
+
+static void free_targets(target_list_t* list)
+{
+	for (int i = 0; i < list->count; i++) {
+		free(list->items[i]);
+	}
+	free(list->items);
+}
+
+// Add a target, expanding IPv4 CIDR ranges
+static bool add_target(target_list_t* list, const char* target)
+{
+	char buf[64];
+	const char* slash = strchr(target, '/');
+	struct in_addr base;
+
+	if (!slash || (size_t)(slash - target) >= sizeof(buf)) {
+		return push_target(list, target);
+	}
+
+	memcpy(buf, target, slash - target);
+	buf[slash - target] = 0;
+	int bits = atoi(slash + 1);
+	if (inet_pton(AF_INET, buf, &base) != 1 || bits < 8 || bits > 32) {
+		fprintf(stderr, "Invalid range %s, prefix must be /8 to /32\n", target);
+		return false;
+	}
+
+	uint32_t first = ntohl(base.s_addr) & (bits == 32 ? 0xffffffffu : ~(0xffffffffu >> bits));
+	uint64_t count = 1ull << (32 - bits);
+	for (uint64_t i = 0; i < count; i++) {
+		struct in_addr addr;
+		addr.s_addr = htonl(first + (uint32_t)i);
+		inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+		if (!push_target(list, buf)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool add_targets_from_file(target_list_t* list, const char* path)
+{
+	char line[512];
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, " \t\r\n#")] = 0;
+		if (line[0] && !add_target(list, line)) {
+			fclose(f);
+			return false;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+static void print_results(FILE* out, const wsping_sweep_t* sw, bool quiet)
+{
+	int alive = 0;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	for (int i = 0; i < wsping_sweep_get_target_count(sw); i++) {
+		const wsping_sweep_result_t* r = wsping_sweep_get_result(sw, i);
+		sent += r->sent;
+		received += r->successful;
+		if (r->successful > 0) {
+			alive++;
+		}
+		if (!quiet) {
+			fprintf(out, "%s [%s]: %s, sent %llu, received %llu",
+				r->target, r->address, r->successful > 0 ? "alive" : "unreachable",
+				(unsigned long long)r->sent, (unsigned long long)r->successful);
+			if (r->successful > 0) {
+				fprintf(out, ", rtt min/avg/max %.3f/%.3f/%.3f ms", r->rtt_min_ns / 1e6,
+					r->rtt_total_ns / 1e6 / r->successful, r->rtt_max_ns / 1e6);
+			}
+			fprintf(out, "\n");
+		}
+	}
+
+	fprintf(out, "%d targets, %d alive, %llu probes sent, %llu replies, %.0f probes/sec\n",
+		wsping_sweep_get_target_count(sw), alive,
+		(unsigned long long)sent, (unsigned long long)received,
+		wsping_sweep_get_probe_rate(sw));
+}
+
+int main(int argc, char** argv)
+{
+	wsping_sweep_options_t opts = {0};
+	const char* file = NULL;
+	const char* log = NULL;
+	uint16_t metrics_port = 0;
+	const char* format = NULL;
+	bool quiet = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:i:r:t:s:n:f:w:m:o:R6qh")) != -1) {
+		switch (c) {
+			case 'c': opts.count = (uint32_t)atoi(optarg); break;
+			case 'i': opts.interval = (uint32_t)atoi(optarg); break;
+			case 'r': opts.rate = (uint32_t)atoi(optarg); break;
+			case 't': opts.timeout = (uint32_t)atoi(optarg); break;
+			case 's': opts.request_size = (uint32_t)atoi(optarg); break;
+			case 'n': opts.sockets = (uint32_t)atoi(optarg); break;
+			case 'f': file = optarg; break;
+			case 'w': log = optarg; break;
+			case 'm': metrics_port = (uint16_t)atoi(optarg); break;
+			case 'o': format = optarg; break;
+			case 'R': opts.raw_sockets = true; break;
+			case '6': opts.ip_version = wsping_ipv6; break;
+			case 'q': quiet = true; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if ((optind == argc && !file) || (format && strcmp(format, "json") != 0 && strcmp(format, "csv") != 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Target ids in the log are the indexes of the targets, in the
+	// order they were given
+	wsping_recorder_t* recorder = NULL;
+	if (log) {
+		wsping_recorder_options_t log_opts = {0};
+		log_opts.append = true;
+		recorder = wsping_recorder_create(log, &log_opts, wsping_error, NULL);
+		if (!recorder) {
+			return 1;
+		}
+		opts.recorder = recorder;
+	}
+
+	// Results stream to stdout, everything for people to stderr
+	FILE* out = stdout;
+	wsping_output_t* output = NULL;
+	if (format) {
+		wsping_output_options_t output_opts = {0};
+		output_opts.format = strcmp(format, "csv") == 0 ? wsping_output_csv : wsping_output_json;
+		output = wsping_output_create(stdout, &output_opts, wsping_error, NULL);
+		if (!output) {
+			wsping_recorder_destroy(recorder);
+			return 1;
+		}
+		opts.output = output;
+		out = stderr;
+	}
+
+	wsping_exporter_t* exporter = NULL;
+	if (metrics_port) {
+		wsping_exporter_options_t export_opts = {0};
+		export_opts.port = metrics_port;
+		exporter = wsping_exporter_create(&export_opts, wsping_error, NULL);
+		if (!exporter) {
+			wsping_output_destroy(output);
+			wsping_recorder_destroy(recorder);
+			return 1;
+		}
+		opts.exporter = exporter;
+	}
+
+	wsping_sweep_t* sw = wsping_sweep_create(&opts, wsping_error, NULL);
+	if (!sw) {
+		wsping_exporter_destroy(exporter);
+		wsping_output_destroy(output);
+		wsping_recorder_destroy(recorder);
+		return 1;
+	}
+
+	target_list_t targets = {0};
+	bool ok = !file || add_targets_from_file(&targets, file);
+	for (int i = optind; ok && i < argc; i++) {
+		ok = add_target(&targets, argv[i]);
+	}
+	ok = ok && wsping_sweep_add_targets(sw, (const char* const*)targets.items, targets.count);
+	free_targets(&targets);
+	if (ok && exporter) {
+		fprintf(out, "Serving metrics on http://127.0.0.1:%u/metrics\n", (unsigned)metrics_port);
+	}
+
+	// With an exporter the sweeps go on until interrupted, the
+	// exported counters keep adding up over them
+	ok = ok && wsping_sweep_run(sw);
+	while (ok) {
+		print_results(out, sw, quiet);
+		if (recorder) {
+			fprintf(out, "%llu records logged to %s\n", (unsigned long long)wsping_recorder_get_count(recorder), log);
+		}
+		if (!exporter) {
+			break;
+		}
+		usleep((opts.interval ? opts.interval : 1000) * 1000);
+		ok = wsping_sweep_run(sw);
+	}
+
+	wsping_sweep_destroy(sw);
+	wsping_exporter_destroy(exporter);
+	wsping_output_destroy(output);
+	wsping_recorder_destroy(recorder);
+	return ok ? 0 : 1;
+}
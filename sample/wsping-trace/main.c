@@ -0,0 +1,197 @@
+/**
+ * WSPing Trace...
+ *
+ * Example usage of wsping traceroute, probes every hop at once
+ * and looks up the host names of the routers in parallel. With -c
+ * the path is monitored over several rounds, like mtr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wsping.h"
+
+#define NAME_SIZE 256
+
+static void wsping_error(void* udata, const char* msg)
+{
+	(void)udata;
+	fprintf(stderr, "WSPing Error: %s\n", msg);
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] target\n"
+		"  -m hops      maximum number of hops (default 30)\n"
+		"  -t timeout   timeout in milliseconds (default 1000)\n"
+		"  -s size      send buffer size (default 32)\n"
+		"  -c rounds    monitor the path over this many rounds\n"
+		"  -i interval  milliseconds between rounds (default 1000)\n"
+		"  -n           do not look up host names\n"
+		"  -6           use IPv6\n",
+		name);
+}
+
+// Host name of a hop, written by a resolver thread
+static void store_name(void* udata, const wsping_resolution_t* res)
+{
+	char* name = (char*)udata;
+	if (res->ok) {
+		snprintf(name, NAME_SIZE, "%s", res->name);
+	}
+}
+
+// Every router is looked up at once too
+static void lookup_names(char names[][NAME_SIZE], char addresses[][WSPING_ADDRESS_SIZE], int count)
+{
+	memset(names, 0, (size_t)count * NAME_SIZE);
+	wsping_resolver_options_t ropts = {0};
+	wsping_resolver_t* resolver = wsping_resolver_create(&ropts, wsping_error, NULL);
+	if (!resolver) {
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		if (addresses[i][0]) {
+			wsping_resolver_reverse(resolver, addresses[i], store_name, names[i]);
+		}
+	}
+	wsping_resolver_wait(resolver);
+	wsping_resolver_destroy(resolver);
+}
+
+static void print_host(const char* name, const char* address, int width)
+{
+	int len;
+	if (!address[0]) {
+		len = printf("???");
+	} else if (name[0]) {
+		len = printf("%s (%s)", name, address);
+	} else {
+		len = printf("%s", address);
+	}
+	printf("%*s", len < width ? width - len : 0, "");
+}
+
+// Per hop table of a monitored path
+static void print_path(wsping_session_t* s, bool lookup)
+{
+	wsping_hop_stats_t stats[WSPING_MAX_WINDOW];
+	char addresses[WSPING_MAX_WINDOW][WSPING_ADDRESS_SIZE];
+	char names[WSPING_MAX_WINDOW][NAME_SIZE];
+	int count = wsping_session_get_hop_count(s);
+
+	for (int i = 0; i < count; i++) {
+		wsping_session_get_hop_stats(s, i, &stats[i]);
+		memcpy(addresses[i], stats[i].address, WSPING_ADDRESS_SIZE);
+	}
+	memset(names, 0, sizeof(names));
+	if (lookup) {
+		lookup_names(names, addresses, count);
+	}
+
+	printf("%-44s %6s %5s %8s %8s %8s %8s %8s %8s\n", "Host", "Loss%", "Snt",
+		"Last", "Avg", "Best", "Wrst", "StDev", "Jitter");
+	for (int i = 0; i < count; i++) {
+		const wsping_hop_stats_t* h = &stats[i];
+		double loss = h->sent ? 100.0 * (double)(h->sent - h->received) / (double)h->sent : 0;
+		printf("%3d. ", h->ttl);
+		print_host(names[i], h->address, 39);
+		printf(" %5.1f%% %5llu", loss, (unsigned long long)h->sent);
+		if (h->received) {
+			printf(" %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f", h->rtt_last_ns / 1e6, h->rtt_mean_ns / 1e6,
+				h->rtt_min_ns / 1e6, h->rtt_max_ns / 1e6, h->rtt_stddev_ns / 1e6, h->jitter_ns / 1e6);
+		}
+		printf("\n");
+	}
+	printf("%llu rounds, %u route changes\n", (unsigned long long)wsping_session_get_trace_rounds(s),
+		wsping_session_get_route_changes(s));
+}
+
+int main(int argc, char** argv)
+{
+	wsping_options_t opts = {0};
+	wsping_hop_t hops[WSPING_MAX_WINDOW];
+	char addresses[WSPING_MAX_WINDOW][WSPING_ADDRESS_SIZE];
+	char names[WSPING_MAX_WINDOW][NAME_SIZE];
+	int max_hops = 30;
+	int rounds = 0;
+	bool lookup = true;
+	int c;
+
+	opts.timeout = 1000;
+	while ((c = getopt(argc, argv, "m:t:s:c:i:n6h")) != -1) {
+		switch (c) {
+			case 'm': max_hops = atoi(optarg); break;
+			case 't': opts.timeout = (uint32_t)atoi(optarg); break;
+			case 's': opts.request_size = (uint32_t)atoi(optarg); break;
+			case 'c': rounds = atoi(optarg); break;
+			case 'i': opts.interval = (uint32_t)atoi(optarg); break;
+			case 'n': lookup = false; break;
+			case '6': opts.ip_version = wsping_ipv6; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (optind != argc - 1 || max_hops < 1 || max_hops > WSPING_MAX_WINDOW || rounds < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.target_site = argv[optind];
+	if (rounds > 0) {
+		opts.monitor_hops = (uint32_t)max_hops;
+		opts.count = (uint32_t)rounds;
+	}
+
+	wsping_session_t* s = wsping_session_create(wsping_error, NULL);
+	if (!s || !wsping_session_start(s, &opts)) {
+		wsping_session_destroy(s);
+		return 1;
+	}
+
+	printf("Tracing route to %s [%s], %d hops max\n", opts.target_site,
+		wsping_session_get_target_ip_address(s), max_hops);
+	if (rounds > 0) {
+		if (!wsping_session_run(s, NULL, NULL)) {
+			wsping_session_destroy(s);
+			return 1;
+		}
+		wsping_session_wait(s);
+		print_path(s, lookup);
+		wsping_session_destroy(s);
+		return 0;
+	}
+
+	int count = wsping_session_trace(s, hops, max_hops);
+	if (count < 0) {
+		wsping_session_destroy(s);
+		return 1;
+	}
+
+	memset(names, 0, sizeof(names));
+	for (int i = 0; i < count; i++) {
+		memcpy(addresses[i], hops[i].address, WSPING_ADDRESS_SIZE);
+	}
+	if (lookup) {
+		lookup_names(names, addresses, count);
+	}
+
+	for (int i = 0; i < count; i++) {
+		const wsping_hop_t* hop = &hops[i];
+		if (!hop->address[0]) {
+			printf("%3d  *\n", hop->ttl);
+		} else if (names[i][0]) {
+			printf("%3d  %s (%s)  %.3f ms\n", hop->ttl, names[i], hop->address, hop->rtt_ns / 1e6);
+		} else {
+			printf("%3d  %s  %.3f ms\n", hop->ttl, hop->address, hop->rtt_ns / 1e6);
+		}
+	}
+	if (count == max_hops && hops[count - 1].status != wsping_reply_ok) {
+		printf("Target not reached within %d hops\n", max_hops);
+	}
+
+	wsping_session_destroy(s);
+	return 0;
+}
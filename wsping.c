@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define WIN32_NO_STATUS
 #include <Windows.h>
@@ -5,64 +6,259 @@
 #include <WS2tcpip.h>
 #include <iphlpapi.h>
 #include <IcmpAPI.h>
+#include <mmsystem.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+#endif
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 #include <assert.h>
 
-#include "wsping.h"
+#include "wsping_priv.h"
 
+#ifdef _WIN32
 // Linker libraries for Visual Studio,
-// add -lws2_32 and -liphlpapi linker flags
+// add -lws2_32, -liphlpapi and -lwinmm linker flags
 // for MinGW/MSYS2 user
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "iphlpapi.lib")
+#pragma comment(lib, "winmm.lib")
+#endif
 
-// WinApi stuffs
-static WSADATA wsa_data;
-static int wsa_status;
-static HANDLE hicmp_file = INVALID_HANDLE_VALUE;
-static int family = AF_UNSPEC;
-static PADDRINFOW target = NULL;
-static PCWSTR target_name = NULL;
-static WCHAR address[46];
-static WCHAR canon_name[NI_MAXHOST];
-static IP_OPTION_INFORMATION ip_options;
-
-// WSPing stuffs
-static wsping_options_t options;
-static wsping_errfunc_t err_cb;
-static void* userdata;
-
-// Ping statistics
-static uint32_t rtt_max = 0;
-static uint32_t rtt_min = 0;
-static uint32_t rtt_total = 0;
-static uint32_t echos_sent = 0;
-static uint32_t echos_received = 0;
-static uint32_t echos_successful = 0;
-static int data_size = 0;
-static int ttl = 0;
-static uint32_t reply_time = 0;
-static const char* status = "";
-
-// Macro for set default value
-#define wsping_defval(param, def) ((param) != 0) ? (param) : (def)
-
-// A wise way to prevent Visual Studio's sprintf warning is using fixed
-// buffer size, instead of defining _CRT_SECURE_NO_WARNINGS
-#ifdef _MSC_VER
-#define wsping_sprintf(dst, fmt, ...) sprintf_s(dst, WSPING_BUF_SIZE, fmt, __VA_ARGS__)
-#else
-#define wsping_sprintf(dst, fmt, ...) sprintf(dst, fmt, __VA_ARGS__)
+// Life cycle of an echo request slot
+typedef enum _slot_state
+{
+	slot_free,
+	slot_pending,   // Waiting for the reply
+	slot_done       // Reply (or failure) ready to be collected
+}
+slot_state_t;
+
+// One echo request in flight
+typedef struct _probe_slot
+{
+	slot_state_t state;
+	uint64_t sent_at;
+	uint64_t sent_ns;
+	uint64_t deadline;
+	uint8_t ttl;
+	uint8_t hop;   // Traceroute hop, 0 for an echo request of the session
+	uint32_t size;   // Request data size
+	wsp_address_t responder;
+	wsping_reply_t reply;
+#ifdef _WIN32
+	HANDLE event;
+	LPVOID reply_buffer;
+	DWORD reply_size;
 #endif
+}
+probe_slot_t;
+
+// Running stats of one hop of the path
+typedef struct _hop_track
+{
+	wsp_address_t address;   // Responder of the last round that had one
+	uint32_t address_changes;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t rtt_last_ns;
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	double rtt_mean_ns;
+	double rtt_m2;
+	double jitter_ns;
+}
+hop_track_t;
+
+// Path seen by the traceroute rounds, updated in place under a seqlock
+typedef struct _path_table
+{
+	uint32_t length;          // Hops to the target, 0 until it answered
+	uint32_t probed;          // Hops probed by the last round
+	uint32_t route_changes;
+	uint32_t reserved;
+	uint64_t rounds;
+	hop_track_t hops[WSPING_MAX_WINDOW];
+}
+path_table_t;
+
+// One hop of the traceroute round in flight, folded into the
+// path table once the round is complete
+typedef struct _round_hop
+{
+	wsp_address_t responder;   // Empty when nothing answered
+	uint64_t rtt_ns;
+	bool sent;                 // The request left the host
+}
+round_hop_t;
 
-enum 
+// Everything a single ping target needs, nothing in here
+// is shared with other sessions
+struct _wsping_session
 {
-	WSPING_BUF_SIZE = 1024,
-	ICMP_ERROR_SIZE = 8,
-	IO_STATUS_BLOCK = 8,
-	DEFAULT_TIMEOUT = 1000,
-	MAX_SEND_SIZE = 65500
+#ifdef _WIN32
+	// WinApi stuffs
+	WSADATA wsa_data;
+	int wsa_status;
+	HANDLE hicmp_file;
+	PADDRINFOW target;
+	WCHAR canon_name[NI_MAXHOST];
+	IP_OPTION_INFORMATION ip_options;
+
+	// UTF-8 copy of the canonical name handed out by the getter
+	char canon_name_utf8[NI_MAXHOST];
+#else
+	// POSIX stuffs
+	int sock;
+	int sock_ttl;
+	struct addrinfo* target;
+	char canon_name[NI_MAXHOST];
+#endif
+	int family;
+
+	// Address of the last responder, kept binary on the probe path
+	// and only formatted into the stats when another host answered
+	wsp_address_t responder;
+
+	// Target answered by options.resolver, the backend
+	// then only parses the numeric address
+	char resolved_address[ADDRESS_SIZE];
+	char resolved_name[NI_MAXHOST];
+
+	// Echo requests in flight
+	probe_slot_t slots[WSPING_MAX_WINDOW];
+	int outstanding;
+	uint16_t sequence;
+
+	// Echo request buffers, allocated once by wsping_session_start()
+	// so the probe path never touches the heap. They hold requests
+	// of up to buffer_size bytes, path MTU discovery grows them
+	uint8_t* send_buffer;
+#ifndef _WIN32
+	uint8_t* reply_buffer;
+	int sock_pmtudisc;
+#endif
+	uint32_t buffer_size;
+
+	// WSPing stuffs, options.payload_data points to payload
+	wsping_options_t options;
+	uint8_t* payload;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+
+	// Ping statistics, only touched by the probing thread
+	wsping_stats_t stats;
+	double rtt_m2;   // Sum of squared RTT deviations (Welford)
+	wsp_recent_t recent;
+	char status_buf[WSPING_BUF_SIZE];
+
+	// Target of the session in options.exporter, -1 for none, and
+	// the name the caller asked for and its address, as the exporter
+	// and options.output label the results
+	int export_id;
+	char target_name[NI_MAXHOST];
+	char target_address[ADDRESS_SIZE];
+	wsp_address_t destination;   // Binary form of target_address
+
+	// Copy of the statistics published for other threads
+	uint32_t published_seq;
+	wsping_stats_t published;
+
+	// Successful round trip times, updated in place under its
+	// own seqlock since it is too large to copy every reply
+	uint32_t rtt_hist_seq;
+	wsping_histogram_t rtt_hist;
+
+	// Background probing, see wsping_session_run()
+	wsp_thread_t worker;
+	bool worker_running;
+	uint32_t worker_stop;
+	uint32_t worker_done;
+	wsping_replyfunc_t reply_cb;
+	void* reply_userdata;
+
+	// Traceroute round in flight, the hops of a blocking
+	// wsping_session_trace() also go to trace_hops
+	int trace_pending;
+	int round_hops;
+	int round_length;
+	round_hop_t round[WSPING_MAX_WINDOW];
+	wsping_hop_t* trace_hops;
+
+	// Replies of the running wsping_session_discover_mtu(), by slot
+	wsping_reply_t* mtu_replies;
+
+	uint32_t path_seq;
+	path_table_t path;
 };
 
+// Session used by the single session API
+static wsping_session_t* default_session = NULL;
+
+
+// Hand a completed slot back to the caller, defined in the session core
+static void finish_slot(wsping_session_t* s, probe_slot_t* slot, wsping_reply_t* replies, int* n);
+
+// Remember an address in network byte order
+static void set_address(wsp_address_t* a, const void* bytes, uint8_t length)
+{
+	memset(a, 0, sizeof(*a));
+	memcpy(a->bytes, bytes, length);
+	a->length = length;
+}
+
+static void set_address_sockaddr(wsp_address_t* a, const struct sockaddr* addr)
+{
+	if (addr->sa_family == AF_INET6) {
+		set_address(a, &((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+	} else if (addr->sa_family == AF_INET) {
+		set_address(a, &((const struct sockaddr_in*)addr)->sin_addr, 4);
+	}
+}
+
+// Replies almost always come from the target, so the text of the
+// responder is rarely built again
+static void set_responder(wsping_session_t* s, const wsp_address_t* a)
+{
+	if (memcmp(&s->responder, a, sizeof(*a)) != 0) {
+		s->responder = *a;
+		wsp_format_address(a, s->stats.ip_address);
+	}
+}
+
+// Every echo request carries the same data, size bytes of the pattern
+static void fill_request_data(const wsping_session_t* s, uint8_t* data, uint32_t size)
+{
+	const wsping_options_t* o = &s->options;
+	wsping_payload_fill(data, size, o->payload, o->payload_seed, o->payload_data, o->payload_length);
+}
+
+// Check the echoed data of a successful reply against the request
+static void check_echo_data(probe_slot_t* slot, const uint8_t* request, const uint8_t* echoed, uint32_t size)
+{
+	uint32_t n = size < slot->size ? size : slot->size;
+	slot->reply.corrupted = size < slot->size || wsping_payload_mismatch(request, echoed, n) != n;
+}
+
+#ifdef _WIN32
+/*-----------------*
+ | Windows Backend |
+ *-----------------*/
+
 // ASCII to Unicode converter
 static wchar_t* utf8_to_utf16(const char* src)
 {
@@ -72,428 +268,2540 @@ static wchar_t* utf8_to_utf16(const char* src)
 		return NULL;
 	}
 	MultiByteToWideChar(CP_UTF8, 0, src, -1, dst, num_bytes);
-	dst[num_bytes] = 0;
+	dst[num_bytes - 1] = 0;
 	return dst;
 }
 
-// Unicode to ASCII converter
-static char* utf16_to_utf8(const wchar_t* src)
+// Unicode to ASCII converter, writes into a session owned buffer.
+// Host names are ASCII (IDNs come back as punycode), so a string
+// that does not fit is left empty rather than truncated
+static void utf16_to_utf8(const wchar_t* src, char* dst, int size)
 {
-	int num_bytes = WideCharToMultiByte(CP_UTF8, 0, src, -1, NULL, 0, NULL, NULL);
-	char* dst = (char*)malloc(num_bytes * sizeof(char));
-	if (!dst) {
-		return NULL;
+	if (WideCharToMultiByte(CP_UTF8, 0, src, -1, dst, size, NULL, NULL) == 0) {
+		dst[0] = 0;
+	}
+}
+
+uint64_t wsp_clock_ms()
+{
+	return GetTickCount64();
+}
+
+// Split the multiplication to prevent overflow of the counter
+static int64_t int64_muldiv(int64_t value, int64_t numerator, int64_t denominator)
+{
+	int64_t q = value / denominator;
+	int64_t r = value % denominator;
+	return q * numerator + r * numerator / denominator;
+}
+
+uint64_t wsp_clock_ns()
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER qpc;
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&qpc);
+	return (uint64_t)int64_muldiv(qpc.QuadPart, 1000000000, freq.QuadPart);
+}
+
+// FILETIME counts 100 ns intervals since 1601
+uint64_t wsp_clock_wall_ns()
+{
+	FILETIME ft;
+	GetSystemTimePreciseAsFileTime(&ft);
+	uint64_t ticks = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	return (ticks - 116444736000000000ULL) * 100;
+}
+
+uint32_t wsp_cpu_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+void wsp_sleep_ms(uint32_t ms)
+{
+	Sleep(ms);
+}
+
+static DWORD WINAPI thread_entry(LPVOID param)
+{
+	wsp_thread_t* t = (wsp_thread_t*)param;
+	t->func(t->arg);
+	return 0;
+}
+
+bool wsp_thread_start(wsp_thread_t* t, void (*func)(void*), void* arg)
+{
+	t->func = func;
+	t->arg = arg;
+	t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+	return t->handle != NULL;
+}
+
+void wsp_thread_join(wsp_thread_t* t)
+{
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+	t->handle = NULL;
+}
+
+void wsp_mutex_init(wsp_mutex_t* m)
+{
+	InitializeSRWLock(m);
+}
+
+void wsp_mutex_destroy(wsp_mutex_t* m)
+{
+	(void)m;
+}
+
+void wsp_mutex_lock(wsp_mutex_t* m)
+{
+	AcquireSRWLockExclusive(m);
+}
+
+void wsp_mutex_unlock(wsp_mutex_t* m)
+{
+	ReleaseSRWLockExclusive(m);
+}
+
+void wsp_cond_init(wsp_cond_t* c)
+{
+	InitializeConditionVariable(c);
+}
+
+void wsp_cond_destroy(wsp_cond_t* c)
+{
+	(void)c;
+}
+
+void wsp_cond_wait(wsp_cond_t* c, wsp_mutex_t* m)
+{
+	SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+void wsp_cond_signal(wsp_cond_t* c)
+{
+	WakeConditionVariable(c);
+}
+
+void wsp_cond_broadcast(wsp_cond_t* c)
+{
+	WakeAllConditionVariable(c);
+}
+
+static bool backend_init(wsping_session_t* s)
+{
+	s->hicmp_file = INVALID_HANDLE_VALUE;
+
+	// WSAStartup is reference counted, so every session
+	// can keep WinSock alive on its own
+	s->wsa_status = WSAStartup(MAKEWORD(2, 2), &s->wsa_data);
+	if (s->wsa_status != 0) {
+		char err[WSPING_BUF_SIZE] = {0};
+		wsping_sprintf(err, "Failed to initialize WinSock: %i", s->wsa_status);
+		s->err_cb(s->userdata, err);
+		return false;
+	}
+	return true;
+}
+
+// Release the ICMP handle, echo requests in flight and
+// resolved target of a session
+static void backend_release(wsping_session_t* s)
+{
+	if (s->hicmp_file != INVALID_HANDLE_VALUE) {
+		// Closing the handle cancels the pending requests, wait
+		// until they are signaled before freeing their buffers
+		IcmpCloseHandle(s->hicmp_file);
+		s->hicmp_file = INVALID_HANDLE_VALUE;
+		for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+			probe_slot_t* slot = &s->slots[i];
+			if (slot->state == slot_pending) {
+				WaitForSingleObject(slot->event, s->options.timeout);
+			}
+			slot->state = slot_free;
+		}
+		s->outstanding = 0;
+	}
+	for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+		probe_slot_t* slot = &s->slots[i];
+		if (slot->event) {
+			CloseHandle(slot->event);
+			slot->event = NULL;
+		}
+		free(slot->reply_buffer);
+		slot->reply_buffer = NULL;
+	}
+	free(s->send_buffer);
+	s->send_buffer = NULL;
+	if (s->target) {
+		FreeAddrInfoW(s->target);
+		s->target = NULL;
+	}
+}
+
+static void backend_shutdown(wsping_session_t* s)
+{
+	backend_release(s);
+	if (s->wsa_status == 0) {
+		WSACleanup();
 	}
-	WideCharToMultiByte(CP_UTF8, 0, src, -1, dst, num_bytes, NULL, NULL);
-	dst[num_bytes] = 0;
-	return dst;
 }
 
 // Get current target site info, target site ip addres,
 // and IP family that we use
-static bool resolve_target(const wchar_t* target_name)
+static bool resolve_target(wsping_session_t* s, const wchar_t* target_name)
 {
 	ADDRINFOW hints = {0};
-	hints.ai_family = family;
+	hints.ai_family = s->family;
 	hints.ai_flags = AI_NUMERICHOST;
 	char err[WSPING_BUF_SIZE] = {0};
 
-	int status = GetAddrInfoW(target_name, NULL, &hints, &target);
+	int status = GetAddrInfoW(target_name, NULL, &hints, &s->target);
 	if (status != 0) {
 		hints.ai_flags = AI_CANONNAME;
-		status = GetAddrInfoW(target_name, NULL, &hints, &target);
+		status = GetAddrInfoW(target_name, NULL, &hints, &s->target);
 		if (status != 0) {
-			const char* tgt = utf16_to_utf8(target_name);
-			wsping_sprintf(err, "Could not find host %s. Please check the name and try again", tgt);
-			err_cb(userdata, err);
+			wsping_sprintf(err, "Could not find host %s. Please check the name and try again", s->options.target_site);
+			s->err_cb(s->userdata, err);
 			return false;
 		}
 #ifdef _MSC_VER
-		wcsncpy_s(canon_name, NI_MAXHOST, target->ai_canonname, wcslen(target->ai_canonname));
+		wcsncpy_s(s->canon_name, NI_MAXHOST, s->target->ai_canonname, wcslen(s->target->ai_canonname));
 #else
-		wcsncpy(canon_name, target->ai_canonname, wcslen(target->ai_canonname));
+		wcsncpy(s->canon_name, s->target->ai_canonname, wcslen(s->target->ai_canonname));
 #endif
-	} else if (options.resolve_address) {
-		status = GetNameInfoW(target->ai_addr, target->ai_addrlen, canon_name, _countof(canon_name), NULL, 0, NI_NAMEREQD);
+	} else if (s->resolved_name[0]) {
+		MultiByteToWideChar(CP_UTF8, 0, s->resolved_name, -1, s->canon_name, _countof(s->canon_name));
+	} else if (s->options.resolve_address) {
+		status = GetNameInfoW(s->target->ai_addr, (socklen_t)s->target->ai_addrlen, s->canon_name, _countof(s->canon_name), NULL, 0, NI_NAMEREQD);
 		if (status != 0) {
 			wsping_sprintf(err, "GetNameInfo failed: %d", WSAGetLastError());
-			err_cb(userdata, err);
+			s->err_cb(s->userdata, err);
 			return false;
 		}
 	}
+	utf16_to_utf8(s->canon_name, s->canon_name_utf8, sizeof(s->canon_name_utf8));
 
-	family = target->ai_family;
+	s->family = s->target->ai_family;
 	return true;
 }
 
-// Reset all stats
-void wsping_reset()
-{
-	memset(address, 0, sizeof(address));
-	memset(canon_name, 0, sizeof(canon_name));
-	rtt_max = 0;
-	rtt_min = 0;
-	rtt_total = 0;
-	echos_sent = 0;
-	echos_received = 0;
-	echos_successful = 0;
-	data_size = 0;
-	ttl = 0;
-	reply_time = 0;
-	status = "Ping Stopped";
-}
-
-// Get reply from target site
-void wsping_refresh()
+// Every request sends the same zeroed data, the reply buffer
+// has room for the reply header and the largest echoed data
+static DWORD reply_buffer_size(const wsping_session_t* s)
 {
-	LPVOID reply_buffer = NULL;
-	LPVOID send_buffer = NULL;
-	DWORD reply_size = 0;
-	DWORD reply_status;
-	char buffer[WSPING_BUF_SIZE] = {0};
-
-	if (options.request_size != 0) {
-		send_buffer = malloc(options.request_size);
-		if (!send_buffer) {
-			status = "Ping Error";
-			err_cb(userdata, "Not enough resources available");
-			return;
-		}
-		memset(send_buffer, 0, options.request_size);
-	}
-
-	if (family == AF_INET6) {
-		reply_size += sizeof(ICMPV6_ECHO_REPLY);
+	DWORD reply_size;
+	if (s->family == AF_INET6) {
+		reply_size = sizeof(ICMPV6_ECHO_REPLY);
 	} else {
 #ifdef _WIN64
-		reply_size += sizeof(ICMP_ECHO_REPLY32);
+		reply_size = sizeof(ICMP_ECHO_REPLY32);
 #else
-		reply_size += sizeof(ICMP_ECHO_REPLY);
+		reply_size = sizeof(ICMP_ECHO_REPLY);
 #endif
 	}
+	return reply_size + s->buffer_size + ICMP_ERROR_SIZE + IO_STATUS_BLOCK;
+}
 
-	reply_size += options.request_size + ICMP_ERROR_SIZE + IO_STATUS_BLOCK;
-	reply_buffer = malloc(reply_size);
-	if (!reply_buffer) {
-		free(send_buffer);
-		status = "Ping Error";
-		err_cb(userdata, "Not enough resources available");
-		return;
-	}
-
-	memset(reply_buffer, 0, reply_size);
-	echos_sent++;
-
-	if (family == AF_INET6) {
-		struct sockaddr_in6 source = {0};
-		source.sin6_family = AF_INET6;
-		reply_status = Icmp6SendEcho2(
-			hicmp_file,                            // IcmpHandle
-			NULL,                                  // Event
-			NULL,                                  // ApcRoutine
-	    	NULL,                                  // ApcContext
-			&source,                               // SourceAddress
-			(struct sockaddr_in6*)target->ai_addr, // DestinationAddress
-			send_buffer,                           // RequestData
-			(USHORT)options.request_size,          // RequestSize
-			&ip_options,                           // RequestOptions
-			reply_buffer,                          // ReplyBuffer
-			reply_size,                            // ReplySize
-			options.timeout                        // Timeout
-		);
-	} else {
-		reply_status = IcmpSendEcho2(
-			hicmp_file,                                        // IcmpHandle
-			NULL,                                              // Event
-			NULL,                                              // ApcRoutine
-			NULL,                                              // ApcContext
-			((PSOCKADDR_IN)target->ai_addr)->sin_addr.s_addr,  // DestinationAddress
-			send_buffer,                                       // RequestData
-			(USHORT)options.request_size,                      // RequestSize
-			&ip_options,                                       // RequestOptions
-			reply_buffer,                                      // ReplyBuffer
-			reply_size,                                        // ReplySize 
-			options.timeout                                    // Timeout
-		);
-	}
-
-	free(send_buffer);
+// Create the manual reset event and reply buffer of the first count
+// slots, one per echo request in flight
+static bool backend_reserve(wsping_session_t* s, int count)
+{
+	char error[64] = {0};
+	DWORD reply_size = reply_buffer_size(s);
 
-	if (reply_status == 0) {
-		reply_status = GetLastError();
-		switch (reply_status) {
-			case IP_REQ_TIMED_OUT:
-				// RTO
-				status = "Request timed out";
-				return;
-			default:
-				// Unhandled error
-				wsping_sprintf(buffer, "Transmit failed. (Code %u)", reply_status);
-				status = buffer;
-				return;
-		}
-	} else {
-		SOCKADDR_IN6 sock_addr_in6 = {0};
-		SOCKADDR_IN sock_addr_in = {0};
-		PSOCKADDR sock_addr;
-		socklen_t sz;
-
-		echos_received++;
-
-		if (family == AF_INET6) {   // IPv6
-			PICMPV6_ECHO_REPLY p_echo_reply = (PICMPV6_ECHO_REPLY)reply_buffer;
-			PIPV6_ADDRESS_EX ipv6_addr = (PIPV6_ADDRESS_EX)&p_echo_reply->Address;
-			sock_addr_in6.sin6_family = AF_INET6;
-			CopyMemory(sock_addr_in6.sin6_addr.u.Word, ipv6_addr->sin6_addr, sizeof(sock_addr_in6.sin6_addr));
-			
-			sock_addr = (PSOCKADDR)&sock_addr_in6;
-			sz = sizeof(SOCKADDR_IN6);
-			GetNameInfoW(
-				sock_addr,      // pSockAddr
-				sz,             // SockaddrLength
-				address,        // pNodeBuffer
-				NI_MAXHOST,     // NodeBufferSize
-				NULL,           // pServiceBuffer
-				0,              // ServiceBufferSize
-				NI_NUMERICHOST  // Flags
-			);
-
-			switch (p_echo_reply->Status) {
-				case IP_SUCCESS: {   
-					// The target site was replied
-					status = "OK";
-					echos_successful++;
-					if (p_echo_reply->RoundTripTime == 0) {
-						reply_time = 1;
-					} else {
-						reply_time = p_echo_reply->RoundTripTime;
-					}
-					break;
-				}
-				case IP_DEST_NET_UNREACHABLE:  
-					// Network unreachable
-					status = "Destination network unreachable";
-					break;
-				case IP_DEST_HOST_UNREACHABLE: 
-					// Network host uncreachable
-					status =  "Destination host unreachable";
-					break;
-				case IP_TTL_EXPIRED_TRANSIT:   
-					// TTL expired
-					status = "TTL expired in transit";
-					break;
-				default:                       
-					// Another reply
-					wsping_sprintf(buffer, "Echo reply returned %lu", p_echo_reply->Status);
-					status = buffer;
-					break;
-			}
-		} else {  // IPv4
-#ifdef _WIN64
-			PICMP_ECHO_REPLY32 p_echo_reply = (PICMPV6_ECHO_REPLY32)reply_buffer;
-#else
-			PICMP_ECHO_REPLY p_echo_reply = (PICMP_ECHO_REPLY)reply_buffer;
-#endif
-			IPAddr* ip4_addr = &p_echo_reply->Address;
-			sock_addr_in.sin_family = AF_INET;
-			sock_addr_in.sin_addr.S_un.S_addr = *ip4_addr;
-			
-			sock_addr = (PSOCKADDR)&sock_addr_in;
-			sz = sizeof(SOCKADDR_IN);
-			GetNameInfoW(
-				sock_addr,
-				sz,
-				address,
-				NI_MAXHOST,
-				NULL,
-				0,
-				NI_NUMERICHOST
-			);
-
-			switch (p_echo_reply->Status) {
-				case IP_SUCCESS: {   
-					// The target site was replied
-					status = "OK";
-					echos_successful++;
-					data_size = p_echo_reply->DataSize;
-					if (p_echo_reply->RoundTripTime == 0) {
-						reply_time = 1;
-					} else {
-						reply_time = p_echo_reply->RoundTripTime;
-					}
-					ttl = p_echo_reply->Options.Ttl;
-					if (p_echo_reply->RoundTripTime < rtt_min || rtt_min == 0) {
-						rtt_min = p_echo_reply->RoundTripTime;
-					}
-					if (p_echo_reply->RoundTripTime > rtt_max || rtt_max == 0) {
-						rtt_max = p_echo_reply->RoundTripTime;
-					}
-					rtt_total += p_echo_reply->RoundTripTime;
-					break;
-				}
-				case IP_DEST_NET_UNREACHABLE:
-					// Network unreachable
-					status = "Destination network unreachable";
-					break;
-				case IP_DEST_HOST_UNREACHABLE:
-					// Network host uncreachable
-					status = "Destination host unreachable";
-					break;
-				case IP_TTL_EXPIRED_TRANSIT:
-					// TTL expired
-					status = "TTL expired in transit";
-					break;
-				default:
-					// Another reply
-					wsping_sprintf(buffer, "Echo reply returned %lu", p_echo_reply->Status);
-					status = buffer;
-					break;
+	for (int i = 0; i < count; i++) {
+		probe_slot_t* slot = &s->slots[i];
+		if (!slot->event) {
+			slot->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+			if (!slot->event) {
+				wsping_sprintf(error, "CreateEvent failed: %lu", GetLastError());
+				s->err_cb(s->userdata, error);
+				return false;
 			}
 		}
+		if (slot->reply_buffer && slot->reply_size >= reply_size) {
+			continue;
+		}
+		free(slot->reply_buffer);
+		slot->reply_size = reply_size;
+		slot->reply_buffer = calloc(1, reply_size);
+		if (!slot->reply_buffer) {
+			s->err_cb(s->userdata, "Not enough resources available");
+			return false;
+		}
 	}
-	
-	free(reply_buffer);
+
+	return true;
 }
 
-bool wsping_init(wsping_errfunc_t err_func, void* udata)
+// Make room for echo requests of size bytes, in the send buffer
+// and the reply buffers of the slots created so far
+static bool backend_grow(wsping_session_t* s, uint32_t size)
 {
-	err_cb = err_func;
-	userdata = udata;
-
-	wsa_status = WSAStartup(MAKEWORD(2, 2), &wsa_data);
-	if (wsa_status != 0) {
-		char err[WSPING_BUF_SIZE] = {0};
-		wsping_sprintf(err, "Failed to initialize WinSock: %i", wsa_status);
-		err_cb(userdata, err);
+	if (size <= s->buffer_size) {
+		return true;
+	}
+	uint8_t* send_buffer = (uint8_t*)malloc(size);
+	if (!send_buffer) {
+		s->err_cb(s->userdata, "Not enough resources available");
 		return false;
 	}
+	fill_request_data(s, send_buffer, size);
+	free(s->send_buffer);
+	s->send_buffer = send_buffer;
+	s->buffer_size = size;
 
-	return true;
+	int reserved = 0;
+	for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+		if (s->slots[i].event) {
+			reserved = i + 1;
+		}
+	}
+	return backend_reserve(s, reserved);
 }
 
-void wsping_shutdown()
+// Set the don't fragment flag of the echo requests. The ICMP API has
+// no such option for IPv6, where the stack may still fragment requests
+// larger than the path MTU it knows about
+static void backend_set_df(wsping_session_t* s, bool on)
 {
-	if (hicmp_file) {
-		IcmpCloseHandle(hicmp_file);
-	}
-	if (target) {
-		FreeAddrInfoW(target);
-	}
-	if (wsa_status == 0) {
-		WSACleanup();
-	}
+	s->ip_options.Flags = on ? IP_FLAG_DF : 0;
 }
 
-bool wsping_start(const wsping_options_t* opt)
+static bool backend_start(wsping_session_t* s)
 {
-	assert(opt);
-	options = *opt;
-	options.timeout = wsping_defval(options.timeout, 4000);
-	options.request_size = wsping_defval(options.request_size, 32);
-	options.resolve_address = wsping_defval(options.resolve_address, false);
-	options.ttl = wsping_defval(options.ttl, 128);
-
-	if (strlen(options.target_site) == 0) {
-		err_cb(userdata,"Target address must be specified");
-		return false;
-	}
+	s->ip_options.Ttl = s->options.ttl;
 
-	ip_options.Ttl = options.ttl;
-	if (options.ip_version == wsping_ipv4) {
-		family = AF_INET;
-	} else if (options.ip_version == wsping_ipv6) {
-		family = AF_INET6;
+	wchar_t* target_name = utf8_to_utf16(s->options.target_site);
+	if (!target_name) {
+		s->err_cb(s->userdata, "Not enough resources available");
+		return false;
 	}
-
-	if (!resolve_target(utf8_to_utf16(options.target_site))) {
+	bool resolved = resolve_target(s, target_name);
+	free(target_name);
+	if (!resolved) {
 		return false;
 	}
 
-	DWORD addrlen = 46;
 	char error[64] = {0};
 
-	if (WSAAddressToStringW(target->ai_addr, (DWORD)target->ai_addrlen, NULL, address, &addrlen)) {
-		wsping_sprintf(error, "WSAAddressToString failed: %d", WSAGetLastError());
-		err_cb(userdata, error);
-		return false;
-	}
-
-	if (family == AF_INET6) {
-		hicmp_file = Icmp6CreateFile();
+	if (s->family == AF_INET6) {
+		s->hicmp_file = Icmp6CreateFile();
 	} else {
-		hicmp_file = IcmpCreateFile();
+		s->hicmp_file = IcmpCreateFile();
 	}
 
-	if (hicmp_file == INVALID_HANDLE_VALUE) {
+	if (s->hicmp_file == INVALID_HANDLE_VALUE) {
 		wsping_sprintf(error, "IcmpCreateFile failed: %lu", GetLastError());
-		err_cb(userdata, error);
+		s->err_cb(s->userdata, error);
 		return false;
 	}
 
-	status = "Ping Started";
-
-	return true;
-}
-
-/*-------------------*
- | Ping Stats Getter |
- *-------------------*/
+	s->buffer_size = s->options.request_size;
+	if (s->options.request_size != 0) {
+		s->send_buffer = (uint8_t*)malloc(s->options.request_size);
+		if (!s->send_buffer) {
+			s->err_cb(s->userdata, "Not enough resources available");
+			return false;
+		}
+		fill_request_data(s, s->send_buffer, s->options.request_size);
+	}
 
-const char* wsping_get_status() 
-{	
-	return status;
+	return backend_reserve(s, (int)s->options.window);
 }
 
-const char* wsping_get_target_ip_address()
+// Map IP_STATUS values into the backend independent reply status
+static wsping_reply_status_t map_ip_status(ULONG status)
 {
-	return utf16_to_utf8(address);
+	switch (status) {
+		case IP_SUCCESS:               return wsping_reply_ok;
+		case IP_REQ_TIMED_OUT:         return wsping_reply_timed_out;
+		case IP_DEST_NET_UNREACHABLE:  return wsping_reply_net_unreachable;
+		case IP_DEST_HOST_UNREACHABLE: return wsping_reply_host_unreachable;
+		case IP_TTL_EXPIRED_TRANSIT:   return wsping_reply_ttl_expired;
+		case IP_PACKET_TOO_BIG:        return wsping_reply_packet_too_big;
+		default:                       return wsping_reply_other;
+	}
 }
 
-const char* wsping_get_target_canonical_name()
+// Read the reply of a signaled echo request. The ICMP API only
+// reports whole milliseconds, the nanosecond RTT is measured with
+// the performance counter from send to completion.
+static void parse_reply(wsping_session_t* s, probe_slot_t* slot)
 {
-	return utf16_to_utf8(canon_name);
-}
+	wsping_reply_t* r = &slot->reply;
+	DWORD count;
 
-int wsping_get_data_size()
-{
-	return data_size;
-}
+	r->rtt_ns = wsp_clock_ns() - slot->sent_ns;
 
-int wsping_get_ttl()
-{
-	return ttl;
-}
+	if (s->family == AF_INET6) {
+		count = Icmp6ParseReplies(slot->reply_buffer, slot->reply_size);
+	} else {
+		count = IcmpParseReplies(slot->reply_buffer, slot->reply_size);
+	}
 
-uint32_t wsping_get_reply_time()
-{
-	return reply_time;
-}
+	if (count == 0) {
+		DWORD reply_status = GetLastError();
+		if (reply_status == IP_REQ_TIMED_OUT) {
+			// RTO
+			r->status = wsping_reply_timed_out;
+		} else {
+			// Unhandled error
+			r->status = wsping_reply_failed;
+			r->detail = reply_status;
+		}
+	} else if (s->family == AF_INET6) {   // IPv6
+		PICMPV6_ECHO_REPLY p_echo_reply = (PICMPV6_ECHO_REPLY)slot->reply_buffer;
+		PIPV6_ADDRESS_EX ipv6_addr = (PIPV6_ADDRESS_EX)&p_echo_reply->Address;
+		set_address(&slot->responder, ipv6_addr->sin6_addr, 16);
 
-uint32_t wsping_get_rtt_min()
-{
-	return rtt_min;
-}
-uint32_t wsping_get_rtt_max()
-{
-	return rtt_max;
-}
+		r->status = map_ip_status(p_echo_reply->Status);
+		r->detail = p_echo_reply->Status;
+		r->rtt = p_echo_reply->RoundTripTime;
+		r->data_size = slot->size;
 
-uint32_t wsping_get_rtt_total()
-{
-	return rtt_total;
-}
+		// The echoed data follows the reply
+		if (r->status == wsping_reply_ok) {
+			check_echo_data(slot, s->send_buffer, (const uint8_t*)(p_echo_reply + 1), slot->size);
+		}
+	} else {  // IPv4
+#ifdef _WIN64
+		PICMP_ECHO_REPLY32 p_echo_reply = (PICMP_ECHO_REPLY32)slot->reply_buffer;
+#else
+		PICMP_ECHO_REPLY p_echo_reply = (PICMP_ECHO_REPLY)slot->reply_buffer;
+#endif
+		set_address(&slot->responder, &p_echo_reply->Address, 4);
 
-uint32_t wsping_get_data_sent()
-{
-	return echos_sent;
+		r->status = map_ip_status(p_echo_reply->Status);
+		r->detail = p_echo_reply->Status;
+		r->rtt = p_echo_reply->RoundTripTime;
+		r->ttl = p_echo_reply->Options.Ttl;
+		r->data_size = p_echo_reply->DataSize;
+
+		// Data may be a 32-bit pointer, its offset into the reply
+		// buffer is the same either way
+		uint32_t offset = (uint32_t)((ULONG_PTR)p_echo_reply->Data - (ULONG_PTR)slot->reply_buffer);
+		if (r->status == wsping_reply_ok && offset + (uint64_t)p_echo_reply->DataSize <= slot->reply_size) {
+			check_echo_data(slot, s->send_buffer, (const uint8_t*)slot->reply_buffer + offset, p_echo_reply->DataSize);
+		}
+	}
+
+	// The next hop MTU of a too big error is not handed out
+	if (r->status == wsping_reply_packet_too_big) {
+		r->detail = 0;
+	}
 }
 
-uint32_t wsping_get_data_received()
+// Put one echo request in flight, the slot event is
+// signaled once the reply arrives or the request times out
+static bool backend_send(wsping_session_t* s, probe_slot_t* slot)
 {
-	return echos_received;
-}
+	DWORD reply_status;
 
-uint32_t wsping_get_data_successful()
+	ResetEvent(slot->event);
+	s->ip_options.Ttl = slot->ttl;
+	slot->sent_at = wsp_clock_ms();
+	slot->sent_ns = wsp_clock_ns();
+
+	if (s->family == AF_INET6) {
+		struct sockaddr_in6 source = {0};
+		source.sin6_family = AF_INET6;
+		reply_status = Icmp6SendEcho2(
+			s->hicmp_file,                            // IcmpHandle
+			slot->event,                              // Event
+			NULL,                                     // ApcRoutine
+			NULL,                                     // ApcContext
+			&source,                                  // SourceAddress
+			(struct sockaddr_in6*)s->target->ai_addr, // DestinationAddress
+			s->send_buffer,                           // RequestData
+			(USHORT)slot->size,                       // RequestSize
+			&s->ip_options,                           // RequestOptions
+			slot->reply_buffer,                       // ReplyBuffer
+			slot->reply_size,                         // ReplySize
+			s->options.timeout                        // Timeout
+		);
+	} else {
+		reply_status = IcmpSendEcho2(
+			s->hicmp_file,                                        // IcmpHandle
+			slot->event,                                          // Event
+			NULL,                                                 // ApcRoutine
+			NULL,                                                 // ApcContext
+			((PSOCKADDR_IN)s->target->ai_addr)->sin_addr.s_addr,  // DestinationAddress
+			s->send_buffer,                                       // RequestData
+			(USHORT)slot->size,                                   // RequestSize
+			&s->ip_options,                                       // RequestOptions
+			slot->reply_buffer,                                   // ReplyBuffer
+			slot->reply_size,                                     // ReplySize
+			s->options.timeout                                    // Timeout
+		);
+	}
+
+	if (reply_status == 0 && GetLastError() == ERROR_IO_PENDING) {
+		slot->state = slot_pending;
+	} else {
+		// Completed (or failed) without going asynchronous
+		parse_reply(s, slot);
+		slot->state = slot_done;
+	}
+
+	return true;
+}
+
+// Collect completed echo requests, waiting on the slot events
+// until at least one completes or wait_ms elapsed
+static int backend_poll(wsping_session_t* s, wsping_reply_t* replies, int max_replies, uint32_t wait_ms)
+{
+	uint64_t deadline = wsp_clock_ms() + wait_ms;
+	int n = 0;
+
+	for (;;) {
+		for (int i = 0; i < WSPING_MAX_WINDOW && n < max_replies; i++) {
+			probe_slot_t* slot = &s->slots[i];
+			if (slot->state == slot_pending && WaitForSingleObject(slot->event, 0) == WAIT_OBJECT_0) {
+				parse_reply(s, slot);
+				slot->state = slot_done;
+			}
+			if (slot->state == slot_done) {
+				finish_slot(s, slot, replies, &n);
+			}
+		}
+
+		uint64_t now = wsp_clock_ms();
+		if (n > 0 || s->outstanding == 0 || now >= deadline) {
+			break;
+		}
+
+		HANDLE events[WSPING_MAX_WINDOW];
+		DWORD count = 0;
+		for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+			if (s->slots[i].state == slot_pending) {
+				events[count++] = s->slots[i].event;
+			}
+		}
+		WaitForMultipleObjects(count, events, FALSE, (DWORD)(deadline - now));
+	}
+
+	return n;
+}
+
+const char* wsping_session_get_target_canonical_name(const wsping_session_t* s)
+{
+	return s->canon_name_utf8;
+}
+
+#else
+/*---------------*
+ | POSIX Backend |
+ *---------------*/
+
+// Unprivileged ICMP sockets (SOCK_DGRAM + IPPROTO_ICMP) let the kernel
+// fill in the echo identifier and checksum, and only deliver replies
+// that belong to this socket. On Linux the calling group must be
+// inside net.ipv4.ping_group_range.
+
+uint64_t wsp_clock_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t wsp_clock_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t wsp_clock_wall_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t wsp_cpu_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+}
+
+void wsp_sleep_ms(uint32_t ms)
+{
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+static void* thread_entry(void* param)
+{
+	wsp_thread_t* t = (wsp_thread_t*)param;
+	t->func(t->arg);
+	return NULL;
+}
+
+bool wsp_thread_start(wsp_thread_t* t, void (*func)(void*), void* arg)
+{
+	t->func = func;
+	t->arg = arg;
+	return pthread_create(&t->handle, NULL, thread_entry, t) == 0;
+}
+
+void wsp_thread_join(wsp_thread_t* t)
+{
+	pthread_join(t->handle, NULL);
+}
+
+void wsp_mutex_init(wsp_mutex_t* m)
+{
+	pthread_mutex_init(m, NULL);
+}
+
+void wsp_mutex_destroy(wsp_mutex_t* m)
+{
+	pthread_mutex_destroy(m);
+}
+
+void wsp_mutex_lock(wsp_mutex_t* m)
+{
+	pthread_mutex_lock(m);
+}
+
+void wsp_mutex_unlock(wsp_mutex_t* m)
+{
+	pthread_mutex_unlock(m);
+}
+
+void wsp_cond_init(wsp_cond_t* c)
+{
+	pthread_cond_init(c, NULL);
+}
+
+void wsp_cond_destroy(wsp_cond_t* c)
+{
+	pthread_cond_destroy(c);
+}
+
+void wsp_cond_wait(wsp_cond_t* c, wsp_mutex_t* m)
+{
+	pthread_cond_wait(c, m);
+}
+
+void wsp_cond_signal(wsp_cond_t* c)
+{
+	pthread_cond_signal(c);
+}
+
+void wsp_cond_broadcast(wsp_cond_t* c)
+{
+	pthread_cond_broadcast(c);
+}
+
+// Send and receive timestamps of echo requests. Kernel receive
+// timestamps (SO_TIMESTAMPNS) use CLOCK_REALTIME, so the send
+// timestamp has to come from the same clock.
+static uint64_t probe_clock_ns(const wsping_session_t* s)
+{
+	struct timespec ts;
+	clock_gettime(s->options.kernel_timestamps ? CLOCK_REALTIME : CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static bool backend_init(wsping_session_t* s)
+{
+	s->sock = -1;
+	return true;
+}
+
+// Release the ICMP socket, echo requests in flight and
+// resolved target of a session
+static void backend_release(wsping_session_t* s)
+{
+	if (s->sock >= 0) {
+		close(s->sock);
+		s->sock = -1;
+	}
+	for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+		s->slots[i].state = slot_free;
+	}
+	s->outstanding = 0;
+	free(s->send_buffer);
+	free(s->reply_buffer);
+	s->send_buffer = NULL;
+	s->reply_buffer = NULL;
+	if (s->target) {
+		freeaddrinfo(s->target);
+		s->target = NULL;
+	}
+}
+
+static void backend_shutdown(wsping_session_t* s)
+{
+	backend_release(s);
+}
+
+// Get current target site info, target site ip addres,
+// and IP family that we use
+static bool resolve_target(wsping_session_t* s, const char* target_name)
+{
+	struct addrinfo hints = {0};
+	hints.ai_family = s->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	char err[WSPING_BUF_SIZE] = {0};
+
+	int status = getaddrinfo(target_name, NULL, &hints, &s->target);
+	if (status != 0) {
+		hints.ai_flags = AI_CANONNAME;
+		status = getaddrinfo(target_name, NULL, &hints, &s->target);
+		if (status != 0) {
+			wsping_sprintf(err, "Could not find host %s. Please check the name and try again", target_name);
+			s->err_cb(s->userdata, err);
+			return false;
+		}
+		if (s->target->ai_canonname) {
+			snprintf(s->canon_name, sizeof(s->canon_name), "%s", s->target->ai_canonname);
+		}
+	} else if (s->resolved_name[0]) {
+		snprintf(s->canon_name, sizeof(s->canon_name), "%s", s->resolved_name);
+	} else if (s->options.resolve_address) {
+		status = getnameinfo(s->target->ai_addr, s->target->ai_addrlen, s->canon_name, sizeof(s->canon_name), NULL, 0, NI_NAMEREQD);
+		if (status != 0) {
+			wsping_sprintf(err, "getnameinfo failed: %s", gai_strerror(status));
+			s->err_cb(s->userdata, err);
+			return false;
+		}
+	}
+
+	s->family = s->target->ai_family;
+	return true;
+}
+
+// TTL of the next echo requests, traceroute hops change it per request
+static void set_socket_ttl(wsping_session_t* s, int ttl)
+{
+	if (s->family == AF_INET6) {
+		setsockopt(s->sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+	} else {
+		setsockopt(s->sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+	}
+	s->sock_ttl = ttl;
+}
+
+static bool backend_start(wsping_session_t* s)
+{
+	char error[WSPING_BUF_SIZE] = {0};
+	int on = 1;
+
+	if (!resolve_target(s, s->options.target_site)) {
+		return false;
+	}
+
+	if (s->family == AF_INET6) {
+		s->sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_ICMPV6);
+	} else {
+		s->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+	}
+
+	if (s->sock < 0) {
+		wsping_sprintf(error, "Could not create ICMP socket: %s", strerror(errno));
+		s->err_cb(s->userdata, error);
+		return false;
+	}
+
+	// Outgoing TTL, reply TTL reporting and ICMP error reporting
+	set_socket_ttl(s, s->options.ttl);
+	if (s->family == AF_INET6) {
+		setsockopt(s->sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on));
+#ifdef IPV6_RECVERR
+		setsockopt(s->sock, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on));
+#endif
+	} else {
+		setsockopt(s->sock, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on));
+#ifdef IP_RECVERR
+		setsockopt(s->sock, IPPROTO_IP, IP_RECVERR, &on, sizeof(on));
+#endif
+	}
+
+#ifdef SO_TIMESTAMPNS
+	if (s->options.kernel_timestamps) {
+		setsockopt(s->sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	}
+#endif
+
+	// Replies and queued errors both carry an ICMP header plus our
+	// data, so one packet size fits the request and every reply
+	s->buffer_size = s->options.request_size;
+	s->send_buffer = (uint8_t*)calloc(1, ICMP_HEADER_SIZE + s->buffer_size);
+	s->reply_buffer = (uint8_t*)malloc(ICMP_HEADER_SIZE + s->buffer_size);
+	if (!s->send_buffer || !s->reply_buffer) {
+		s->err_cb(s->userdata, "Not enough resources available");
+		return false;
+	}
+
+	// Identifier and checksum are filled in by the kernel,
+	// only the sequence number changes between requests
+	s->send_buffer[0] = s->family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+	fill_request_data(s, s->send_buffer + ICMP_HEADER_SIZE, s->buffer_size);
+
+	return true;
+}
+
+// Every slot shares the socket, nothing to set up per slot
+static bool backend_reserve(wsping_session_t* s, int count)
+{
+	(void)s;
+	(void)count;
+	return true;
+}
+
+// Make room for echo requests of size bytes
+static bool backend_grow(wsping_session_t* s, uint32_t size)
+{
+	if (size <= s->buffer_size) {
+		return true;
+	}
+	uint8_t* send_buffer = (uint8_t*)calloc(1, ICMP_HEADER_SIZE + size);
+	uint8_t* reply_buffer = (uint8_t*)malloc(ICMP_HEADER_SIZE + size);
+	if (!send_buffer || !reply_buffer) {
+		free(send_buffer);
+		free(reply_buffer);
+		s->err_cb(s->userdata, "Not enough resources available");
+		return false;
+	}
+	memcpy(send_buffer, s->send_buffer, ICMP_HEADER_SIZE);
+	fill_request_data(s, send_buffer + ICMP_HEADER_SIZE, size);
+	free(s->send_buffer);
+	free(s->reply_buffer);
+	s->send_buffer = send_buffer;
+	s->reply_buffer = reply_buffer;
+	s->buffer_size = size;
+	return true;
+}
+
+// Set the don't fragment flag of the echo requests. Linux probe mode
+// also sends requests larger than the path MTU it has cached, so every
+// size is tried on the wire and the previous mode comes back after
+static void backend_set_df(wsping_session_t* s, bool on)
+{
+#if defined(IP_MTU_DISCOVER) && defined(IPV6_MTU_DISCOVER)
+	int level = s->family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+	int name = s->family == AF_INET6 ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER;
+	if (on) {
+		int mode = s->family == AF_INET6 ? IPV6_PMTUDISC_PROBE : IP_PMTUDISC_PROBE;
+		socklen_t len = sizeof(s->sock_pmtudisc);
+		getsockopt(s->sock, level, name, &s->sock_pmtudisc, &len);
+		setsockopt(s->sock, level, name, &mode, sizeof(mode));
+	} else {
+		setsockopt(s->sock, level, name, &s->sock_pmtudisc, sizeof(s->sock_pmtudisc));
+	}
+#elif defined(IP_DONTFRAG) && defined(IPV6_DONTFRAG)
+	int value = on ? 1 : 0;
+	if (s->family == AF_INET6) {
+		setsockopt(s->sock, IPPROTO_IPV6, IPV6_DONTFRAG, &value, sizeof(value));
+	} else {
+		setsockopt(s->sock, IPPROTO_IP, IP_DONTFRAG, &value, sizeof(value));
+	}
+#else
+	(void)s;
+	(void)on;
+#endif
+}
+
+wsping_reply_status_t wsp_map_icmp_error(int family, int type, int code)
+{
+	if (family == AF_INET6) {
+		if (type == ICMP6_TIME_EXCEEDED) {
+			return wsping_reply_ttl_expired;
+		}
+		if (type == ICMP6_PACKET_TOO_BIG) {
+			return wsping_reply_packet_too_big;
+		}
+		if (type == ICMP6_DST_UNREACH) {
+			return code == ICMP6_DST_UNREACH_NOROUTE ? wsping_reply_net_unreachable : wsping_reply_host_unreachable;
+		}
+	} else {
+		if (type == ICMP_TIME_EXCEEDED) {
+			return wsping_reply_ttl_expired;
+		}
+		if (type == ICMP_DEST_UNREACH && code == ICMP_FRAG_NEEDED) {
+			return wsping_reply_packet_too_big;
+		}
+		if (type == ICMP_DEST_UNREACH) {
+			return code == ICMP_NET_UNREACH ? wsping_reply_net_unreachable : wsping_reply_host_unreachable;
+		}
+	}
+	return wsping_reply_other;
+}
+
+bool wsp_pending_icmp_error(int err)
+{
+	switch (err) {
+		case ECONNREFUSED:
+		case EHOSTUNREACH:
+		case ENETUNREACH:
+#ifdef EPROTO
+		case EPROTO:
+#endif
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Find the echo request in flight with the given sequence number
+static probe_slot_t* find_pending(wsping_session_t* s, uint16_t seq)
+{
+	for (int i = 0; i < WSPING_MAX_WINDOW; i++) {
+		if (s->slots[i].state == slot_pending && s->slots[i].reply.sequence == seq) {
+			return &s->slots[i];
+		}
+	}
+	return NULL;
+}
+
+// Fill a reply from the ancillary data of an echo reply
+static void parse_reply(struct msghdr* msg, probe_slot_t* slot)
+{
+	wsping_reply_t* r = &slot->reply;
+	for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+		if ((c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_TTL) ||
+			(c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_HOPLIMIT)) {
+			int ttl;
+			memcpy(&ttl, CMSG_DATA(c), sizeof(ttl));
+			r->ttl = ttl;
+		}
+	}
+
+	set_address_sockaddr(&slot->responder, (struct sockaddr*)msg->msg_name);
+	r->status = wsping_reply_ok;
+}
+
+#if defined(IP_RECVERR)
+// Fill a reply from an ICMP error (unreachable, time exceeded)
+// taken from the socket error queue
+static void parse_error(wsping_session_t* s, struct msghdr* msg, probe_slot_t* slot)
+{
+	wsping_reply_t* r = &slot->reply;
+	r->status = wsping_reply_failed;
+	for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+		if ((c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_RECVERR) ||
+			(c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+			struct sock_extended_err* ee = (struct sock_extended_err*)CMSG_DATA(c);
+			if (ee->ee_origin == SO_EE_ORIGIN_ICMP || ee->ee_origin == SO_EE_ORIGIN_ICMP6) {
+				set_address_sockaddr(&slot->responder, SO_EE_OFFENDER(ee));
+				r->status = wsp_map_icmp_error(s->family, ee->ee_type, ee->ee_code);
+				r->detail = ((unsigned long)ee->ee_type << 8) | ee->ee_code;
+				if (r->status == wsping_reply_packet_too_big) {
+					r->detail = ee->ee_info;   // Next hop MTU
+				}
+			} else {
+				r->detail = ee->ee_errno;
+			}
+		}
+	}
+}
+#endif
+
+// Read one echo reply, or one queued ICMP error when flags has
+// MSG_ERRQUEUE, returns false once there is nothing left to read
+static bool recv_packet(wsping_session_t* s, int flags, wsping_reply_t* replies, int* n)
+{
+	uint8_t* packet = s->reply_buffer;
+	uint8_t control[512];
+	struct sockaddr_storage from;
+	struct iovec iov = { packet, ICMP_HEADER_SIZE + s->buffer_size };
+	struct msghdr msg = {0};
+	msg.msg_name = &from;
+	msg.msg_namelen = sizeof(from);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t len = recvmsg(s->sock, &msg, flags | MSG_DONTWAIT);
+	if (len < 0) {
+		return false;
+	}
+	uint64_t received_ns = probe_clock_ns(s);
+
+	// The error queue hands back our own request as payload,
+	// either way the sequence number tells which slot it is for
+	uint16_t seq = (uint16_t)((packet[6] << 8) | packet[7]);
+	uint8_t reply_type = s->family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY;
+	probe_slot_t* slot = len >= ICMP_HEADER_SIZE ? find_pending(s, seq) : NULL;
+	if (!slot) {
+		return true;
+	}
+
+#if defined(IP_RECVERR)
+	if (flags & MSG_ERRQUEUE) {
+		parse_error(s, &msg, slot);
+	} else
+#endif
+	if (packet[0] == reply_type) {
+		parse_reply(&msg, slot);
+	} else {
+		return true;
+	}
+
+#ifdef SO_TIMESTAMPNS
+	// Prefer the time the kernel received the packet
+	for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+			received_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+		}
+	}
+#endif
+
+	slot->reply.rtt_ns = received_ns > slot->sent_ns ? received_ns - slot->sent_ns : 0;
+	slot->reply.rtt = (uint32_t)(slot->reply.rtt_ns / 1000000);
+	slot->reply.data_size = (int)len - ICMP_HEADER_SIZE;
+	if (slot->reply.status == wsping_reply_ok) {
+		check_echo_data(slot, s->send_buffer + ICMP_HEADER_SIZE, packet + ICMP_HEADER_SIZE, (uint32_t)slot->reply.data_size);
+	}
+	slot->state = slot_done;
+	finish_slot(s, slot, replies, n);
+	return true;
+}
+
+// Put one echo request on the wire
+static bool backend_send(wsping_session_t* s, probe_slot_t* slot)
+{
+	uint8_t* packet = s->send_buffer;
+	uint16_t seq = slot->reply.sequence;
+	packet[6] = (uint8_t)(seq >> 8);
+	packet[7] = (uint8_t)(seq & 0xff);
+
+	if (slot->ttl != s->sock_ttl) {
+		set_socket_ttl(s, slot->ttl);
+	}
+
+	slot->sent_at = wsp_clock_ms();
+	slot->deadline = slot->sent_at + s->options.timeout;
+	slot->sent_ns = probe_clock_ns(s);
+	ssize_t sent = sendto(s->sock, packet, ICMP_HEADER_SIZE + slot->size, 0, s->target->ai_addr, s->target->ai_addrlen);
+	if (sent < 0 && wsp_pending_icmp_error(errno)) {
+		// An ICMP error of an earlier request is also left pending on
+		// the socket and fails the next send once, try it again
+		sent = sendto(s->sock, packet, ICMP_HEADER_SIZE + slot->size, 0, s->target->ai_addr, s->target->ai_addrlen);
+	}
+
+	if (sent < 0 && errno == EMSGSIZE) {
+		// Larger than the MTU of the outgoing interface
+		slot->reply.status = wsping_reply_packet_too_big;
+		slot->state = slot_done;
+	} else if (sent < 0) {
+		slot->reply.status = wsping_reply_failed;
+		slot->reply.detail = (unsigned long)errno;
+		slot->state = slot_done;
+	} else {
+		slot->state = slot_pending;
+	}
+	return true;
+}
+
+// Collect completed echo requests, waiting on the socket until at
+// least one completes or wait_ms elapsed. Requests older than the
+// timeout are completed as timed out.
+static int backend_poll(wsping_session_t* s, wsping_reply_t* replies, int max_replies, uint32_t wait_ms)
+{
+	uint64_t now = wsp_clock_ms();
+	uint64_t deadline = now + wait_ms;
+	int n = 0;
+
+	for (;;) {
+#if defined(IP_RECVERR)
+		while (n < max_replies && recv_packet(s, MSG_ERRQUEUE, replies, &n)) {}
+#endif
+		while (n < max_replies && recv_packet(s, 0, replies, &n)) {}
+
+		uint64_t wake = deadline;
+		for (int i = 0; i < WSPING_MAX_WINDOW && n < max_replies; i++) {
+			probe_slot_t* slot = &s->slots[i];
+			if (slot->state == slot_pending && now >= slot->deadline) {
+				// RTO
+				slot->reply.status = wsping_reply_timed_out;
+				slot->state = slot_done;
+			}
+			if (slot->state == slot_done) {
+				finish_slot(s, slot, replies, &n);
+			} else if (slot->state == slot_pending && slot->deadline < wake) {
+				wake = slot->deadline;
+			}
+		}
+
+		if (n > 0 || s->outstanding == 0 || now >= deadline) {
+			break;
+		}
+
+		struct pollfd pfd = { s->sock, POLLIN, 0 };
+		poll(&pfd, 1, wake > now ? (int)(wake - now) : 0);
+		now = wsp_clock_ms();
+	}
+
+	return n;
+}
+
+const char* wsping_session_get_target_canonical_name(const wsping_session_t* s)
+{
+	return s->canon_name;
+}
+
+#endif
+
+/*--------------*
+ | Reply Status |
+ *--------------*/
+
+static const char* const status_names[] = {
+	"ok", "timed_out", "net_unreachable", "host_unreachable",
+	"ttl_expired", "other", "failed", "packet_too_big"
+};
+
+const char* wsp_status_name(wsping_reply_status_t status)
+{
+	return (unsigned)status < sizeof(status_names) / sizeof(status_names[0]) ? status_names[status] : "other";
+}
+
+/*---------*
+ | Seqlock |
+ *---------*/
+
+// The writer bumps the sequence to odd while it writes, readers retry
+// until they copied between two reads of the same even sequence. The
+// data is copied a word at a time so nothing is read or written twice
+static void copy_words(volatile uint32_t* dst, const volatile uint32_t* src, size_t size)
+{
+	for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+		dst[i] = src[i];
+	}
+}
+
+void wsp_seqlock_begin(uint32_t* seq)
+{
+	wsp_atomic_store(seq, *seq + 1);
+	wsp_atomic_fence();
+}
+
+void wsp_seqlock_end(uint32_t* seq)
+{
+	wsp_atomic_store(seq, *seq + 1);
+}
+
+void wsp_seqlock_write(uint32_t* seq, void* dst, const void* src, size_t size)
+{
+	wsp_seqlock_begin(seq);
+	copy_words((volatile uint32_t*)dst, (const volatile uint32_t*)src, size);
+	wsp_seqlock_end(seq);
+}
+
+void wsp_seqlock_read(const uint32_t* seq, void* dst, const void* src, size_t size)
+{
+	for (;;) {
+		uint32_t start = wsp_atomic_load(seq);
+		if ((start & 1) == 0) {
+			copy_words((volatile uint32_t*)dst, (const volatile uint32_t*)src, size);
+			wsp_atomic_fence();
+			if (wsp_atomic_load(seq) == start) {
+				return;
+			}
+		}
+		wsp_cpu_relax();
+	}
+}
+
+/*--------------*
+ | Session Core |
+ *--------------*/
+
+wsping_session_t* wsping_session_create(wsping_errfunc_t err_func, void* udata)
+{
+	wsping_session_t* s = (wsping_session_t*)calloc(1, sizeof(wsping_session_t));
+	if (!s) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	s->err_cb = err_func;
+	s->userdata = udata;
+	s->family = AF_UNSPEC;
+	s->export_id = -1;
+
+	if (!backend_init(s)) {
+		free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+void wsping_session_destroy(wsping_session_t* s)
+{
+	if (!s) {
+		return;
+	}
+	wsping_session_stop(s);
+	backend_shutdown(s);
+	wsp_recent_free(&s->recent);
+	free(s->payload);
+	free(s);
+}
+
+static void set_status(wsping_session_t* s, const char* text)
+{
+	size_t len = strlen(text);
+	if (len >= sizeof(s->stats.status_text)) {
+		len = sizeof(s->stats.status_text) - 1;
+	}
+	memcpy(s->stats.status_text, text, len);
+	s->stats.status_text[len] = 0;
+}
+
+// Hand a consistent copy of the statistics to readers on other
+// threads, without ever waiting for them
+static void publish_stats(wsping_session_t* s)
+{
+	wsp_seqlock_write(&s->published_seq, &s->published, &s->stats, sizeof(s->stats));
+}
+
+// Forget the path seen by earlier traceroute rounds
+static void clear_path(wsping_session_t* s)
+{
+	s->trace_pending = 0;
+	wsp_seqlock_begin(&s->path_seq);
+	memset(&s->path, 0, sizeof(s->path));
+	wsp_seqlock_end(&s->path_seq);
+}
+
+// Reset all stats
+void wsping_session_reset(wsping_session_t* s)
+{
+	assert(s);
+	memset(&s->responder, 0, sizeof(s->responder));
+	memset(s->canon_name, 0, sizeof(s->canon_name));
+#ifdef _WIN32
+	memset(s->canon_name_utf8, 0, sizeof(s->canon_name_utf8));
+#endif
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->rtt_m2 = 0;
+	wsp_recent_reset(&s->recent);
+	set_status(s, "Ping Stopped");
+	publish_stats(s);
+	wsp_seqlock_begin(&s->rtt_hist_seq);
+	wsping_histogram_reset(&s->rtt_hist);
+	wsp_seqlock_end(&s->rtt_hist_seq);
+	clear_path(s);
+}
+
+// Update the session stats with a completed echo request
+// Welford's online mean and variance, and the RFC 3550 interarrival
+// jitter where the transit time difference of two replies in a row is
+// the difference of their round trip times
+static void update_rtt_variation(wsping_session_t* s, uint64_t rtt_ns)
+{
+	double rtt = (double)rtt_ns;
+	double n = (double)s->stats.echos_successful;
+	double delta = rtt - s->stats.rtt_mean_ns;
+	s->stats.rtt_mean_ns += delta / n;
+	s->rtt_m2 += delta * (rtt - s->stats.rtt_mean_ns);
+	s->stats.rtt_mdev_ns = sqrt(s->rtt_m2 / n);
+	s->stats.rtt_stddev_ns = n > 1 ? sqrt(s->rtt_m2 / (n - 1)) : 0.0;
+
+	if (n > 1) {
+		double d = fabs(rtt - (double)s->stats.reply_time_ns);
+		s->stats.jitter_ns += (d - s->stats.jitter_ns) / 16.0;
+	}
+}
+
+static void update_stats(wsping_session_t* s, const wsping_reply_t* r)
+{
+	s->stats.status = r->status;
+	s->stats.detail = r->detail;
+	switch (r->status) {
+		case wsping_reply_ok:
+			// The target site was replied
+			set_status(s, "OK");
+			s->stats.echos_received++;
+			s->stats.echos_successful++;
+			s->stats.data_size = r->data_size;
+			s->stats.ttl = r->ttl;
+			s->stats.reply_time = r->rtt == 0 ? 1 : r->rtt;
+			if (r->rtt < s->stats.rtt_min || s->stats.rtt_min == 0) {
+				s->stats.rtt_min = r->rtt;
+			}
+			if (r->rtt > s->stats.rtt_max || s->stats.rtt_max == 0) {
+				s->stats.rtt_max = r->rtt;
+			}
+			s->stats.rtt_total += r->rtt;
+			update_rtt_variation(s, r->rtt_ns);
+			s->stats.reply_time_ns = r->rtt_ns;
+			if (r->rtt_ns < s->stats.rtt_min_ns || s->stats.rtt_min_ns == 0) {
+				s->stats.rtt_min_ns = r->rtt_ns;
+			}
+			if (r->rtt_ns > s->stats.rtt_max_ns) {
+				s->stats.rtt_max_ns = r->rtt_ns;
+			}
+			s->stats.rtt_total_ns += r->rtt_ns;
+			if (r->corrupted) {
+				s->stats.echos_corrupted++;
+				if (r->data_size < (int)s->options.request_size) {
+					s->stats.echos_truncated++;
+				}
+			}
+			wsp_seqlock_begin(&s->rtt_hist_seq);
+			wsping_histogram_record(&s->rtt_hist, r->rtt_ns);
+			wsp_seqlock_end(&s->rtt_hist_seq);
+			break;
+		case wsping_reply_timed_out:
+			// RTO
+			set_status(s, "Request timed out");
+			break;
+		case wsping_reply_net_unreachable:
+			// Network unreachable
+			set_status(s, "Destination network unreachable");
+			s->stats.echos_received++;
+			break;
+		case wsping_reply_host_unreachable:
+			// Network host uncreachable
+			set_status(s, "Destination host unreachable");
+			s->stats.echos_received++;
+			break;
+		case wsping_reply_ttl_expired:
+			// TTL expired
+			set_status(s, "TTL expired in transit");
+			s->stats.echos_received++;
+			break;
+		case wsping_reply_other:
+			// Another reply
+			wsping_sprintf(s->status_buf, "Echo reply returned %lu", r->detail);
+			set_status(s, s->status_buf);
+			s->stats.echos_received++;
+			break;
+		case wsping_reply_failed:
+			// Unhandled error
+			wsping_sprintf(s->status_buf, "Transmit failed. (Code %lu)", r->detail);
+			set_status(s, s->status_buf);
+			break;
+		case wsping_reply_packet_too_big:
+			// DF set on a request larger than the path MTU
+			set_status(s, "Packet needs to be fragmented but DF set");
+			s->stats.echos_received++;
+			break;
+	}
+	wsp_recent_push(&s->recent, wsp_clock_ns(), r->status == wsping_reply_ok, r->rtt_ns);
+	wsp_recent_fill(&s->recent, &s->stats);
+	publish_stats(s);
+}
+
+// Fold one reply into the stats of its hop, a couple of
+// additions so that many paths can be watched at once
+static void update_hop(hop_track_t* hop, uint64_t rtt_ns)
+{
+	double rtt = (double)rtt_ns;
+	hop->received++;
+	if (hop->received > 1) {
+		double d = rtt - (double)hop->rtt_last_ns;
+		hop->jitter_ns += (fabs(d) - hop->jitter_ns) / 16.0;
+	}
+	if (hop->received == 1 || rtt_ns < hop->rtt_min_ns) {
+		hop->rtt_min_ns = rtt_ns;
+	}
+	if (rtt_ns > hop->rtt_max_ns) {
+		hop->rtt_max_ns = rtt_ns;
+	}
+	double delta = rtt - hop->rtt_mean_ns;
+	hop->rtt_mean_ns += delta / (double)hop->received;
+	hop->rtt_m2 += delta * (rtt - hop->rtt_mean_ns);
+	hop->rtt_last_ns = rtt_ns;
+}
+
+// Fold a completed round into the path table and compare its
+// responders with the known path. A hop answered by another router,
+// or the target showing up at another distance, counts as a route
+// change. The hops behind the target are the target answering again
+// and are left out, so is a round the target did not answer beyond
+// the distance known from earlier rounds
+static void finish_round(wsping_session_t* s)
+{
+	path_table_t* p = &s->path;
+	int hops = s->round_hops;
+	bool changed = false;
+
+	if (s->round_length != 0) {
+		hops = s->round_length;
+	} else if (p->length != 0 && (int)p->length < hops) {
+		hops = (int)p->length;
+	}
+
+	wsp_seqlock_begin(&s->path_seq);
+	for (int i = 0; i < hops; i++) {
+		hop_track_t* hop = &p->hops[i];
+		const round_hop_t* r = &s->round[i];
+		hop->sent += r->sent;
+		if (r->responder.length == 0) {
+			continue;
+		}
+		update_hop(hop, r->rtt_ns);
+		if (hop->address.length != 0 && memcmp(&hop->address, &r->responder, sizeof(wsp_address_t)) != 0) {
+			hop->address_changes++;
+			changed = true;
+		}
+		hop->address = r->responder;
+	}
+	if (s->round_length != 0) {
+		changed |= p->length != 0 && p->length != (uint32_t)s->round_length;
+		p->length = (uint32_t)s->round_length;
+	}
+	if (changed) {
+		p->route_changes++;
+	}
+	p->rounds++;
+	wsp_seqlock_end(&s->path_seq);
+}
+
+// Keep the reply of one hop until its round is complete. Replies
+// come in any order, so only then is it known where the target is
+static void record_hop(wsping_session_t* s, const probe_slot_t* slot)
+{
+	int index = slot->hop - 1;
+	const wsping_reply_t* r = &slot->reply;
+
+	if (s->trace_hops) {
+		wsping_hop_t* out = &s->trace_hops[index];
+		out->status = r->status;
+		out->rtt_ns = r->rtt_ns;
+		wsp_format_address(&slot->responder, out->address);
+	}
+
+	s->round[index].responder = slot->responder;
+	s->round[index].rtt_ns = r->rtt_ns;
+	bool target = r->status == wsping_reply_ok ||
+		(slot->responder.length != 0 && memcmp(&slot->responder, &s->destination, sizeof(wsp_address_t)) == 0);
+	if (target && (s->round_length == 0 || slot->hop < s->round_length)) {
+		s->round_length = slot->hop;
+	}
+
+	if (--s->trace_pending == 0) {
+		finish_round(s);
+	}
+}
+
+// Append a completed echo request to the probe log and the result
+// stream of the session
+static void record_reply(wsping_session_t* s, const probe_slot_t* slot)
+{
+	wsping_record_t record;
+	record.time_ns = wsp_clock_wall_ns();
+	record.target = s->options.record_id;
+	record.sequence = slot->reply.sequence;
+	record.rtt_ns = slot->reply.rtt_ns;
+	record.ttl = (uint8_t)slot->reply.ttl;
+	record.status = slot->reply.status;
+	record.size = slot->size;
+	if (s->options.recorder) {
+		wsping_recorder_append(s->options.recorder, &record);
+	}
+	if (s->options.output) {
+		wsping_output_write(s->options.output, &record, s->target_name, s->target_address);
+	}
+}
+
+static void finish_slot(wsping_session_t* s, probe_slot_t* slot, wsping_reply_t* replies, int* n)
+{
+	if (slot->hop != 0) {
+		// Traceroute probes stay out of the ping stats
+		record_hop(s, slot);
+	} else if (s->mtu_replies) {
+		// So do path MTU probes
+		s->mtu_replies[slot - s->slots] = slot->reply;
+	} else {
+		if (slot->responder.length != 0) {
+			set_responder(s, &slot->responder);
+		}
+		update_stats(s, &slot->reply);
+		if (s->options.recorder || s->options.output) {
+			record_reply(s, slot);
+		}
+		if (s->export_id >= 0) {
+			wsping_exporter_observe(s->options.exporter, s->export_id, slot->reply.status, slot->reply.rtt_ns);
+		}
+		replies[(*n)++] = slot->reply;
+	}
+	slot->state = slot_free;
+	s->outstanding--;
+}
+
+// Put an echo request with the given TTL and data size in flight
+static bool send_slot(wsping_session_t* s, probe_slot_t* slot, uint8_t ttl, uint8_t hop, uint32_t size)
+{
+	memset(&slot->reply, 0, sizeof(slot->reply));
+	memset(&slot->responder, 0, sizeof(slot->responder));
+	slot->reply.sequence = ++s->sequence;
+	slot->ttl = ttl;
+	slot->hop = hop;
+	slot->size = size;
+	if (!backend_send(s, slot)) {
+		set_status(s, "Ping Error");
+		publish_stats(s);
+		s->err_cb(s->userdata, "Not enough resources available");
+		return false;
+	}
+	s->outstanding++;
+	return true;
+}
+
+int wsping_session_send(wsping_session_t* s)
+{
+	assert(s);
+	if (!s->target) {
+		s->err_cb(s->userdata, "Ping has not been started");
+		return -1;
+	}
+	if (s->outstanding >= (int)s->options.window) {
+		return -1;
+	}
+
+	probe_slot_t* slot = NULL;
+	for (uint32_t i = 0; i < s->options.window; i++) {
+		if (s->slots[i].state == slot_free) {
+			slot = &s->slots[i];
+			break;
+		}
+	}
+	assert(slot);
+
+	if (!send_slot(s, slot, s->options.ttl, 0, s->options.request_size)) {
+		return -1;
+	}
+
+	s->stats.echos_sent++;
+	publish_stats(s);
+	return slot->reply.sequence;
+}
+
+int wsping_session_poll(wsping_session_t* s, wsping_reply_t* replies, int max_replies, uint32_t wait_ms)
+{
+	assert(s);
+	assert(replies || max_replies == 0);
+	if (max_replies <= 0) {
+		return 0;
+	}
+	int n = backend_poll(s, replies, max_replies, wait_ms);
+	if (s->options.output) {
+		wsp_output_tick(s->options.output, wsp_clock_wall_ns());
+	}
+	return n;
+}
+
+int wsping_session_get_outstanding(const wsping_session_t* s)
+{
+	return s->outstanding;
+}
+
+// Waits longer than this sleep or block on the socket, the rest is spun
+// away so echo requests leave on time despite the coarse timers
+#ifdef _WIN32
+#define WORKER_SPIN_NS 2000000   // Sleep() granularity after timeBeginPeriod(1)
+#else
+#define WORKER_SPIN_NS 1000000   // poll() only takes milliseconds
+#endif
+
+// Fixed rate scheduling, echo request k is due at start + k * interval
+// so time spent probing never adds up to drift. Due times missed by a
+// whole interval are skipped instead of being sent in a burst. Every
+// completed echo request is handed to the reply callback
+static void worker_main(void* arg)
+{
+	wsping_session_t* s = (wsping_session_t*)arg;
+	wsping_reply_t replies[WSPING_MAX_WINDOW];
+	const uint64_t interval = (uint64_t)s->options.interval * 1000000;
+	const uint64_t start = wsp_clock_ns();
+	const uint64_t end = s->options.deadline != 0 ? start + (uint64_t)s->options.deadline * 1000000 : UINT64_MAX;
+	uint64_t tick = 0;
+	uint64_t first_send = 0;
+	uint32_t sent = 0;
+
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+	s->stats.rate_requested = 1e9 / (double)interval;
+	while (!wsp_atomic_load(&s->worker_stop)) {
+		uint64_t now = wsp_clock_ns();
+		bool sending = (s->options.count == 0 || sent < s->options.count) && now < end;
+		if (!sending && s->outstanding == 0) {
+			break;
+		}
+
+		uint64_t due = start + tick * interval;
+		bool window_full = s->options.monitor_hops != 0 ? s->trace_pending > 0 : s->outstanding >= (int)s->options.window;
+		if (sending && now >= due && !window_full) {
+			if (now - due >= interval) {
+				uint64_t missed = (now - due) / interval;
+				s->stats.echos_skipped += missed;
+				tick += missed;
+				due += missed * interval;
+			}
+			if (now - due > s->stats.send_late_max_ns) {
+				s->stats.send_late_max_ns = now - due;
+			}
+			if (sent == 0) {
+				first_send = now;
+			} else {
+				s->stats.rate_achieved = (double)sent * 1e9 / (double)(now - first_send);
+			}
+			tick++;
+			if (s->options.monitor_hops != 0) {
+				if (wsping_session_send_trace(s, (int)s->options.monitor_hops) > 0) {
+					sent++;
+				}
+			} else {
+				sent++;
+				wsping_session_send(s);
+			}
+			continue;
+		}
+
+		// Time left until the next echo request is due, or a step
+		// when only replies are awaited
+		uint64_t left = WORKER_STEP * (uint64_t)1000000;
+		if (sending && !window_full && due - now < left) {
+			left = due - now;
+		}
+
+		if (s->outstanding > 0) {
+			uint32_t wait = left > WORKER_SPIN_NS ? (uint32_t)((left - WORKER_SPIN_NS) / 1000000) : 0;
+			int n = wsping_session_poll(s, replies, WSPING_MAX_WINDOW, wait);
+			for (int i = 0; i < n && s->reply_cb; i++) {
+				s->reply_cb(s->reply_userdata, &replies[i]);
+			}
+		} else if (left > WORKER_SPIN_NS + 1000000) {
+			if (s->options.output) {
+				wsp_output_tick(s->options.output, wsp_clock_wall_ns());
+			}
+			wsp_sleep_ms((uint32_t)((left - WORKER_SPIN_NS) / 1000000));
+		} else {
+			wsp_cpu_relax();
+		}
+	}
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+
+	// The last results need not wait for the next session
+	if (s->options.output) {
+		wsping_output_flush(s->options.output);
+	}
+	wsp_atomic_store(&s->worker_done, 1);
+}
+
+bool wsping_session_run(wsping_session_t* s, wsping_replyfunc_t reply_func, void* udata)
+{
+	assert(s);
+	if (!s->target) {
+		s->err_cb(s->userdata, "Ping has not been started");
+		return false;
+	}
+	if (s->worker_running) {
+		s->err_cb(s->userdata, "Ping is already running");
+		return false;
+	}
+
+	s->reply_cb = reply_func;
+	s->reply_userdata = udata;
+	wsp_atomic_store(&s->worker_stop, 0);
+	wsp_atomic_store(&s->worker_done, 0);
+	if (!wsp_thread_start(&s->worker, worker_main, s)) {
+		s->err_cb(s->userdata, "Failed to create the ping thread");
+		return false;
+	}
+	s->worker_running = true;
+	return true;
+}
+
+void wsping_session_wait(wsping_session_t* s)
+{
+	assert(s);
+	if (!s->worker_running) {
+		return;
+	}
+	wsp_thread_join(&s->worker);
+	s->worker_running = false;
+}
+
+void wsping_session_stop(wsping_session_t* s)
+{
+	assert(s);
+	if (!s->worker_running) {
+		return;
+	}
+	wsp_atomic_store(&s->worker_stop, 1);
+	wsping_session_wait(s);
+}
+
+bool wsping_session_is_running(const wsping_session_t* s)
+{
+	return s->worker_running && !wsp_atomic_load(&s->worker_done);
+}
+
+// Get reply from target site
+void wsping_session_refresh(wsping_session_t* s)
+{
+	wsping_reply_t reply;
+
+	assert(s);
+
+	// Make room when asynchronous requests filled the window
+	while (s->outstanding >= (int)s->options.window) {
+		wsping_session_poll(s, &reply, 1, s->options.timeout);
+	}
+
+	int seq = wsping_session_send(s);
+	if (seq < 0) {
+		return;
+	}
+
+	// Block until our own request completes
+	while (s->outstanding > 0) {
+		if (wsping_session_poll(s, &reply, 1, s->options.timeout) == 1 && reply.sequence == (uint16_t)seq) {
+			break;
+		}
+	}
+}
+
+int wsping_session_send_trace(wsping_session_t* s, int max_hops)
+{
+	int free_slots[WSPING_MAX_WINDOW];
+	int count = 0;
+
+	assert(s);
+	if (!s->target) {
+		s->err_cb(s->userdata, "Ping has not been started");
+		return -1;
+	}
+	if (s->trace_pending > 0 || max_hops <= 0) {
+		return -1;
+	}
+	if (max_hops > WSPING_MAX_WINDOW) {
+		max_hops = WSPING_MAX_WINDOW;
+	}
+
+	// Every hop needs a slot of its own
+	for (int i = 0; i < WSPING_MAX_WINDOW && count < max_hops; i++) {
+		if (s->slots[i].state == slot_free) {
+			free_slots[count++] = i;
+		}
+	}
+	if (count < max_hops || !backend_reserve(s, free_slots[count - 1] + 1)) {
+		return -1;
+	}
+
+	// One request per hop, all of them in flight at once. Routers answer
+	// with time exceeded, the target and the hops behind it with a reply
+	memset(s->round, 0, sizeof(s->round));
+	s->round_hops = max_hops;
+	s->round_length = 0;
+	int sent = 0;
+	for (int i = 0; i < max_hops; i++) {
+		probe_slot_t* slot = &s->slots[free_slots[i]];
+		if (!send_slot(s, slot, (uint8_t)(i + 1), (uint8_t)(i + 1), s->options.request_size)) {
+			break;
+		}
+		s->trace_pending++;
+
+		// A request that failed to leave the host completes right away
+		// and still closes its hop in the round, but is not a probe
+		s->round[i].sent = slot->state == slot_pending;
+		sent += s->round[i].sent;
+	}
+	wsp_seqlock_begin(&s->path_seq);
+	s->path.probed = (uint32_t)max_hops;
+	wsp_seqlock_end(&s->path_seq);
+	return s->trace_pending > 0 ? sent : -1;
+}
+
+int wsping_session_trace(wsping_session_t* s, wsping_hop_t* hops, int max_hops)
+{
+	wsping_reply_t reply;
+
+	assert(s);
+	assert(hops);
+	if (s->worker_running) {
+		s->err_cb(s->userdata, "Stop the background ping before tracing");
+		return -1;
+	}
+	if (max_hops <= 0) {
+		return 0;
+	}
+	if (max_hops > WSPING_MAX_WINDOW) {
+		max_hops = WSPING_MAX_WINDOW;
+	}
+
+	// Every slot may be needed, earlier requests finish first
+	while (s->outstanding > 0) {
+		wsping_session_poll(s, &reply, 1, s->options.timeout);
+	}
+
+	for (int i = 0; i < max_hops; i++) {
+		memset(&hops[i], 0, sizeof(hops[i]));
+		hops[i].ttl = (uint8_t)(i + 1);
+		hops[i].status = wsping_reply_failed;
+	}
+	s->trace_hops = hops;
+	if (wsping_session_send_trace(s, max_hops) < 0) {
+		s->trace_hops = NULL;
+		return -1;
+	}
+	while (s->trace_pending > 0) {
+		backend_poll(s, &reply, 1, s->options.timeout);
+	}
+	s->trace_hops = NULL;
+
+	return s->round_length != 0 ? s->round_length : max_hops;
+}
+
+bool wsping_session_start(wsping_session_t* s, const wsping_options_t* opt)
+{
+	assert(s);
+	assert(opt);
+
+	// Restarting a session drops the previous target
+	wsping_session_stop(s);
+	backend_release(s);
+
+	s->options = *opt;
+	s->export_id = -1;
+	s->options.timeout = wsping_defval(s->options.timeout, 4000);
+	s->options.request_size = wsping_defval(s->options.request_size, 32);
+	s->options.resolve_address = wsping_defval(s->options.resolve_address, false);
+	s->options.ttl = wsping_defval(s->options.ttl, 128);
+	s->options.window = wsping_defval(s->options.window, 1);
+	s->options.interval = wsping_defval(s->options.interval, 1000);
+	s->options.recent_count = wsping_defval(s->options.recent_count, DEFAULT_RECENT_COUNT);
+
+	if (!s->options.target_site || strlen(s->options.target_site) == 0) {
+		s->err_cb(s->userdata, "Target address must be specified");
+		return false;
+	}
+	snprintf(s->target_name, sizeof(s->target_name), "%s", s->options.target_site);
+
+	if (s->options.request_size > MAX_SEND_SIZE) {
+		s->err_cb(s->userdata, "Send buffer size is too large");
+		return false;
+	}
+
+	// The custom pattern must outlive the caller's buffer
+	uint8_t* payload = NULL;
+	if (s->options.payload == wsping_payload_custom) {
+		if (!s->options.payload_data || s->options.payload_length == 0) {
+			s->err_cb(s->userdata, "Payload pattern data must be specified");
+			return false;
+		}
+		payload = (uint8_t*)malloc(s->options.payload_length);
+		if (!payload) {
+			s->err_cb(s->userdata, "Not enough resources available");
+			return false;
+		}
+		memcpy(payload, s->options.payload_data, s->options.payload_length);
+	} else {
+		s->options.payload_length = 0;
+	}
+	free(s->payload);
+	s->payload = payload;
+	s->options.payload_data = payload;
+
+	if (s->options.window > WSPING_MAX_WINDOW) {
+		s->options.window = WSPING_MAX_WINDOW;
+	}
+
+	if (s->options.monitor_hops > WSPING_MAX_WINDOW) {
+		s->options.monitor_hops = WSPING_MAX_WINDOW;
+	}
+	clear_path(s);
+
+	if (s->options.ip_version == wsping_ipv4) {
+		s->family = AF_INET;
+	} else if (s->options.ip_version == wsping_ipv6) {
+		s->family = AF_INET6;
+	}
+
+	// A shared resolver answers from its cache, the reverse lookup
+	// is only needed when the target was an address already
+	s->resolved_name[0] = 0;
+	if (s->options.resolver) {
+		char err[WSPING_BUF_SIZE] = {0};
+		wsping_resolver_t* r = s->options.resolver;
+		if (!wsping_resolver_resolve(r, s->options.target_site, s->options.ip_version, s->resolved_address, s->resolved_name, sizeof(s->resolved_name))) {
+			wsping_sprintf(err, "Could not find host %s. Please check the name and try again", s->options.target_site);
+			s->err_cb(s->userdata, err);
+			return false;
+		}
+		if (!s->resolved_name[0] && s->options.resolve_address &&
+			!wsping_resolver_resolve_reverse(r, s->resolved_address, s->resolved_name, sizeof(s->resolved_name))) {
+			wsping_sprintf(err, "Could not find the host name of %s", s->resolved_address);
+			s->err_cb(s->userdata, err);
+			return false;
+		}
+		s->options.target_site = s->resolved_address;
+	}
+
+	// Recent probes of a previous target no longer count
+	wsp_recent_free(&s->recent);
+	if (!wsp_recent_init(&s->recent, s->options.recent_count, s->options.recent_ms)) {
+		s->err_cb(s->userdata, "Not enough resources available");
+		return false;
+	}
+
+	if (!backend_start(s)) {
+		backend_release(s);
+		return false;
+	}
+
+	memset(&s->destination, 0, sizeof(s->destination));
+	set_address_sockaddr(&s->destination, s->target->ai_addr);
+	wsp_format_address(&s->destination, s->target_address);
+	set_responder(s, &s->destination);
+
+	// Exported under the name the caller asked for
+	if (s->options.exporter) {
+		s->export_id = wsping_exporter_add_target(s->options.exporter, s->target_name, s->target_address);
+		if (s->export_id < 0) {
+			backend_release(s);
+			return false;
+		}
+	}
+
+	set_status(s, "Ping Started");
+	publish_stats(s);
+
+	return true;
+}
+
+/*--------------------*
+ | Path MTU Discovery |
+ *--------------------*/
+
+// Link MTUs tried in the first round, RFC 1191 plateaus and the
+// usual Ethernet, PPPoE, tunnel and jumbo frame sizes
+static const uint32_t mtu_plateaus[] = {
+	576, 1280, 1400, 1480, 1492, 1500, 4352, 8166, 9000, 17914, 32000, 65535
+};
+
+enum
+{
+	MTU_PROBES = 8,        // Sizes in flight per round after the first
+	MTU_MAX_ROUNDS = 32
+};
+
+// Sizes still to learn about lie between good (the largest that came
+// back) and bad (the smallest that did not)
+typedef struct _mtu_search
+{
+	int64_t good;
+	int64_t too_big;   // Smallest size refused with a too big error
+	int64_t lost;      // Smallest size that vanished without one
+	int lost_tries;
+	uint32_t sizes[WSPING_MAX_WINDOW];
+	int count;
+}
+mtu_search_t;
+
+static int64_t mtu_bad(const mtu_search_t* m)
+{
+	return m->lost < m->too_big ? m->lost : m->too_big;
+}
+
+// IP and ICMP headers in front of the request data
+static uint32_t mtu_overhead(const wsping_session_t* s)
+{
+	return (s->family == AF_INET6 ? 40 : 20) + ICMP_HEADER_SIZE;
+}
+
+static void add_mtu_size(mtu_search_t* m, int64_t size)
+{
+	if (size <= m->good || size >= mtu_bad(m) || m->count == WSPING_MAX_WINDOW) {
+		return;
+	}
+	for (int i = 0; i < m->count; i++) {
+		if (m->sizes[i] == (uint32_t)size) {
+			return;
+		}
+	}
+	m->sizes[m->count++] = (uint32_t)size;
+}
+
+// Send every size of a round at once and wait for all of them
+static bool run_mtu_round(wsping_session_t* s, mtu_search_t* m, wsping_mtu_t* result)
+{
+	wsping_reply_t replies[WSPING_MAX_WINDOW];
+	wsping_reply_t reply;
+
+	if (!backend_reserve(s, m->count)) {
+		return false;
+	}
+	s->mtu_replies = replies;
+	for (int i = 0; i < m->count; i++) {
+		if (!send_slot(s, &s->slots[i], s->options.ttl, 0, m->sizes[i])) {
+			m->count = i;
+			break;
+		}
+	}
+	while (s->outstanding > 0) {
+		backend_poll(s, &reply, 1, s->options.timeout);
+	}
+	s->mtu_replies = NULL;
+	result->rounds++;
+	result->probes += (uint32_t)m->count;
+
+	for (int i = 0; i < m->count; i++) {
+		int64_t size = m->sizes[i];
+		if (replies[i].status == wsping_reply_ok) {
+			m->good = size > m->good ? size : m->good;
+		} else if (replies[i].status == wsping_reply_packet_too_big) {
+			m->too_big = size < m->too_big ? size : m->too_big;
+			uint32_t mtu = (uint32_t)replies[i].detail;
+			if (mtu != 0 && (result->reported_mtu == 0 || mtu < result->reported_mtu)) {
+				result->reported_mtu = mtu;
+			}
+		} else if (size == m->lost) {
+			m->lost_tries++;
+		} else if (size < m->lost) {
+			m->lost = size;
+			m->lost_tries = 1;
+		}
+	}
+	return m->count > 0;
+}
+
+bool wsping_session_discover_mtu(wsping_session_t* s, uint32_t max_size, wsping_mtu_t* result)
+{
+	mtu_search_t m;
+	wsping_reply_t reply;
+
+	assert(s);
+	assert(result);
+	memset(result, 0, sizeof(*result));
+	if (!s->target) {
+		s->err_cb(s->userdata, "Ping has not been started");
+		return false;
+	}
+	if (s->worker_running) {
+		s->err_cb(s->userdata, "Stop the background ping before discovering the MTU");
+		return false;
+	}
+	if (max_size == 0 || max_size > MAX_SEND_SIZE) {
+		max_size = MAX_SEND_SIZE;
+	}
+
+	// Every slot may be needed, earlier requests finish first
+	while (s->outstanding > 0) {
+		wsping_session_poll(s, &reply, 1, s->options.timeout);
+	}
+	if (!backend_grow(s, max_size)) {
+		return false;
+	}
+
+	memset(&m, 0, sizeof(m));
+	m.good = -1;
+	m.too_big = (int64_t)max_size + 1;
+	m.lost = m.too_big;
+
+	// The smallest request tells whether the target answers at all,
+	// the largest one ends the search right away on a local link
+	uint32_t overhead = mtu_overhead(s);
+	add_mtu_size(&m, 0);
+	add_mtu_size(&m, max_size);
+	for (size_t i = 0; i < sizeof(mtu_plateaus) / sizeof(mtu_plateaus[0]); i++) {
+		if (mtu_plateaus[i] >= overhead) {
+			add_mtu_size(&m, mtu_plateaus[i] - overhead);
+		}
+	}
+
+	backend_set_df(s, true);
+	bool ok = true;
+	while (ok && result->rounds < MTU_MAX_ROUNDS) {
+		ok = run_mtu_round(s, &m, result);
+		if (!ok || m.good < 0) {
+			break;
+		}
+
+		// A success above a failure means the failure was plain loss
+		if (m.lost <= m.good) {
+			m.lost = (int64_t)max_size + 1;
+			m.lost_tries = 0;
+		}
+		if (m.too_big <= m.good) {
+			m.too_big = (int64_t)max_size + 1;
+		}
+
+		m.count = 0;
+		int64_t bad = mtu_bad(&m);
+		if (bad == m.good + 1) {
+			// Converged, a size that vanished only once gets another try
+			if (bad == m.lost && m.lost <= max_size && m.lost_tries < 2) {
+				m.sizes[m.count++] = (uint32_t)bad;
+				continue;
+			}
+			break;
+		}
+
+		// Next hop MTUs from too big errors are most likely the answer,
+		// the rest of the round splits the range left evenly
+		if (result->reported_mtu > overhead) {
+			add_mtu_size(&m, (int64_t)result->reported_mtu - overhead);
+			add_mtu_size(&m, (int64_t)result->reported_mtu - overhead + 1);
+		}
+		for (int i = 1; i <= MTU_PROBES; i++) {
+			add_mtu_size(&m, m.good + (bad - m.good) * i / (MTU_PROBES + 1));
+		}
+		if (m.count == 0) {
+			add_mtu_size(&m, m.good + 1);
+		}
+	}
+	backend_set_df(s, false);
+
+	if (!ok) {
+		return false;
+	}
+	if (m.good < 0) {
+		s->err_cb(s->userdata, "Path MTU discovery got no reply from the target");
+		return false;
+	}
+	result->payload = (uint32_t)m.good;
+	result->mtu = (uint32_t)m.good + overhead;
+	result->black_hole = mtu_bad(&m) == m.lost && m.lost < m.too_big && m.lost_tries >= 2;
+	return true;
+}
+
+/*---------------------*
+ | Session Stats Getter |
+ *---------------------*/
+
+// The 32-bit getters predate the 64-bit counters, they stick
+// at their maximum instead of wrapping around
+static uint32_t saturate_u32(uint64_t value)
+{
+	return value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+const char* wsping_session_get_target_ip_address(const wsping_session_t* s)
+{
+	return s->stats.ip_address;
+}
+
+const char* wsping_session_get_status(const wsping_session_t* s)
+{
+	return s->stats.status_text;
+}
+
+int wsping_session_get_data_size(const wsping_session_t* s)
+{
+	return s->stats.data_size;
+}
+
+int wsping_session_get_ttl(const wsping_session_t* s)
+{
+	return s->stats.ttl;
+}
+
+uint32_t wsping_session_get_reply_time(const wsping_session_t* s)
+{
+	return s->stats.reply_time;
+}
+
+uint64_t wsping_session_get_reply_time_ns(const wsping_session_t* s)
+{
+	return s->stats.reply_time_ns;
+}
+
+uint32_t wsping_session_get_rtt_min(const wsping_session_t* s)
+{
+	return s->stats.rtt_min;
+}
+
+uint32_t wsping_session_get_rtt_max(const wsping_session_t* s)
+{
+	return s->stats.rtt_max;
+}
+
+uint32_t wsping_session_get_rtt_total(const wsping_session_t* s)
+{
+	return saturate_u32(s->stats.rtt_total);
+}
+
+uint64_t wsping_session_get_rtt_total64(const wsping_session_t* s)
+{
+	return s->stats.rtt_total;
+}
+
+uint64_t wsping_session_get_rtt_min_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_min_ns;
+}
+
+uint64_t wsping_session_get_rtt_max_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_max_ns;
+}
+
+uint64_t wsping_session_get_rtt_total_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_total_ns;
+}
+
+double wsping_session_get_rtt_mean_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_mean_ns;
+}
+
+double wsping_session_get_rtt_stddev_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_stddev_ns;
+}
+
+double wsping_session_get_rtt_mdev_ns(const wsping_session_t* s)
+{
+	return s->stats.rtt_mdev_ns;
+}
+
+double wsping_session_get_jitter_ns(const wsping_session_t* s)
+{
+	return s->stats.jitter_ns;
+}
+
+uint32_t wsping_session_get_data_sent(const wsping_session_t* s)
+{
+	return saturate_u32(s->stats.echos_sent);
+}
+
+uint32_t wsping_session_get_data_received(const wsping_session_t* s)
+{
+	return saturate_u32(s->stats.echos_received);
+}
+
+uint32_t wsping_session_get_data_successful(const wsping_session_t* s)
+{
+	return saturate_u32(s->stats.echos_successful);
+}
+
+uint64_t wsping_session_get_data_sent64(const wsping_session_t* s)
+{
+	return s->stats.echos_sent;
+}
+
+uint64_t wsping_session_get_data_received64(const wsping_session_t* s)
+{
+	return s->stats.echos_received;
+}
+
+uint64_t wsping_session_get_data_successful64(const wsping_session_t* s)
+{
+	return s->stats.echos_successful;
+}
+
+void wsping_session_get_stats(const wsping_session_t* s, wsping_stats_t* stats)
+{
+	assert(s);
+	assert(stats);
+	wsp_seqlock_read(&s->published_seq, stats, &s->published, sizeof(*stats));
+}
+
+uint64_t wsping_session_get_rtt_percentile_ns(const wsping_session_t* s, double percentile)
+{
+	return wsping_histogram_percentile(&s->rtt_hist, percentile);
+}
+
+void wsping_session_get_histogram(const wsping_session_t* s, wsping_histogram_t* h)
+{
+	assert(s);
+	assert(h);
+	wsp_seqlock_read(&s->rtt_hist_seq, h, &s->rtt_hist, sizeof(*h));
+}
+
+// Only the head of the path table, the hops are read one by one
+static void read_path_head(const wsping_session_t* s, path_table_t* p)
+{
+	wsp_seqlock_read(&s->path_seq, p, &s->path, offsetof(path_table_t, hops));
+}
+
+// Hops to the target, or the hops probed while it never answered
+int wsping_session_get_hop_count(const wsping_session_t* s)
+{
+	path_table_t p;
+	assert(s);
+	read_path_head(s, &p);
+	return (int)(p.length != 0 ? p.length : p.probed);
+}
+
+uint32_t wsping_session_get_route_changes(const wsping_session_t* s)
+{
+	path_table_t p;
+	assert(s);
+	read_path_head(s, &p);
+	return p.route_changes;
+}
+
+uint64_t wsping_session_get_trace_rounds(const wsping_session_t* s)
+{
+	path_table_t p;
+	assert(s);
+	read_path_head(s, &p);
+	return p.rounds;
+}
+
+bool wsping_session_get_hop_stats(const wsping_session_t* s, int index, wsping_hop_stats_t* stats)
+{
+	hop_track_t hop;
+	assert(s);
+	assert(stats);
+	if (index < 0 || index >= WSPING_MAX_WINDOW) {
+		return false;
+	}
+	wsp_seqlock_read(&s->path_seq, &hop, &s->path.hops[index], sizeof(hop));
+
+	memset(stats, 0, sizeof(*stats));
+	stats->ttl = (uint8_t)(index + 1);
+	wsp_format_address(&hop.address, stats->address);
+	stats->sent = hop.sent;
+	stats->received = hop.received;
+	stats->rtt_last_ns = hop.rtt_last_ns;
+	stats->rtt_min_ns = hop.rtt_min_ns;
+	stats->rtt_max_ns = hop.rtt_max_ns;
+	stats->rtt_mean_ns = hop.rtt_mean_ns;
+	stats->rtt_stddev_ns = hop.received > 1 ? sqrt(hop.rtt_m2 / (double)(hop.received - 1)) : 0;
+	stats->jitter_ns = hop.jitter_ns;
+	stats->address_changes = hop.address_changes;
+	return true;
+}
+
+/*---------------------*
+ | Single Session API  |
+ *---------------------*/
+
+bool wsping_init(wsping_errfunc_t err_func, void* udata)
+{
+	if (default_session) {
+		wsping_session_destroy(default_session);
+	}
+	default_session = wsping_session_create(err_func, udata);
+	return default_session != NULL;
+}
+
+void wsping_shutdown()
+{
+	wsping_session_destroy(default_session);
+	default_session = NULL;
+}
+
+bool wsping_start(const wsping_options_t* opt)
+{
+	return wsping_session_start(default_session, opt);
+}
+
+void wsping_reset()
+{
+	wsping_session_reset(default_session);
+}
+
+void wsping_refresh()
+{
+	wsping_session_refresh(default_session);
+}
+
+int wsping_trace(wsping_hop_t* hops, int max_hops)
+{
+	return wsping_session_trace(default_session, hops, max_hops);
+}
+
+int wsping_send_trace(int max_hops)
+{
+	return wsping_session_send_trace(default_session, max_hops);
+}
+
+bool wsping_discover_mtu(uint32_t max_size, wsping_mtu_t* result)
+{
+	return wsping_session_discover_mtu(default_session, max_size, result);
+}
+
+bool wsping_run(wsping_replyfunc_t reply_func, void* udata)
+{
+	return wsping_session_run(default_session, reply_func, udata);
+}
+
+void wsping_wait()
+{
+	wsping_session_wait(default_session);
+}
+
+void wsping_stop()
+{
+	wsping_session_stop(default_session);
+}
+
+bool wsping_is_running()
+{
+	return wsping_session_is_running(default_session);
+}
+
+const char* wsping_get_status()
+{
+	return wsping_session_get_status(default_session);
+}
+
+const char* wsping_get_target_ip_address()
+{
+	return wsping_session_get_target_ip_address(default_session);
+}
+
+const char* wsping_get_target_canonical_name()
+{
+	return wsping_session_get_target_canonical_name(default_session);
+}
+
+int wsping_get_data_size()
+{
+	return wsping_session_get_data_size(default_session);
+}
+
+int wsping_get_ttl()
+{
+	return wsping_session_get_ttl(default_session);
+}
+
+uint32_t wsping_get_reply_time()
+{
+	return wsping_session_get_reply_time(default_session);
+}
+
+uint64_t wsping_get_reply_time_ns()
+{
+	return wsping_session_get_reply_time_ns(default_session);
+}
+
+uint32_t wsping_get_rtt_min()
+{
+	return wsping_session_get_rtt_min(default_session);
+}
+
+uint32_t wsping_get_rtt_max()
+{
+	return wsping_session_get_rtt_max(default_session);
+}
+
+uint32_t wsping_get_rtt_total()
+{
+	return wsping_session_get_rtt_total(default_session);
+}
+
+uint64_t wsping_get_rtt_total64()
+{
+	return wsping_session_get_rtt_total64(default_session);
+}
+
+uint64_t wsping_get_rtt_min_ns()
+{
+	return wsping_session_get_rtt_min_ns(default_session);
+}
+
+uint64_t wsping_get_rtt_max_ns()
+{
+	return wsping_session_get_rtt_max_ns(default_session);
+}
+
+uint64_t wsping_get_rtt_total_ns()
+{
+	return wsping_session_get_rtt_total_ns(default_session);
+}
+
+double wsping_get_rtt_mean_ns()
+{
+	return wsping_session_get_rtt_mean_ns(default_session);
+}
+
+double wsping_get_rtt_stddev_ns()
+{
+	return wsping_session_get_rtt_stddev_ns(default_session);
+}
+
+double wsping_get_rtt_mdev_ns()
+{
+	return wsping_session_get_rtt_mdev_ns(default_session);
+}
+
+double wsping_get_jitter_ns()
+{
+	return wsping_session_get_jitter_ns(default_session);
+}
+
+uint32_t wsping_get_data_sent()
+{
+	return wsping_session_get_data_sent(default_session);
+}
+
+uint32_t wsping_get_data_received()
+{
+	return wsping_session_get_data_received(default_session);
+}
+
+uint32_t wsping_get_data_successful()
+{
+	return wsping_session_get_data_successful(default_session);
+}
+
+uint64_t wsping_get_data_sent64()
+{
+	return wsping_session_get_data_sent64(default_session);
+}
+
+uint64_t wsping_get_data_received64()
+{
+	return wsping_session_get_data_received64(default_session);
+}
+
+uint64_t wsping_get_data_successful64()
+{
+	return wsping_session_get_data_successful64(default_session);
+}
+
+void wsping_get_stats(wsping_stats_t* stats)
+{
+	wsping_session_get_stats(default_session, stats);
+}
+
+uint64_t wsping_get_rtt_percentile_ns(double percentile)
+{
+	return wsping_session_get_rtt_percentile_ns(default_session, percentile);
+}
+
+void wsping_get_histogram(wsping_histogram_t* h)
+{
+	wsping_session_get_histogram(default_session, h);
+}
+
+int wsping_get_hop_count()
+{
+	return wsping_session_get_hop_count(default_session);
+}
+
+uint32_t wsping_get_route_changes()
+{
+	return wsping_session_get_route_changes(default_session);
+}
+
+uint64_t wsping_get_trace_rounds()
+{
+	return wsping_session_get_trace_rounds(default_session);
+}
+
+bool wsping_get_hop_stats(int index, wsping_hop_stats_t* stats)
 {
-	return echos_successful;
+	return wsping_session_get_hop_stats(default_session, index, stats);
 }
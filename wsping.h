@@ -2,6 +2,7 @@
 
 /*********************************************************
  * Simple pinging library for Windows using WinSock2 API *
+ * and for POSIX systems using ICMP datagram sockets     *
  *********************************************************/
 
 #include <stdio.h>
@@ -13,6 +14,21 @@
 extern "C" {
 #endif
 
+// Maximum number of echo requests a session can keep in flight
+#define WSPING_MAX_WINDOW 64
+
+// Room for the status text in wsping_stats_t
+#define WSPING_STATUS_SIZE 64
+
+// Room for a numeric IPv4 or IPv6 address
+#define WSPING_ADDRESS_SIZE 46
+
+// Latency histogram layout, values keep a relative precision of
+// 1 / 2^WSPING_HIST_SUB_BITS and saturate at 2^WSPING_HIST_MAX_BITS ns
+#define WSPING_HIST_SUB_BITS 7
+#define WSPING_HIST_MAX_BITS 36
+#define WSPING_HIST_BUCKETS ((WSPING_HIST_MAX_BITS - WSPING_HIST_SUB_BITS + 1) << WSPING_HIST_SUB_BITS)
+
 typedef enum _wsping_ip_version
 {
 	wsping_ipv4,
@@ -23,6 +39,32 @@ wsping_ip_version_t;
 // Error output function callback
 typedef void (*wsping_errfunc_t)(void*, const char*);
 
+// Opaque ping session, every session owns its own ICMP handle,
+// target and statistics so many of them can run side by side
+typedef struct _wsping_session wsping_session_t;
+
+// Opaque name resolver, shared by sessions and sweeps, see below
+typedef struct _wsping_resolver wsping_resolver_t;
+
+// Opaque probe log writer, shared by sessions and sweeps, see below
+typedef struct _wsping_recorder wsping_recorder_t;
+
+// Opaque metrics exporter, shared by sessions and sweeps, see below
+typedef struct _wsping_exporter wsping_exporter_t;
+
+// Opaque JSON Lines / CSV result writer, shared by sessions and sweeps, see below
+typedef struct _wsping_output wsping_output_t;
+
+// Data of the echo requests, echoed data is checked against it
+typedef enum _wsping_payload
+{
+	wsping_payload_zero,        // All zero, the default
+	wsping_payload_increment,   // 0x00, 0x01, ... 0xff, 0x00, ...
+	wsping_payload_random,      // Pseudo random bytes from payload_seed
+	wsping_payload_custom       // payload_data repeated
+}
+wsping_payload_t;
+
 typedef struct _wsping_options
 {
 	uint32_t timeout;
@@ -31,9 +73,524 @@ typedef struct _wsping_options
 	bool resolve_address;
 	const char* target_site;
 	wsping_ip_version_t ip_version;
+	uint32_t window;   // Echo requests in flight, 1 to WSPING_MAX_WINDOW
+	bool kernel_timestamps;   // Measure RTT from kernel receive timestamps (POSIX)
+	uint32_t interval;   // Milliseconds between echo requests of wsping_session_run(), default 1000
+	uint32_t count;      // Echo requests wsping_session_run() sends, 0 for no limit
+	uint32_t deadline;   // Milliseconds after which wsping_session_run() stops sending, 0 for none
+	uint32_t recent_count;   // Completed probes in the recent stats, default 100
+	uint32_t recent_ms;      // Also leave out probes older than this, 0 for no age limit
+	wsping_resolver_t* resolver;   // Resolve the target through this cache, NULL to resolve directly
+	uint32_t monitor_hops;   // wsping_session_run() traces this many hops per interval instead of pinging, 0 to ping
+	wsping_payload_t payload;   // Data pattern of the echo requests
+	uint32_t payload_seed;      // Seed of wsping_payload_random
+	const uint8_t* payload_data;   // Pattern of wsping_payload_custom, copied by wsping_session_start()
+	uint32_t payload_length;
+	wsping_recorder_t* recorder;   // Log every completed echo request here, NULL for none
+	uint32_t record_id;            // Target id of the logged echo requests
+	wsping_exporter_t* exporter;   // Export the results of the echo requests, NULL for none
+	wsping_output_t* output;       // Stream every completed echo request here, NULL for none
 } 
 wsping_options_t;
 
+// Outcome of a single echo request
+typedef enum _wsping_reply_status
+{
+	wsping_reply_ok,
+	wsping_reply_timed_out,
+	wsping_reply_net_unreachable,
+	wsping_reply_host_unreachable,
+	wsping_reply_ttl_expired,
+	wsping_reply_other,    // Unexpected reply, see detail
+	wsping_reply_failed,   // Transmit failed, see detail
+	wsping_reply_packet_too_big   // Needs fragmentation but DF is set, detail has the next hop MTU when known
+}
+wsping_reply_status_t;
+
+typedef struct _wsping_reply
+{
+	uint16_t sequence;
+	wsping_reply_status_t status;
+	unsigned long detail;  // Platform status code for other/failed replies, next hop MTU for packet_too_big
+	uint32_t rtt;          // Round trip time in milliseconds
+	uint64_t rtt_ns;       // Round trip time in nanoseconds
+	int ttl;
+	int data_size;
+	bool corrupted;        // Echoed data differs from the request or came back short
+}
+wsping_reply_t;
+
+// Statistics of a session, wsping_session_get_stats() copies them as
+// a whole so the numbers always agree with each other
+typedef struct _wsping_stats
+{
+	uint64_t echos_sent;
+	uint64_t echos_received;
+	uint64_t echos_successful;
+	uint32_t rtt_min;        // Round trip times in milliseconds
+	uint32_t rtt_max;
+	uint64_t rtt_total;
+	uint32_t reply_time;
+	int data_size;           // Of the last successful reply
+	int ttl;
+	wsping_reply_status_t status;  // Of the last completed echo request
+	unsigned long detail;
+	uint64_t reply_time_ns;  // Round trip times in nanoseconds
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	uint64_t rtt_total_ns;
+	double rtt_mean_ns;      // Mean of successful round trip times
+	double rtt_stddev_ns;    // Sample standard deviation
+	double rtt_mdev_ns;      // Population standard deviation, like ping's mdev
+	double jitter_ns;        // RFC 3550 interarrival jitter
+	char status_text[WSPING_STATUS_SIZE];  // Same as wsping_session_get_status()
+	char ip_address[WSPING_ADDRESS_SIZE];  // Same as wsping_session_get_target_ip_address()
+	// Schedule of wsping_session_run(), in echo requests per second
+	double rate_requested;
+	double rate_achieved;
+	uint64_t send_late_max_ns;  // Worst delay of an echo request past its due time
+	uint64_t echos_skipped;     // Due times missed by a whole interval
+	// Successful replies whose echoed data differs from the request,
+	// and those that echoed less data than was sent
+	uint64_t echos_corrupted;
+	uint64_t echos_truncated;
+	// Over the most recent completed probes, see recent_count and
+	// recent_ms, so an outage shows up no matter how long we ran
+	uint32_t recent_probes;
+	uint32_t recent_successful;
+	uint64_t recent_rtt_min_ns;
+	uint64_t recent_rtt_max_ns;
+	double recent_rtt_mean_ns;
+}
+wsping_stats_t;
+
+// Log-linear (HDR style) histogram of nanosecond round trip times,
+// fixed memory and constant time recording
+typedef struct _wsping_histogram
+{
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[WSPING_HIST_BUCKETS];
+}
+wsping_histogram_t;
+
+// Values from low to high (inclusive) were recorded count times
+typedef struct _wsping_histogram_bucket
+{
+	uint64_t low;
+	uint64_t high;
+	uint64_t count;
+}
+wsping_histogram_bucket_t;
+
+// One hop of wsping_session_trace()
+typedef struct _wsping_hop
+{
+	uint8_t ttl;
+	wsping_reply_status_t status;   // ttl_expired for a router, ok for the target
+	char address[WSPING_ADDRESS_SIZE];   // Responder, empty when nothing answered
+	uint64_t rtt_ns;
+}
+wsping_hop_t;
+
+// Running stats of one hop over every traceroute round
+typedef struct _wsping_hop_stats
+{
+	uint8_t ttl;
+	char address[WSPING_ADDRESS_SIZE];   // Last responder, empty when nothing answered yet
+	uint64_t sent;
+	uint64_t received;
+	uint64_t rtt_last_ns;
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	double rtt_mean_ns;
+	double rtt_stddev_ns;
+	double jitter_ns;   // RFC 3550 interarrival jitter of the hop
+	uint32_t address_changes;   // Rounds answered by another router than the one before
+}
+wsping_hop_stats_t;
+
+// Outcome of wsping_session_discover_mtu()
+typedef struct _wsping_mtu
+{
+	uint32_t mtu;            // Largest packet that got through unfragmented, IP and ICMP headers included
+	uint32_t payload;        // Request data size of that packet
+	uint32_t reported_mtu;   // Smallest next hop MTU of a too big error, 0 when none said so
+	bool black_hole;         // Larger packets vanished without any too big error
+	uint32_t rounds;         // Rounds of probes in flight at once
+	uint32_t probes;         // Echo requests sent
+}
+wsping_mtu_t;
+
+// Reply callback of the background ping thread, runs on that thread
+typedef void (*wsping_replyfunc_t)(void*, const wsping_reply_t*);
+
+// Session initialization / destruction
+wsping_session_t* wsping_session_create(wsping_errfunc_t err_func, void* udata);
+void wsping_session_destroy(wsping_session_t* s);
+
+// Session operations
+bool wsping_session_start(wsping_session_t* s, const wsping_options_t* opt);
+void wsping_session_reset(wsping_session_t* s);
+void wsping_session_refresh(wsping_session_t* s);
+
+// Background pinging, a thread owned by the session sends echo requests
+// at the fixed rate of the interval, count and deadline options, and
+// passes each completed one to reply_func (may be NULL). Stats are best
+// read through wsping_session_get_stats() meanwhile, and the session must
+// not be refreshed, sent, polled or reset from other threads until it
+// stops. wsping_session_wait() blocks until count or deadline is reached,
+// starting or destroying the session stops the thread
+bool wsping_session_run(wsping_session_t* s, wsping_replyfunc_t reply_func, void* udata);
+void wsping_session_wait(wsping_session_t* s);
+void wsping_session_stop(wsping_session_t* s);
+bool wsping_session_is_running(const wsping_session_t* s);
+
+// Asynchronous session operations. wsping_session_send() puts a new
+// echo request in flight and returns its sequence number, or -1 when
+// the window is full. wsping_session_poll() waits up to wait_ms for
+// requests to complete and returns how many replies were written.
+// Completed replies are counted in the session stats too.
+int wsping_session_send(wsping_session_t* s);
+int wsping_session_poll(wsping_session_t* s, wsping_reply_t* replies, int max_replies, uint32_t wait_ms);
+int wsping_session_get_outstanding(const wsping_session_t* s);
+
+// Traceroute to the session target. Hops 1 to max_hops (at most
+// WSPING_MAX_WINDOW) are probed at once, so a trace takes about one
+// timeout instead of one per hop. Returns how many hops it took to
+// reach the target, max_hops when it was not reached or -1 on error.
+// Trace probes are not counted in the session stats
+int wsping_session_trace(wsping_session_t* s, wsping_hop_t* hops, int max_hops);
+
+// Path monitoring, mtr style. wsping_session_send_trace() puts one
+// traceroute round of max_hops in flight and returns how many probes
+// left the host, or -1 while the previous round is still running or too
+// few slots are free. Rounds complete through wsping_session_poll(),
+// or run at the interval of wsping_session_run() with monitor_hops set.
+// Every round updates the loss, round trip times and jitter of each
+// hop up to the target, and a hop answered by another router or the
+// target answering at another distance counts as a route change. The
+// getters below are safe to call from any thread
+int wsping_session_send_trace(wsping_session_t* s, int max_hops);
+int wsping_session_get_hop_count(const wsping_session_t* s);
+uint32_t wsping_session_get_route_changes(const wsping_session_t* s);
+uint64_t wsping_session_get_trace_rounds(const wsping_session_t* s);
+bool wsping_session_get_hop_stats(const wsping_session_t* s, int index, wsping_hop_stats_t* stats);
+
+// Path MTU discovery, finds the largest echo request up to max_size bytes
+// of data (0 for the largest request_size) that reaches the target with
+// DF set. Every round has several sizes in flight at once, the common
+// link MTUs first, then sizes spread over the range left, so discovery
+// takes a few timeouts at most. A size that vanished twice without a
+// too big error is reported as a black hole. Returns false when the
+// target did not answer at all. Probes are not counted in the stats
+bool wsping_session_discover_mtu(wsping_session_t* s, uint32_t max_size, wsping_mtu_t* result);
+
+// Session stats getter
+const char* wsping_session_get_status(const wsping_session_t* s);
+const char* wsping_session_get_target_ip_address(const wsping_session_t* s);
+const char* wsping_session_get_target_canonical_name(const wsping_session_t* s);
+int wsping_session_get_data_size(const wsping_session_t* s);
+int wsping_session_get_ttl(const wsping_session_t* s);
+uint32_t wsping_session_get_reply_time(const wsping_session_t* s);
+uint64_t wsping_session_get_reply_time_ns(const wsping_session_t* s);
+uint32_t wsping_session_get_rtt_min(const wsping_session_t* s);
+uint32_t wsping_session_get_rtt_max(const wsping_session_t* s);
+uint32_t wsping_session_get_rtt_total(const wsping_session_t* s);
+uint64_t wsping_session_get_rtt_min_ns(const wsping_session_t* s);
+uint64_t wsping_session_get_rtt_max_ns(const wsping_session_t* s);
+uint64_t wsping_session_get_rtt_total_ns(const wsping_session_t* s);
+double wsping_session_get_rtt_mean_ns(const wsping_session_t* s);
+double wsping_session_get_rtt_stddev_ns(const wsping_session_t* s);
+double wsping_session_get_rtt_mdev_ns(const wsping_session_t* s);
+double wsping_session_get_jitter_ns(const wsping_session_t* s);
+uint32_t wsping_session_get_data_sent(const wsping_session_t* s);
+uint32_t wsping_session_get_data_received(const wsping_session_t* s);
+uint32_t wsping_session_get_data_successful(const wsping_session_t* s);
+
+// 64-bit counters for long running sessions, the 32-bit getters above
+// saturate at UINT32_MAX
+uint64_t wsping_session_get_rtt_total64(const wsping_session_t* s);
+uint64_t wsping_session_get_data_sent64(const wsping_session_t* s);
+uint64_t wsping_session_get_data_received64(const wsping_session_t* s);
+uint64_t wsping_session_get_data_successful64(const wsping_session_t* s);
+
+// Snapshot of all session stats, safe to call from any thread while
+// another one pings, the getters above are for the pinging thread
+void wsping_session_get_stats(const wsping_session_t* s, wsping_stats_t* stats);
+
+// Every successful round trip time goes into a histogram. The percentile
+// getter is for the pinging thread, wsping_session_get_histogram() copies
+// a consistent histogram from any thread
+uint64_t wsping_session_get_rtt_percentile_ns(const wsping_session_t* s, double percentile);
+void wsping_session_get_histogram(const wsping_session_t* s, wsping_histogram_t* h);
+
+// Histogram operations. Percentiles range from 0 to 100, the iterator
+// starts at 0 and only visits non-empty buckets
+void wsping_histogram_reset(wsping_histogram_t* h);
+void wsping_histogram_record(wsping_histogram_t* h, uint64_t value);
+void wsping_histogram_merge(wsping_histogram_t* dst, const wsping_histogram_t* src);
+uint64_t wsping_histogram_percentile(const wsping_histogram_t* h, double percentile);
+bool wsping_histogram_next(const wsping_histogram_t* h, int* iter, wsping_histogram_bucket_t* bucket);
+
+// Payload patterns, the sessions use them for their echo requests.
+// wsping_payload_mismatch() returns the offset of the first byte that
+// differs, or size when both are the same. It compares a vector at a
+// time (SSE2, AVX2 when the CPU has it, NEON)
+void wsping_payload_fill(uint8_t* dst, size_t size, wsping_payload_t pattern, uint32_t seed, const uint8_t* data, size_t length);
+size_t wsping_payload_mismatch(const void* expected, const void* actual, size_t size);
+
+// Internet checksum (RFC 1071) of a packet, ready to be stored in it as
+// is. wsping_checksum_adjust() updates a checksum after one 16-bit word
+// of the packet changed (RFC 1624), words are taken as they are in memory
+uint16_t wsping_checksum(const void* data, size_t size);
+uint16_t wsping_checksum_adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word);
+
+// Name resolution off the probing path. A resolver runs forward and
+// reverse lookups on a bounded pool of threads and caches the answers,
+// failed lookups too but for a shorter time. The system resolver does
+// not report record TTLs, so cache_ttl caps how long an answer is kept.
+typedef struct _wsping_resolver_options
+{
+	uint32_t threads;        // Lookups running at once, default 8
+	uint32_t cache_ttl;      // Seconds an answer stays cached, default 60
+	uint32_t negative_ttl;   // Seconds a failed lookup stays cached, default 5
+	uint32_t cache_size;     // Cached answers, default 1024
+}
+wsping_resolver_options_t;
+
+typedef struct _wsping_resolution
+{
+	const char* query;     // Name or address that was looked up
+	const char* address;   // Numeric address, empty when the lookup failed
+	const char* name;      // Canonical name, or the host name of a reverse lookup
+	bool ok;
+	bool cached;           // Answered from the cache
+}
+wsping_resolution_t;
+
+// Lookup callback, the strings are only valid during the call
+typedef void (*wsping_resolvefunc_t)(void*, const wsping_resolution_t*);
+
+// Resolver initialization / destruction. Lookups that did not start
+// yet call back as failed during destruction. No other thread may
+// still use the resolver then, wsping_resolver_wait() included
+wsping_resolver_t* wsping_resolver_create(const wsping_resolver_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_resolver_destroy(wsping_resolver_t* r);
+
+// Asynchronous lookups. The callback runs on a resolver thread, or
+// right away when the answer is cached. wsping_resolver_wait() blocks
+// until every queued lookup called back
+bool wsping_resolver_lookup(wsping_resolver_t* r, const char* name, wsping_ip_version_t version, wsping_resolvefunc_t func, void* udata);
+bool wsping_resolver_reverse(wsping_resolver_t* r, const char* address, wsping_resolvefunc_t func, void* udata);
+void wsping_resolver_wait(wsping_resolver_t* r);
+
+// Blocking lookups through the same cache on the calling thread.
+// address needs room for 46 characters, name may be NULL
+bool wsping_resolver_resolve(wsping_resolver_t* r, const char* name, wsping_ip_version_t version, char* address, char* canon_name, size_t canon_size);
+bool wsping_resolver_resolve_reverse(wsping_resolver_t* r, const char* address, char* name, size_t size);
+
+// Probe logs, a compact binary record of every probe result. Records
+// are varint coded with timestamps relative to the one before, about
+// 12 bytes each, and go into 64 KB blocks that decode on their own.
+// The writer fills a memory mapped file preallocated a chunk at a
+// time, so appending costs no system call until the chunk is full.
+// A recorder can be shared by sessions on many threads
+typedef struct _wsping_recorder_options
+{
+	uint32_t preallocate;   // MB mapped and preallocated at a time, default 64
+	bool append;            // Continue an existing log instead of replacing it
+}
+wsping_recorder_options_t;
+
+typedef struct _wsping_record
+{
+	uint64_t time_ns;       // Wall clock time the probe completed, ns since 1970
+	uint32_t target;        // record_id of a session, target index of a sweep
+	uint16_t sequence;
+	uint64_t rtt_ns;
+	uint8_t ttl;            // Of the reply, 0 when unknown
+	wsping_reply_status_t status;
+	uint32_t size;          // Request data size
+}
+wsping_record_t;
+
+// Recorder initialization / destruction, the log is cut
+// to the size of its records when the recorder is destroyed
+wsping_recorder_t* wsping_recorder_create(const char* path, const wsping_recorder_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_recorder_destroy(wsping_recorder_t* r);
+
+// Recorder operations. wsping_recorder_flush() starts writing the
+// records back to disk without waiting for it
+bool wsping_recorder_append(wsping_recorder_t* r, const wsping_record_t* record);
+void wsping_recorder_flush(wsping_recorder_t* r);
+uint64_t wsping_recorder_get_count(const wsping_recorder_t* r);
+uint64_t wsping_recorder_get_size(const wsping_recorder_t* r);
+
+// Prometheus / OpenMetrics exposition. The exporter serves GET /metrics
+// on its own thread with per target probe and result counters, loss,
+// an RTT histogram and jitter. Probe threads only bump the counters of
+// their target, a scrape renders the targets that changed since the
+// one before again and updates their text in the kept exposition.
+// Several scrapers are served at once. Sessions and sweeps with an
+// exporter add their targets themselves
+typedef struct _wsping_exporter_options
+{
+	const char* address;   // Numeric listen address, default 127.0.0.1
+	uint16_t port;         // Listen port, default 9464
+}
+wsping_exporter_options_t;
+
+// Exporter initialization / destruction, starts and stops the listener
+wsping_exporter_t* wsping_exporter_create(const wsping_exporter_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_exporter_destroy(wsping_exporter_t* e);
+
+// Exposition writer, gets the text piece by piece in order
+typedef void (*wsping_writefunc_t)(void*, const char*, size_t);
+
+// Exporter operations. wsping_exporter_add_target() returns the id of
+// the target with these labels, the same one when it was added before,
+// or -1 on error. address may be NULL. Results of a target can come
+// from any thread. wsping_exporter_render() hands the exposition the
+// listener would serve to func and returns its size, 0 on error
+int wsping_exporter_add_target(wsping_exporter_t* e, const char* target, const char* address);
+void wsping_exporter_observe(wsping_exporter_t* e, int id, wsping_reply_status_t status, uint64_t rtt_ns);
+size_t wsping_exporter_render(wsping_exporter_t* e, wsping_writefunc_t func, void* udata);
+
+// Machine readable results, one line per completed probe as JSON
+// Lines or CSV. Lines are formatted by hand into a buffer that goes
+// out in one write when it is full or its oldest line has waited
+// flush_interval, checked on every wakeup of a session worker or
+// sweep. Streaming costs no allocation and about one system call per
+// 64 KB. A run of a session worker or sweep ends with a flush. An
+// output can be shared by sessions on many threads, a JSON line
+// looks like
+//
+//   {"time":1700000000.123456,"id":0,"target":"example.com","address":"93.184.216.34",
+//    "seq":1,"status":"ok","rtt_ns":12345678,"ttl":56,"size":32}
+typedef enum _wsping_output_format
+{
+	wsping_output_json,
+	wsping_output_csv   // Same fields, after a header line
+}
+wsping_output_format_t;
+
+typedef struct _wsping_output_options
+{
+	wsping_output_format_t format;
+	uint32_t buffer_size;      // Bytes, default 64 KB
+	uint32_t flush_interval;   // Milliseconds a line may wait in the buffer, default 100
+}
+wsping_output_options_t;
+
+// Output initialization / destruction, writes to a stream the caller
+// keeps open, like stdout. Destroying the output flushes it
+wsping_output_t* wsping_output_create(FILE* stream, const wsping_output_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_output_destroy(wsping_output_t* o);
+
+// Output operations. record->target goes out as the id, target and
+// address may be NULL. Returns false once writing to the stream failed
+bool wsping_output_write(wsping_output_t* o, const wsping_record_t* record, const char* target, const char* address);
+bool wsping_output_flush(wsping_output_t* o);
+uint64_t wsping_output_get_count(const wsping_output_t* o);
+
+// Offline analysis of probe logs. A log is memory mapped and its
+// blocks are split between threads, each one sums up the records of
+// its blocks per target. The partial sums are merged in log order, so
+// the stats, histograms and even the jitter come out the same as if
+// the records were read one by one. Logs added one after the other
+// are treated as one history, oldest first
+typedef struct _wsping_analysis wsping_analysis_t;
+
+typedef struct _wsping_analysis_options
+{
+	uint32_t threads;     // Threads reading a log, default one per CPU
+	uint64_t start_ns;    // Leave out records before this wall clock time, 0 for none
+	uint64_t end_ns;      // and from this time on, 0 for none
+	bool histograms;      // RTT histogram per target, about 30 KB per target and thread
+}
+wsping_analysis_options_t;
+
+// Stats of one target over the analyzed records, in the fields the
+// session keeps live. Recent and schedule stats are left out
+typedef struct _wsping_analysis_result
+{
+	uint32_t target;
+	uint64_t first_ns;    // Wall clock times of its first and last record
+	uint64_t last_ns;
+	wsping_stats_t stats;
+	const wsping_histogram_t* histogram;   // Successful RTTs, NULL without histograms
+}
+wsping_analysis_result_t;
+
+// Analysis initialization / destruction
+wsping_analysis_t* wsping_analysis_create(const wsping_analysis_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_analysis_destroy(wsping_analysis_t* a);
+
+// Analysis operations. Results are sorted by target id and stay
+// valid until the next log is added
+bool wsping_analysis_add_log(wsping_analysis_t* a, const char* path);
+int wsping_analysis_get_target_count(const wsping_analysis_t* a);
+const wsping_analysis_result_t* wsping_analysis_get_result(const wsping_analysis_t* a, int index);
+uint64_t wsping_analysis_get_records(const wsping_analysis_t* a);
+
+// Sweep mode, pings thousands of targets through a few shared
+// ICMP sockets (POSIX backend only)
+typedef struct _wsping_sweep wsping_sweep_t;
+
+typedef struct _wsping_sweep_options
+{
+	uint32_t timeout;        // Per probe timeout in milliseconds
+	uint32_t request_size;
+	uint8_t ttl;
+	uint32_t count;          // Probes sent to every target
+	uint32_t interval;       // Milliseconds between two probes to the same target
+	uint32_t rate;           // Maximum probes per second, 0 for no limit
+	uint32_t sockets;        // Sockets per IP version
+	wsping_ip_version_t ip_version;
+	wsping_resolver_t* resolver;   // Resolver for target names, NULL to resolve directly
+	bool raw_sockets;        // IPv4 through raw sockets, needs CAP_NET_RAW
+	wsping_recorder_t* recorder;   // Log every completed probe, target ids are target indexes
+	wsping_exporter_t* exporter;   // Export the results of every target, NULL for none
+	wsping_output_t* output;       // Stream every completed probe, ids are target indexes
+}
+wsping_sweep_options_t;
+
+typedef struct _wsping_sweep_result
+{
+	const char* target;             // Target as it was added
+	const char* address;            // Numeric address that was pinged
+	wsping_reply_status_t status;   // Status of the last completed probe
+	uint64_t sent;
+	uint64_t received;
+	uint64_t successful;
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	uint64_t rtt_total_ns;
+}
+wsping_sweep_result_t;
+
+// Sweep initialization / destruction
+wsping_sweep_t* wsping_sweep_create(const wsping_sweep_options_t* opt, wsping_errfunc_t err_func, void* udata);
+void wsping_sweep_destroy(wsping_sweep_t* sw);
+
+// Sweep operations. Targets are resolved once when added,
+// wsping_sweep_add_targets() resolves all their names in parallel.
+// wsping_sweep_run() blocks until every probe completed and
+// can be called again for the next sweep.
+bool wsping_sweep_add_target(wsping_sweep_t* sw, const char* target);
+bool wsping_sweep_add_targets(wsping_sweep_t* sw, const char* const* targets, int count);
+bool wsping_sweep_run(wsping_sweep_t* sw);
+
+// Sweep results of the last run
+int wsping_sweep_get_target_count(const wsping_sweep_t* sw);
+const wsping_sweep_result_t* wsping_sweep_get_result(const wsping_sweep_t* sw, int index);
+double wsping_sweep_get_probe_rate(const wsping_sweep_t* sw);
+
+// Single session API below, kept for simple applications.
+// It drives one process-wide default session and is not thread safe.
+
 // Ping initialization / destruction
 bool wsping_init(wsping_errfunc_t err_func, void* udata);
 void wsping_shutdown();
@@ -42,6 +599,13 @@ void wsping_shutdown();
 bool wsping_start(const wsping_options_t* opt);
 void wsping_reset();
 void wsping_refresh();
+int wsping_trace(wsping_hop_t* hops, int max_hops);
+int wsping_send_trace(int max_hops);
+bool wsping_discover_mtu(uint32_t max_size, wsping_mtu_t* result);
+bool wsping_run(wsping_replyfunc_t reply_func, void* udata);
+void wsping_wait();
+void wsping_stop();
+bool wsping_is_running();
 
 // Stats getter
 const char* wsping_get_status();
@@ -50,12 +614,31 @@ const char* wsping_get_target_canonical_name();
 int wsping_get_data_size();
 int wsping_get_ttl();
 uint32_t wsping_get_reply_time();
+uint64_t wsping_get_reply_time_ns();
 uint32_t wsping_get_rtt_min();
 uint32_t wsping_get_rtt_max();
 uint32_t wsping_get_rtt_total();
+uint64_t wsping_get_rtt_min_ns();
+uint64_t wsping_get_rtt_max_ns();
+uint64_t wsping_get_rtt_total_ns();
+double wsping_get_rtt_mean_ns();
+double wsping_get_rtt_stddev_ns();
+double wsping_get_rtt_mdev_ns();
+double wsping_get_jitter_ns();
 uint32_t wsping_get_data_sent();
 uint32_t wsping_get_data_received();
 uint32_t wsping_get_data_successful();
+uint64_t wsping_get_rtt_total64();
+uint64_t wsping_get_data_sent64();
+uint64_t wsping_get_data_received64();
+uint64_t wsping_get_data_successful64();
+void wsping_get_stats(wsping_stats_t* stats);
+uint64_t wsping_get_rtt_percentile_ns(double percentile);
+void wsping_get_histogram(wsping_histogram_t* h);
+int wsping_get_hop_count();
+uint32_t wsping_get_route_changes();
+uint64_t wsping_get_trace_rounds();
+bool wsping_get_hop_stats(int index, wsping_hop_stats_t* stats);
 
 #ifdef __cplusplus
 }
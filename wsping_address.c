@@ -0,0 +1,101 @@
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Text form follows inet_ntop(): dotted quads for IPv4, and for IPv6
+// lowercase hex groups where the longest run of two or more zero groups
+// becomes "::", with IPv4 mapped and compatible addresses ending in a
+// dotted quad.
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char* format_ipv4(const uint8_t* bytes, char* dst)
+{
+	for (int i = 0; i < 4; i++) {
+		unsigned value = bytes[i];
+		if (value >= 100) {
+			*dst++ = (char)('0' + value / 100);
+			value %= 100;
+			*dst++ = (char)('0' + value / 10);
+		} else if (value >= 10) {
+			*dst++ = (char)('0' + value / 10);
+		}
+		*dst++ = (char)('0' + value % 10);
+		if (i < 3) {
+			*dst++ = '.';
+		}
+	}
+	return dst;
+}
+
+static char* format_group(unsigned group, char* dst)
+{
+	bool started = false;
+	for (int shift = 12; shift >= 0; shift -= 4) {
+		unsigned digit = (group >> shift) & 0xf;
+		if (digit || started || shift == 0) {
+			*dst++ = hex_digits[digit];
+			started = true;
+		}
+	}
+	return dst;
+}
+
+static char* format_ipv6(const uint8_t* bytes, char* dst)
+{
+	unsigned groups[8];
+	int best_base = -1, best_len = 0;
+	int cur_base = -1, cur_len = 0;
+
+	for (int i = 0; i < 8; i++) {
+		groups[i] = ((unsigned)bytes[i * 2] << 8) | bytes[i * 2 + 1];
+		if (groups[i] == 0) {
+			if (cur_base < 0) {
+				cur_base = i;
+				cur_len = 0;
+			}
+			if (++cur_len > best_len) {
+				best_base = cur_base;
+				best_len = cur_len;
+			}
+		} else {
+			cur_base = -1;
+		}
+	}
+	if (best_len < 2) {
+		best_base = -1;
+	}
+
+	for (int i = 0; i < 8; i++) {
+		if (i == best_base) {
+			*dst++ = ':';
+			if (i + best_len == 8) {
+				*dst++ = ':';
+			}
+			i += best_len - 1;
+			continue;
+		}
+		if (i > 0) {
+			*dst++ = ':';
+		}
+		// ::a.b.c.d and ::ffff:a.b.c.d
+		if (i == 6 && best_base == 0 && (best_len == 6 || (best_len == 5 && groups[5] == 0xffff))) {
+			return format_ipv4(bytes + 12, dst);
+		}
+		dst = format_group(groups[i], dst);
+	}
+	return dst;
+}
+
+int wsp_format_address(const wsp_address_t* a, char* dst)
+{
+	char* end = dst;
+	if (a->length == 4) {
+		end = format_ipv4(a->bytes, dst);
+	} else if (a->length == 16) {
+		end = format_ipv6(a->bytes, dst);
+	}
+	*end = 0;
+	return (int)(end - dst);
+}
@@ -0,0 +1,668 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// The blocks of a log are split into one contiguous range per thread.
+// Every thread sums its records per target in its own hash table, and
+// the tables are merged into the analysis in range order afterwards.
+// All the sums merge exactly: counters add up, mean and variance merge
+// like Chan et al., and the RFC 3550 jitter is a linear filter, so the
+// jitter of a range started from 0 decays the jitter before it by
+// (15/16)^steps and adds up.
+
+enum
+{
+	MIN_TABLE_SIZE = 64,
+	FAST_DECODE_MARGIN = 5 * 10   // Five varints of up to 10 bytes
+};
+
+// Running sums of one target over a range of records
+typedef struct _target_sums
+{
+	bool used;
+	uint32_t target;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint64_t sent;
+	uint64_t received;
+	uint64_t successful;
+	uint64_t rtt_min_ns;
+	uint64_t rtt_max_ns;
+	uint64_t rtt_total_ns;
+	uint64_t rtt_total_ms;
+	double rtt_mean_ns;
+	double rtt_m2;
+	double jitter_ns;        // Started from 0 at the first reply of the range
+	uint64_t jitter_steps;
+	uint64_t rtt_first_ns;   // First and last successful RTT of the range
+	uint64_t rtt_last_ns;
+	wsping_reply_status_t status;
+	uint8_t ttl;
+	uint32_t data_size;
+	wsping_histogram_t* histogram;
+}
+target_sums_t;
+
+// Open addressing by target id
+typedef struct _sums_table
+{
+	target_sums_t* entries;
+	uint32_t mask;
+	uint32_t count;
+}
+sums_table_t;
+
+// Blocks read by one thread
+typedef struct _scan_job
+{
+	wsping_analysis_t* analysis;
+	const uint8_t* data;
+	uint64_t size;
+	uint64_t first_block;
+	uint64_t end_block;
+	sums_table_t table;
+	uint64_t records;
+	bool failed;
+	wsp_thread_t thread;
+}
+scan_job_t;
+
+struct _wsping_analysis
+{
+	wsping_analysis_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+
+	sums_table_t table;
+	uint64_t records;
+	wsping_analysis_result_t* results;
+	int num_results;
+};
+
+static uint32_t load_u32(const uint8_t* src)
+{
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint64_t load_u64(const uint8_t* src)
+{
+	return (uint64_t)load_u32(src) | ((uint64_t)load_u32(src + 4) << 32);
+}
+
+// Returns NULL when the varint runs past end
+static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t* value)
+{
+	uint64_t v = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t byte = *p++;
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if (byte < 0x80) {
+			*value = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Same without the bounds checks, at most 10 bytes are read
+static const uint8_t* get_varint_fast(const uint8_t* p, uint64_t* value)
+{
+	uint64_t v = *p & 0x7f;
+	if (*p++ >= 0x80) {
+		for (int shift = 7; shift < 64; shift += 7) {
+			uint8_t byte = *p++;
+			v |= (uint64_t)(byte & 0x7f) << shift;
+			if (byte < 0x80) {
+				break;
+			}
+		}
+	}
+	*value = v;
+	return p;
+}
+
+// Decode a record but its time, NULL when it runs past end. Most
+// records are far enough from the end of their block to skip checks
+static const uint8_t* decode_record(const uint8_t* p, const uint8_t* end, wsping_record_t* r, uint64_t* delta)
+{
+	uint64_t target, sequence, size;
+	r->status = (wsping_reply_status_t)(p[0] & 0x7f);
+	r->ttl = p[1];
+	p += 2;
+	if (end - p >= FAST_DECODE_MARGIN) {
+		p = get_varint_fast(p, delta);
+		p = get_varint_fast(p, &target);
+		p = get_varint_fast(p, &sequence);
+		p = get_varint_fast(p, &r->rtt_ns);
+		p = get_varint_fast(p, &size);
+	} else if (!(p = get_varint(p, end, delta)) || !(p = get_varint(p, end, &target)) ||
+		!(p = get_varint(p, end, &sequence)) || !(p = get_varint(p, end, &r->rtt_ns)) ||
+		!(p = get_varint(p, end, &size))) {
+		return NULL;
+	}
+	r->target = (uint32_t)target;
+	r->sequence = (uint16_t)sequence;
+	r->size = (uint32_t)size;
+	return p;
+}
+
+/*-------------*
+ | Sums Tables |
+ *-------------*/
+
+static void free_table(sums_table_t* t)
+{
+	if (t->entries) {
+		for (uint32_t i = 0; i <= t->mask; i++) {
+			free(t->entries[i].histogram);
+		}
+	}
+	free(t->entries);
+	memset(t, 0, sizeof(*t));
+}
+
+static bool grow_table(sums_table_t* t)
+{
+	uint32_t size = t->entries ? (t->mask + 1) * 2 : MIN_TABLE_SIZE;
+	target_sums_t* entries = (target_sums_t*)calloc(size, sizeof(target_sums_t));
+	if (!entries) {
+		return false;
+	}
+	for (uint32_t i = 0; t->entries && i <= t->mask; i++) {
+		if (t->entries[i].used) {
+			uint32_t j = (t->entries[i].target * 0x9e3779b1u) & (size - 1);
+			while (entries[j].used) {
+				j = (j + 1) & (size - 1);
+			}
+			entries[j] = t->entries[i];
+		}
+	}
+	free(t->entries);
+	t->entries = entries;
+	t->mask = size - 1;
+	return true;
+}
+
+// Sums of a target, added when it is not in the table yet
+static target_sums_t* find_sums(sums_table_t* t, uint32_t target)
+{
+	if (!t->entries || (t->count + 1) * 2 > t->mask + 1) {
+		if (!grow_table(t)) {
+			return NULL;
+		}
+	}
+	uint32_t i = (target * 0x9e3779b1u) & t->mask;
+	while (t->entries[i].used) {
+		if (t->entries[i].target == target) {
+			return &t->entries[i];
+		}
+		i = (i + 1) & t->mask;
+	}
+	t->entries[i].used = true;
+	t->entries[i].target = target;
+	t->count++;
+	return &t->entries[i];
+}
+
+// Same steps as the stats update of a session
+static bool add_record(const wsping_analysis_t* a, target_sums_t* s, const wsping_record_t* r)
+{
+	if (s->sent == 0) {
+		s->first_ns = r->time_ns;
+	}
+	s->last_ns = r->time_ns;
+	s->sent++;
+	s->status = r->status;
+	if (r->status != wsping_reply_timed_out && r->status != wsping_reply_failed) {
+		s->received++;
+	}
+	if (r->status != wsping_reply_ok) {
+		return true;
+	}
+
+	s->successful++;
+	s->ttl = r->ttl;
+	s->data_size = r->size;
+	if (s->successful == 1 || r->rtt_ns < s->rtt_min_ns) {
+		s->rtt_min_ns = r->rtt_ns;
+	}
+	if (r->rtt_ns > s->rtt_max_ns) {
+		s->rtt_max_ns = r->rtt_ns;
+	}
+	s->rtt_total_ns += r->rtt_ns;
+	s->rtt_total_ms += r->rtt_ns / 1000000;
+
+	double rtt = (double)r->rtt_ns;
+	double delta = rtt - s->rtt_mean_ns;
+	s->rtt_mean_ns += delta / (double)s->successful;
+	s->rtt_m2 += delta * (rtt - s->rtt_mean_ns);
+	if (s->successful > 1) {
+		double d = fabs(rtt - (double)s->rtt_last_ns);
+		s->jitter_ns += (d - s->jitter_ns) / 16.0;
+		s->jitter_steps++;
+	} else {
+		s->rtt_first_ns = r->rtt_ns;
+	}
+	s->rtt_last_ns = r->rtt_ns;
+
+	if (a->options.histograms) {
+		if (!s->histogram) {
+			s->histogram = (wsping_histogram_t*)calloc(1, sizeof(wsping_histogram_t));
+			if (!s->histogram) {
+				return false;
+			}
+		}
+		wsping_histogram_record(s->histogram, r->rtt_ns);
+	}
+	return true;
+}
+
+// Fold the sums of later records into dst, src gives up its histogram
+static void merge_sums(target_sums_t* dst, target_sums_t* src)
+{
+	if (dst->sent == 0) {
+		*dst = *src;
+		src->histogram = NULL;
+		return;
+	}
+
+	dst->last_ns = src->last_ns;
+	dst->sent += src->sent;
+	dst->received += src->received;
+	dst->status = src->status;
+
+	if (src->successful != 0) {
+		if (dst->successful == 0) {
+			dst->rtt_min_ns = src->rtt_min_ns;
+			dst->rtt_mean_ns = src->rtt_mean_ns;
+			dst->rtt_m2 = src->rtt_m2;
+			dst->jitter_ns = src->jitter_ns;
+			dst->jitter_steps = src->jitter_steps;
+			dst->rtt_first_ns = src->rtt_first_ns;
+		} else {
+			double n_a = (double)dst->successful;
+			double n_b = (double)src->successful;
+			double delta = src->rtt_mean_ns - dst->rtt_mean_ns;
+			dst->rtt_mean_ns += delta * n_b / (n_a + n_b);
+			dst->rtt_m2 += src->rtt_m2 + delta * delta * n_a * n_b / (n_a + n_b);
+
+			// One step across the boundary, then the steps of src
+			double d = fabs((double)src->rtt_first_ns - (double)dst->rtt_last_ns);
+			double jitter = dst->jitter_ns + (d - dst->jitter_ns) / 16.0;
+			dst->jitter_ns = jitter * pow(15.0 / 16.0, (double)src->jitter_steps) + src->jitter_ns;
+			dst->jitter_steps += 1 + src->jitter_steps;
+			if (src->rtt_min_ns < dst->rtt_min_ns) {
+				dst->rtt_min_ns = src->rtt_min_ns;
+			}
+		}
+		if (src->rtt_max_ns > dst->rtt_max_ns) {
+			dst->rtt_max_ns = src->rtt_max_ns;
+		}
+		dst->successful += src->successful;
+		dst->rtt_total_ns += src->rtt_total_ns;
+		dst->rtt_total_ms += src->rtt_total_ms;
+		dst->rtt_last_ns = src->rtt_last_ns;
+		dst->ttl = src->ttl;
+		dst->data_size = src->data_size;
+	}
+
+	if (src->histogram) {
+		if (dst->histogram) {
+			wsping_histogram_merge(dst->histogram, src->histogram);
+			free(src->histogram);
+		} else {
+			dst->histogram = src->histogram;
+		}
+		src->histogram = NULL;
+	}
+}
+
+static bool merge_table(sums_table_t* dst, sums_table_t* src)
+{
+	for (uint32_t i = 0; src->entries && i <= src->mask; i++) {
+		target_sums_t* s = &src->entries[i];
+		if (!s->used) {
+			continue;
+		}
+		target_sums_t* d = find_sums(dst, s->target);
+		if (!d) {
+			return false;
+		}
+		merge_sums(d, s);
+	}
+	return true;
+}
+
+/*--------------*
+ | Block Reader |
+ *--------------*/
+
+// Decode the records of every block of a job. A block whose header
+// does not add up (zero filled past the end of an unclosed log, or
+// damaged) is skipped, a damaged record ends its block
+static void scan_main(void* arg)
+{
+	scan_job_t* job = (scan_job_t*)arg;
+	const wsping_analysis_t* a = job->analysis;
+	uint64_t start_ns = a->options.start_ns;
+	uint64_t end_ns = a->options.end_ns != 0 ? a->options.end_ns : UINT64_MAX;
+
+	for (uint64_t b = job->first_block; b < job->end_block && !job->failed; b++) {
+		uint64_t offset = b * WSP_LOG_BLOCK_SIZE;
+		uint64_t avail = job->size - offset < WSP_LOG_BLOCK_SIZE ? job->size - offset : WSP_LOG_BLOCK_SIZE;
+		const uint8_t* block = job->data + offset;
+		if (avail < WSP_LOG_BLOCK_HEADER) {
+			continue;
+		}
+		uint32_t used = load_u32(block + 8);
+		if (used < WSP_LOG_BLOCK_HEADER || used > avail) {
+			continue;
+		}
+
+		uint64_t time = load_u64(block);
+		const uint8_t* p = block + WSP_LOG_BLOCK_HEADER;
+		const uint8_t* end = block + used;
+		while (p + 2 <= end && (*p & WSP_LOG_TAG)) {
+			wsping_record_t r;
+			uint64_t delta;
+			if (!(p = decode_record(p, end, &r, &delta))) {
+				break;
+			}
+			time += (delta >> 1) ^ (0 - (delta & 1));
+			if (time < start_ns || time >= end_ns) {
+				continue;
+			}
+
+			r.time_ns = time;
+			target_sums_t* s = find_sums(&job->table, r.target);
+			if (!s || !add_record(a, s, &r)) {
+				job->failed = true;
+				break;
+			}
+			job->records++;
+		}
+	}
+}
+
+/*-------------*
+ | Log Mapping |
+ *-------------*/
+
+typedef struct _log_map
+{
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	const uint8_t* data;
+	uint64_t size;
+}
+log_map_t;
+
+#ifdef _WIN32
+static bool map_log(log_map_t* m, const char* path, char* err)
+{
+	WCHAR wpath[MAX_PATH];
+	LARGE_INTEGER size;
+	m->mapping = NULL;
+	m->data = NULL;
+	m->file = INVALID_HANDLE_VALUE;
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH) != 0) {
+		m->file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	}
+	if (m->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m->file, &size)) {
+		wsping_sprintf(err, "Could not open probe log %s (Code %lu)", path, GetLastError());
+		return false;
+	}
+	m->size = (uint64_t)size.QuadPart;
+	if (m->size < WSP_LOG_HEADER_SIZE) {
+		wsping_sprintf(err, "%s is not a probe log", path);
+		return false;
+	}
+	m->mapping = CreateFileMappingW(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	m->data = m->mapping ? (const uint8_t*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!m->data) {
+		wsping_sprintf(err, "Could not map probe log %s (Code %lu)", path, GetLastError());
+		return false;
+	}
+	return true;
+}
+
+static void unmap_log(log_map_t* m)
+{
+	if (m->data) {
+		UnmapViewOfFile(m->data);
+	}
+	if (m->mapping) {
+		CloseHandle(m->mapping);
+	}
+	if (m->file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m->file);
+	}
+}
+#else
+static bool map_log(log_map_t* m, const char* path, char* err)
+{
+	struct stat st;
+	m->data = NULL;
+	m->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (m->fd < 0 || fstat(m->fd, &st) != 0) {
+		wsping_sprintf(err, "Could not open probe log %s: %s", path, strerror(errno));
+		return false;
+	}
+	m->size = (uint64_t)st.st_size;
+	if (m->size < WSP_LOG_HEADER_SIZE) {
+		wsping_sprintf(err, "%s is not a probe log", path);
+		return false;
+	}
+	void* data = mmap(NULL, (size_t)m->size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+	if (data == MAP_FAILED) {
+		wsping_sprintf(err, "Could not map probe log %s: %s", path, strerror(errno));
+		return false;
+	}
+	// Every thread reads its range front to back
+	madvise(data, (size_t)m->size, MADV_SEQUENTIAL);
+	m->data = (const uint8_t*)data;
+	return true;
+}
+
+static void unmap_log(log_map_t* m)
+{
+	if (m->data) {
+		munmap((void*)m->data, (size_t)m->size);
+	}
+	if (m->fd >= 0) {
+		close(m->fd);
+	}
+}
+#endif
+
+/*---------------*
+ | Analysis Core |
+ *---------------*/
+
+wsping_analysis_t* wsping_analysis_create(const wsping_analysis_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	wsping_analysis_t* a = (wsping_analysis_t*)calloc(1, sizeof(wsping_analysis_t));
+	if (!a) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	a->err_cb = err_func;
+	a->userdata = udata;
+	if (opt) {
+		a->options = *opt;
+	}
+	a->options.threads = wsping_defval(a->options.threads, wsp_cpu_count());
+	return a;
+}
+
+void wsping_analysis_destroy(wsping_analysis_t* a)
+{
+	if (!a) {
+		return;
+	}
+	free_table(&a->table);
+	free(a->results);
+	free(a);
+}
+
+static int compare_results(const void* x, const void* y)
+{
+	uint32_t a = ((const wsping_analysis_result_t*)x)->target;
+	uint32_t b = ((const wsping_analysis_result_t*)y)->target;
+	return a < b ? -1 : a > b;
+}
+
+// Turn the sums into the stats a session would have, sorted by target
+static bool build_results(wsping_analysis_t* a)
+{
+	free(a->results);
+	a->num_results = 0;
+	a->results = (wsping_analysis_result_t*)calloc(a->table.count ? a->table.count : 1, sizeof(wsping_analysis_result_t));
+	if (!a->results) {
+		return false;
+	}
+
+	for (uint32_t i = 0; a->table.entries && i <= a->table.mask; i++) {
+		const target_sums_t* s = &a->table.entries[i];
+		if (!s->used) {
+			continue;
+		}
+		wsping_analysis_result_t* r = &a->results[a->num_results++];
+		wsping_stats_t* st = &r->stats;
+		double n = (double)s->successful;
+		r->target = s->target;
+		r->first_ns = s->first_ns;
+		r->last_ns = s->last_ns;
+		r->histogram = s->histogram;
+		st->echos_sent = s->sent;
+		st->echos_received = s->received;
+		st->echos_successful = s->successful;
+		st->status = s->status;
+		if (s->successful == 0) {
+			continue;
+		}
+		st->rtt_min = (uint32_t)(s->rtt_min_ns / 1000000);
+		st->rtt_max = (uint32_t)(s->rtt_max_ns / 1000000);
+		st->rtt_total = s->rtt_total_ms;
+		st->reply_time = s->rtt_last_ns < 1000000 ? 1 : (uint32_t)(s->rtt_last_ns / 1000000);
+		st->data_size = (int)s->data_size;
+		st->ttl = s->ttl;
+		st->reply_time_ns = s->rtt_last_ns;
+		st->rtt_min_ns = s->rtt_min_ns;
+		st->rtt_max_ns = s->rtt_max_ns;
+		st->rtt_total_ns = s->rtt_total_ns;
+		st->rtt_mean_ns = s->rtt_mean_ns;
+		st->rtt_mdev_ns = sqrt(s->rtt_m2 / n);
+		st->rtt_stddev_ns = n > 1 ? sqrt(s->rtt_m2 / (n - 1)) : 0.0;
+		st->jitter_ns = s->jitter_ns;
+	}
+	qsort(a->results, a->num_results, sizeof(wsping_analysis_result_t), compare_results);
+	return true;
+}
+
+bool wsping_analysis_add_log(wsping_analysis_t* a, const char* path)
+{
+	assert(a);
+	assert(path);
+
+	char err[WSPING_BUF_SIZE] = {0};
+	log_map_t m;
+	if (!map_log(&m, path, err)) {
+		a->err_cb(a->userdata, err);
+		unmap_log(&m);
+		return false;
+	}
+	if (memcmp(m.data, WSP_LOG_MAGIC, 8) != 0 || load_u32(m.data + 8) != WSP_LOG_VERSION ||
+		load_u32(m.data + 12) != WSP_LOG_BLOCK_SIZE) {
+		wsping_sprintf(err, "%s is not a probe log", path);
+		a->err_cb(a->userdata, err);
+		unmap_log(&m);
+		return false;
+	}
+
+	// Block 0 is the file header
+	uint64_t blocks = (m.size + WSP_LOG_BLOCK_SIZE - 1) / WSP_LOG_BLOCK_SIZE - 1;
+	uint32_t threads = a->options.threads;
+	if (threads > blocks) {
+		threads = blocks ? (uint32_t)blocks : 1;
+	}
+	scan_job_t* jobs = (scan_job_t*)calloc(threads, sizeof(scan_job_t));
+	if (!jobs) {
+		a->err_cb(a->userdata, "Not enough resources available");
+		unmap_log(&m);
+		return false;
+	}
+
+	// The calling thread takes the first range
+	uint32_t started = 0;
+	for (uint32_t i = 0; i < threads; i++) {
+		jobs[i].analysis = a;
+		jobs[i].data = m.data;
+		jobs[i].size = m.size;
+		jobs[i].first_block = 1 + blocks * i / threads;
+		jobs[i].end_block = 1 + blocks * (i + 1) / threads;
+	}
+	for (uint32_t i = 1; i < threads; i++, started++) {
+		if (!wsp_thread_start(&jobs[i].thread, scan_main, &jobs[i])) {
+			break;
+		}
+	}
+	for (uint32_t i = started + 1; i < threads; i++) {
+		scan_main(&jobs[i]);
+	}
+	scan_main(&jobs[0]);
+	for (uint32_t i = 1; i <= started; i++) {
+		wsp_thread_join(&jobs[i].thread);
+	}
+
+	bool ok = true;
+	for (uint32_t i = 0; i < threads; i++) {
+		ok = ok && !jobs[i].failed && merge_table(&a->table, &jobs[i].table);
+		a->records += jobs[i].records;
+		free_table(&jobs[i].table);
+	}
+	free(jobs);
+	unmap_log(&m);
+
+	if (!ok || !build_results(a)) {
+		a->err_cb(a->userdata, "Not enough resources available");
+		return false;
+	}
+	return true;
+}
+
+int wsping_analysis_get_target_count(const wsping_analysis_t* a)
+{
+	return a->num_results;
+}
+
+const wsping_analysis_result_t* wsping_analysis_get_result(const wsping_analysis_t* a, int index)
+{
+	if (index < 0 || index >= a->num_results) {
+		return NULL;
+	}
+	return &a->results[index];
+}
+
+uint64_t wsping_analysis_get_records(const wsping_analysis_t* a)
+{
+	return a->records;
+}
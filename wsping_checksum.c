@@ -0,0 +1,207 @@
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHECKSUM_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define CHECKSUM_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CHECKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+// Internet checksum (RFC 1071). The one's complement sum does not care
+// about byte order, so words are summed as they are in memory and the
+// result is stored back the same way. The vector kernels widen 16-bit
+// words into 32-bit lanes, which are folded into a 64-bit sum before
+// they can overflow.
+
+enum
+{
+	// Vector iterations before the 32-bit lanes are folded, each
+	// lane gains at most 2 * 0xffff per iteration
+	FOLD_INTERVAL = 16384
+};
+
+// Fold a wide one's complement sum to 16 bits
+static uint16_t fold_sum(uint64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)sum;
+}
+
+// Four bytes at a time into a 64-bit sum, then the last word and byte
+static uint64_t sum_scalar(const uint8_t* p, size_t size, uint64_t sum)
+{
+	for (; size >= 4; p += 4, size -= 4) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		sum += word;
+	}
+	if (size >= 2) {
+		uint16_t word;
+		memcpy(&word, p, 2);
+		sum += word;
+		p += 2;
+		size -= 2;
+	}
+	if (size == 1) {
+		// Padded with a zero byte, in memory order
+		uint8_t last[2] = { p[0], 0 };
+		uint16_t word;
+		memcpy(&word, last, 2);
+		sum += word;
+	}
+	return sum;
+}
+
+#ifdef CHECKSUM_SSE2
+static uint64_t sum_sse2(const uint8_t* p, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t sum = 0;
+
+	while (size >= 32) {
+		__m128i acc0 = zero, acc1 = zero;
+		size_t blocks = size / 32 < FOLD_INTERVAL ? size / 32 : FOLD_INTERVAL;
+		for (size_t i = 0; i < blocks; i++, p += 32) {
+			__m128i a = _mm_loadu_si128((const __m128i*)p);
+			__m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+			acc0 = _mm_add_epi32(acc0, _mm_add_epi32(_mm_unpacklo_epi16(a, zero), _mm_unpackhi_epi16(a, zero)));
+			acc1 = _mm_add_epi32(acc1, _mm_add_epi32(_mm_unpacklo_epi16(b, zero), _mm_unpackhi_epi16(b, zero)));
+		}
+		size -= blocks * 32;
+
+		// Widen the 32-bit lanes and add them up
+		__m128i acc = _mm_add_epi64(_mm_unpacklo_epi32(acc0, zero), _mm_unpackhi_epi32(acc0, zero));
+		acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(acc1, zero), _mm_unpackhi_epi32(acc1, zero)));
+		uint64_t lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		sum += lanes[0] + lanes[1];
+	}
+	return sum_scalar(p, size, sum);
+}
+#endif
+
+#ifdef CHECKSUM_AVX2
+#ifdef __GNUC__
+__attribute__((target("avx2")))
+#endif
+static uint64_t sum_avx2(const uint8_t* p, size_t size)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	uint64_t sum = 0;
+
+	while (size >= 64) {
+		__m256i acc0 = zero, acc1 = zero;
+		size_t blocks = size / 64 < FOLD_INTERVAL ? size / 64 : FOLD_INTERVAL;
+		for (size_t i = 0; i < blocks; i++, p += 64) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)p);
+			__m256i b = _mm256_loadu_si256((const __m256i*)(p + 32));
+			acc0 = _mm256_add_epi32(acc0, _mm256_add_epi32(_mm256_unpacklo_epi16(a, zero), _mm256_unpackhi_epi16(a, zero)));
+			acc1 = _mm256_add_epi32(acc1, _mm256_add_epi32(_mm256_unpacklo_epi16(b, zero), _mm256_unpackhi_epi16(b, zero)));
+		}
+		size -= blocks * 64;
+
+		__m256i acc = _mm256_add_epi64(_mm256_unpacklo_epi32(acc0, zero), _mm256_unpackhi_epi32(acc0, zero));
+		acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_unpacklo_epi32(acc1, zero), _mm256_unpackhi_epi32(acc1, zero)));
+		uint64_t lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	return sum_scalar(p, size, sum);
+}
+#endif
+
+#ifdef CHECKSUM_NEON
+static uint64_t sum_neon(const uint8_t* p, size_t size)
+{
+	uint64_t sum = 0;
+
+	while (size >= 32) {
+		uint32x4_t acc0 = vdupq_n_u32(0), acc1 = vdupq_n_u32(0);
+		size_t blocks = size / 32 < FOLD_INTERVAL ? size / 32 : FOLD_INTERVAL;
+		for (size_t i = 0; i < blocks; i++, p += 32) {
+			// Pairwise add and accumulate widens the words for free
+			acc0 = vpadalq_u16(acc0, vreinterpretq_u16_u8(vld1q_u8(p)));
+			acc1 = vpadalq_u16(acc1, vreinterpretq_u16_u8(vld1q_u8(p + 16)));
+		}
+		size -= blocks * 32;
+		sum += vaddlvq_u32(acc0) + vaddlvq_u32(acc1);
+	}
+	return sum_scalar(p, size, sum);
+}
+#endif
+
+uint16_t wsping_checksum(const void* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t sum;
+	assert(p || size == 0);
+
+#ifdef CHECKSUM_AVX2
+	if (size >= 256 && wsp_cpu_has_avx2()) {
+		return (uint16_t)~fold_sum(sum_avx2(p, size));
+	}
+#endif
+#if defined(CHECKSUM_SSE2)
+	sum = sum_sse2(p, size);
+#elif defined(CHECKSUM_NEON)
+	sum = sum_neon(p, size);
+#else
+	sum = sum_scalar(p, size, 0);
+#endif
+	return (uint16_t)~fold_sum(sum);
+}
+
+// RFC 1624 equation 3, HC' = ~(~HC + ~m + m')
+uint16_t wsping_checksum_adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word)
+{
+	uint32_t sum = (uint16_t)~checksum;
+	sum += (uint16_t)~old_word;
+	sum += new_word;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+/*------------------------*
+ | Echo Request Templates |
+ *------------------------*/
+
+void wsp_echo_init(uint8_t* packet, uint8_t type, uint16_t ident, size_t size)
+{
+	uint16_t checksum = 0;
+	packet[0] = type;
+	packet[1] = 0;
+	memcpy(packet + 2, &checksum, 2);
+	packet[4] = (uint8_t)(ident >> 8);
+	packet[5] = (uint8_t)(ident & 0xff);
+	packet[6] = 0;
+	packet[7] = 0;
+	checksum = wsping_checksum(packet, size);
+	memcpy(packet + 2, &checksum, 2);
+}
+
+void wsp_echo_set_sequence(uint8_t* packet, uint16_t seq)
+{
+	uint8_t bytes[2] = { (uint8_t)(seq >> 8), (uint8_t)(seq & 0xff) };
+	uint16_t old_word, new_word, checksum;
+	memcpy(&old_word, packet + 6, 2);
+	memcpy(&new_word, bytes, 2);
+	memcpy(&checksum, packet + 2, 2);
+	checksum = wsping_checksum_adjust(checksum, old_word, new_word);
+	memcpy(packet + 2, &checksum, 2);
+	memcpy(packet + 6, bytes, 2);
+}
@@ -0,0 +1,952 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#define poll WSAPoll
+#define SEND_FLAGS 0
+#else
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+// Targets live in chunks that never move, so probe threads can update
+// them while targets are added. Every target keeps its counters under a
+// seqlock, and the text of each metric family rendered from them by
+// the last scrape. The exposition is kept as one slice per family and
+// chunk of targets. A scrape renders the targets whose sequence moved
+// and writes their text over the old one in place, a slice is only
+// packed again when a text changed its length or a response is still
+// sending the slice. Responses hold on to the slices they send, so the
+// listener serves several scrapers at once without the render lock
+// and the probe threads never wait for any of it.
+
+enum
+{
+	DEFAULT_EXPORTER_PORT = 9464,
+	TARGET_CHUNK_SIZE = 1024,
+	MAX_TARGET_CHUNKS = 1024,
+	EXPORT_STATUSES = wsping_reply_packet_too_big + 1,
+	EXPORT_BUCKETS = 13,            // Bounds below and +Inf
+	REQUEST_SIZE = 4096,
+	LISTEN_POLL_MS = 100,
+	CLIENT_TIMEOUT_MS = 2000,   // Without progress
+	MAX_CLIENTS = 16,
+	SEND_CHUNK_SIZE = 1048576
+};
+
+// Metric families, in the order they are exposed
+typedef enum _export_family
+{
+	family_probes,
+	family_results,
+	family_loss,
+	family_rtt,
+	family_jitter,
+	family_count
+}
+export_family_t;
+
+static const char* const family_headers[family_count] = {
+	"# TYPE wsping_probes counter\n"
+	"# HELP wsping_probes Completed echo requests.\n",
+	"# TYPE wsping_probe_results counter\n"
+	"# HELP wsping_probe_results Completed echo requests by outcome.\n",
+	"# TYPE wsping_loss_ratio gauge\n"
+	"# UNIT wsping_loss_ratio ratio\n"
+	"# HELP wsping_loss_ratio Share of echo requests without a reply.\n",
+	"# TYPE wsping_rtt_seconds histogram\n"
+	"# UNIT wsping_rtt_seconds seconds\n"
+	"# HELP wsping_rtt_seconds Round trip times of successful echo requests.\n",
+	"# TYPE wsping_jitter_seconds gauge\n"
+	"# UNIT wsping_jitter_seconds seconds\n"
+	"# HELP wsping_jitter_seconds RFC 3550 interarrival jitter.\n",
+};
+
+// Upper bounds of the RTT buckets in ns and as exposed
+static const uint64_t bucket_bounds[EXPORT_BUCKETS - 1] = {
+	500000, 1000000, 2500000, 5000000, 10000000, 25000000,
+	50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000ULL
+};
+
+static const char* const bucket_labels[EXPORT_BUCKETS] = {
+	"0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025",
+	"0.05", "0.1", "0.25", "0.5", "1.0", "2.5", "+Inf"
+};
+
+// Counters of a target, copied as a whole by the scrape
+typedef struct _export_counts
+{
+	uint64_t probes;
+	uint64_t results[EXPORT_STATUSES];
+	uint64_t buckets[EXPORT_BUCKETS];   // Not cumulative
+	uint64_t rtt_sum_ns;
+	uint64_t rtt_last_ns;
+	double jitter_ns;
+}
+export_counts_t;
+
+typedef struct _export_target
+{
+	// Probe side, the lock keeps threads sharing a target in line
+	wsp_mutex_t lock;
+	uint32_t seq;
+	export_counts_t counts;
+
+	// Scrape side
+	char* labels;   // target="...",address="..."
+	uint32_t labels_len;
+	bool rendered;
+	uint32_t rendered_seq;
+	char* text;
+	size_t text_cap;
+	size_t offsets[family_count + 1];
+
+	// Where the text of each family sits in the slice of its chunk
+	size_t slice_offsets[family_count];
+	size_t slice_lengths[family_count];
+}
+export_target_t;
+
+// Text of one family for a chunk of targets. Responses take a
+// reference while they send it, both under render_lock
+typedef struct _export_slice
+{
+	uint32_t refs;
+	size_t size;
+	char text[];
+}
+export_slice_t;
+
+// Part of a response, slice is held by the response until sent
+typedef struct _export_piece
+{
+	const char* data;
+	size_t size;
+	export_slice_t* slice;
+}
+export_piece_t;
+
+// Scraper connected to the listener, the response is NULL
+// while the request is still being read
+typedef struct _export_client
+{
+	socket_t sock;
+	uint64_t deadline;   // wsp_clock_ms() time it is dropped at
+	size_t request_len;
+	char request[REQUEST_SIZE];
+	char header[256];
+	export_piece_t* pieces;
+	uint32_t num_pieces;
+	uint32_t piece;
+	size_t offset;
+}
+export_client_t;
+
+struct _wsping_exporter
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	int wsa_status;
+#endif
+	wsping_exporter_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+	socket_t listener;
+
+	// Targets by id, ids are looked up by their labels
+	wsp_mutex_t targets_lock;
+	export_target_t* chunks[MAX_TARGET_CHUNKS];
+	uint32_t num_targets;
+	int* ids;
+	uint32_t ids_mask;
+
+	// Exposition of the last render, slices hold the targets
+	// counted in slice_targets of their chunk
+	wsp_mutex_t render_lock;
+	export_slice_t* slices[MAX_TARGET_CHUNKS][family_count];
+	uint32_t slice_targets[MAX_TARGET_CHUNKS];
+	export_piece_t* pieces;   // Of wsping_exporter_render()
+	uint32_t pieces_cap;
+
+	// Listener thread and the scrapers it serves
+	wsp_thread_t thread;
+	bool thread_running;
+	uint32_t stopping;
+	export_client_t clients[MAX_CLIENTS];
+	int num_clients;
+};
+
+static export_target_t* target_at(const wsping_exporter_t* e, uint32_t id)
+{
+	return &e->chunks[id / TARGET_CHUNK_SIZE][id % TARGET_CHUNK_SIZE];
+}
+
+/*-----------*
+ | Targets   |
+ *-----------*/
+
+static uint32_t hash_labels(const char* labels, size_t len)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ (uint8_t)labels[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// Append a label value with \, " and newlines escaped
+static char* escape_value(char* dst, const char* value)
+{
+	for (; *value; value++) {
+		if (*value == '\\' || *value == '"') {
+			*dst++ = '\\';
+			*dst++ = *value;
+		} else if (*value == '\n') {
+			*dst++ = '\\';
+			*dst++ = 'n';
+		} else {
+			*dst++ = *value;
+		}
+	}
+	return dst;
+}
+
+static bool grow_ids(wsping_exporter_t* e)
+{
+	uint32_t size = e->ids ? (e->ids_mask + 1) * 2 : TARGET_CHUNK_SIZE;
+	int* ids = (int*)malloc(size * sizeof(int));
+	if (!ids) {
+		return false;
+	}
+	memset(ids, 0xff, size * sizeof(int));
+	for (uint32_t i = 0; i < e->num_targets; i++) {
+		export_target_t* t = target_at(e, i);
+		uint32_t j = hash_labels(t->labels, t->labels_len) & (size - 1);
+		while (ids[j] >= 0) {
+			j = (j + 1) & (size - 1);
+		}
+		ids[j] = (int)i;
+	}
+	free(e->ids);
+	e->ids = ids;
+	e->ids_mask = size - 1;
+	return true;
+}
+
+int wsping_exporter_add_target(wsping_exporter_t* e, const char* target, const char* address)
+{
+	assert(e);
+	assert(target);
+
+	// Escaping at most doubles the values
+	size_t size = 2 * strlen(target) + (address ? 2 * strlen(address) : 0) + 32;
+	char* labels = (char*)malloc(size);
+	if (!labels) {
+		e->err_cb(e->userdata, "Not enough resources available");
+		return -1;
+	}
+	char* p = labels;
+	memcpy(p, "target=\"", 8);
+	p = escape_value(p + 8, target);
+	*p++ = '"';
+	if (address && address[0]) {
+		memcpy(p, ",address=\"", 10);
+		p = escape_value(p + 10, address);
+		*p++ = '"';
+	}
+	*p = 0;
+	uint32_t len = (uint32_t)(p - labels);
+	uint32_t hash = hash_labels(labels, len);
+
+	wsp_mutex_lock(&e->targets_lock);
+	if (!e->ids || (e->num_targets + 1) * 2 > e->ids_mask + 1) {
+		if (!grow_ids(e)) {
+			wsp_mutex_unlock(&e->targets_lock);
+			free(labels);
+			e->err_cb(e->userdata, "Not enough resources available");
+			return -1;
+		}
+	}
+
+	uint32_t i = hash & e->ids_mask;
+	for (; e->ids[i] >= 0; i = (i + 1) & e->ids_mask) {
+		export_target_t* t = target_at(e, (uint32_t)e->ids[i]);
+		if (t->labels_len == len && memcmp(t->labels, labels, len) == 0) {
+			int id = e->ids[i];
+			wsp_mutex_unlock(&e->targets_lock);
+			free(labels);
+			return id;
+		}
+	}
+
+	uint32_t id = e->num_targets;
+	uint32_t chunk = id / TARGET_CHUNK_SIZE;
+	if (chunk >= MAX_TARGET_CHUNKS ||
+		(!e->chunks[chunk] && !(e->chunks[chunk] = (export_target_t*)calloc(TARGET_CHUNK_SIZE, sizeof(export_target_t))))) {
+		wsp_mutex_unlock(&e->targets_lock);
+		free(labels);
+		e->err_cb(e->userdata, "Too many exported targets");
+		return -1;
+	}
+	export_target_t* t = target_at(e, id);
+	wsp_mutex_init(&t->lock);
+	t->labels = labels;
+	t->labels_len = len;
+	e->ids[i] = (int)id;
+
+	// Scrapes only look at the targets published here
+	wsp_atomic_store(&e->num_targets, id + 1);
+	wsp_mutex_unlock(&e->targets_lock);
+	return (int)id;
+}
+
+void wsping_exporter_observe(wsping_exporter_t* e, int id, wsping_reply_status_t status, uint64_t rtt_ns)
+{
+	assert(e);
+	if (id < 0 || (uint32_t)id >= wsp_atomic_load(&e->num_targets) || (unsigned)status >= EXPORT_STATUSES) {
+		return;
+	}
+
+	export_target_t* t = target_at(e, (uint32_t)id);
+	export_counts_t* c = &t->counts;
+	wsp_mutex_lock(&t->lock);
+	wsp_seqlock_begin(&t->seq);
+	c->probes++;
+	c->results[status]++;
+	if (status == wsping_reply_ok) {
+		int b = 0;
+		while (b < EXPORT_BUCKETS - 1 && rtt_ns > bucket_bounds[b]) {
+			b++;
+		}
+		c->buckets[b]++;
+		if (c->results[wsping_reply_ok] > 1) {
+			double d = (double)rtt_ns - (double)c->rtt_last_ns;
+			c->jitter_ns += ((d < 0 ? -d : d) - c->jitter_ns) / 16.0;
+		}
+		c->rtt_sum_ns += rtt_ns;
+		c->rtt_last_ns = rtt_ns;
+	}
+	wsp_seqlock_end(&t->seq);
+	wsp_mutex_unlock(&t->lock);
+}
+
+/*-----------*
+ | Rendering |
+ *-----------*/
+
+static char* put_u64(char* dst, uint64_t value)
+{
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+	while (n) {
+		*dst++ = digits[--n];
+	}
+	return dst;
+}
+
+// Fixed point value with 9 decimals, like ns as seconds
+static char* put_fixed9(char* dst, uint64_t value)
+{
+	dst = put_u64(dst, value / 1000000000);
+	*dst++ = '.';
+	uint64_t frac = value % 1000000000;
+	for (uint64_t div = 100000000; div; div /= 10) {
+		*dst++ = (char)('0' + frac / div % 10);
+	}
+	return dst;
+}
+
+static char* put_str(char* dst, const char* src, size_t len)
+{
+	memcpy(dst, src, len);
+	return dst + len;
+}
+
+#define put_lit(dst, lit) put_str(dst, lit, sizeof(lit) - 1)
+
+// name{labels} followed by a space
+static char* put_sample(char* dst, const char* name, size_t name_len, const export_target_t* t)
+{
+	dst = put_str(dst, name, name_len);
+	*dst++ = '{';
+	dst = put_str(dst, t->labels, t->labels_len);
+	return dst;
+}
+
+// Text of every family of one target, from a snapshot of its counters.
+// changed tells whether it was rendered again
+static bool render_target(export_target_t* t, bool* changed)
+{
+	export_counts_t c;
+	uint32_t seq = wsp_atomic_load(&t->seq);
+	*changed = !t->rendered || seq != t->rendered_seq;
+	if (!*changed) {
+		return true;
+	}
+	wsp_seqlock_read(&t->seq, &c, &t->counts, sizeof(c));
+
+	// The longest line is a bucket or a result, about 60 bytes
+	// besides the labels
+	size_t line = t->labels_len + 80;
+	size_t need = line * (EXPORT_STATUSES + EXPORT_BUCKETS + 5);
+	if (need > t->text_cap) {
+		char* text = (char*)realloc(t->text, need);
+		if (!text) {
+			return false;
+		}
+		t->text = text;
+		t->text_cap = need;
+	}
+
+	char* p = t->text;
+	t->offsets[family_probes] = 0;
+	p = put_sample(p, "wsping_probes_total", 19, t);
+	p = put_lit(p, "} ");
+	p = put_u64(p, c.probes);
+	*p++ = '\n';
+
+	t->offsets[family_results] = (size_t)(p - t->text);
+	for (int s = 0; s < EXPORT_STATUSES; s++) {
+		if (c.results[s] == 0) {
+			continue;
+		}
+		p = put_sample(p, "wsping_probe_results_total", 26, t);
+		p = put_lit(p, ",status=\"");
+		const char* name = wsp_status_name((wsping_reply_status_t)s);
+		p = put_str(p, name, strlen(name));
+		p = put_lit(p, "\"} ");
+		p = put_u64(p, c.results[s]);
+		*p++ = '\n';
+	}
+
+	t->offsets[family_loss] = (size_t)(p - t->text);
+	uint64_t ok = c.results[wsping_reply_ok];
+	p = put_sample(p, "wsping_loss_ratio", 17, t);
+	p = put_lit(p, "} ");
+	p = put_fixed9(p, c.probes ? (uint64_t)((double)(c.probes - ok) * 1e9 / (double)c.probes) : 0);
+	*p++ = '\n';
+
+	t->offsets[family_rtt] = (size_t)(p - t->text);
+	uint64_t cumulative = 0;
+	for (int b = 0; b < EXPORT_BUCKETS; b++) {
+		cumulative += c.buckets[b];
+		p = put_sample(p, "wsping_rtt_seconds_bucket", 25, t);
+		p = put_lit(p, ",le=\"");
+		p = put_str(p, bucket_labels[b], strlen(bucket_labels[b]));
+		p = put_lit(p, "\"} ");
+		p = put_u64(p, cumulative);
+		*p++ = '\n';
+	}
+	p = put_sample(p, "wsping_rtt_seconds_count", 24, t);
+	p = put_lit(p, "} ");
+	p = put_u64(p, cumulative);
+	*p++ = '\n';
+	p = put_sample(p, "wsping_rtt_seconds_sum", 22, t);
+	p = put_lit(p, "} ");
+	p = put_fixed9(p, c.rtt_sum_ns);
+	*p++ = '\n';
+
+	t->offsets[family_jitter] = (size_t)(p - t->text);
+	p = put_sample(p, "wsping_jitter_seconds", 21, t);
+	p = put_lit(p, "} ");
+	p = put_fixed9(p, (uint64_t)c.jitter_ns);
+	*p++ = '\n';
+
+	t->offsets[family_count] = (size_t)(p - t->text);
+	t->rendered = true;
+	t->rendered_seq = seq;
+	return true;
+}
+
+static void release_slice(export_slice_t* s)
+{
+	if (s && --s->refs == 0) {
+		free(s);
+	}
+}
+
+// Pack the text of one family of a chunk into a new slice
+static bool pack_slice(wsping_exporter_t* e, uint32_t chunk, uint32_t first, uint32_t last, int f)
+{
+	size_t size = 0;
+	for (uint32_t i = first; i < last; i++) {
+		const export_target_t* t = target_at(e, i);
+		size += t->offsets[f + 1] - t->offsets[f];
+	}
+	export_slice_t* s = (export_slice_t*)malloc(sizeof(export_slice_t) + size);
+	if (!s) {
+		return false;
+	}
+
+	char* p = s->text;
+	for (uint32_t i = first; i < last; i++) {
+		export_target_t* t = target_at(e, i);
+		t->slice_offsets[f] = (size_t)(p - s->text);
+		t->slice_lengths[f] = t->offsets[f + 1] - t->offsets[f];
+		p = put_str(p, t->text + t->offsets[f], t->slice_lengths[f]);
+	}
+	s->refs = 1;
+	s->size = size;
+	release_slice(e->slices[chunk][f]);
+	e->slices[chunk][f] = s;
+	return true;
+}
+
+// Bring the slices of one chunk up to date. A text that kept its
+// length goes over the old one, unless a response still sends it
+static bool render_chunk(wsping_exporter_t* e, uint32_t chunk, uint32_t count)
+{
+	uint32_t first = chunk * TARGET_CHUNK_SIZE;
+	uint32_t last = count - first < TARGET_CHUNK_SIZE ? count : first + TARGET_CHUNK_SIZE;
+	bool pack[family_count];
+	bool ok = true;
+
+	for (int f = 0; f < family_count; f++) {
+		pack[f] = !e->slices[chunk][f] || e->slice_targets[chunk] != last - first;
+	}
+	for (uint32_t i = first; i < last; i++) {
+		export_target_t* t = target_at(e, i);
+		bool changed;
+		if (!render_target(t, &changed)) {
+			ok = false;
+			break;
+		}
+		for (int f = 0; changed && f < family_count; f++) {
+			export_slice_t* s = e->slices[chunk][f];
+			size_t len = t->offsets[f + 1] - t->offsets[f];
+			if (pack[f] || len != t->slice_lengths[f] || s->refs > 1) {
+				pack[f] = true;
+				continue;
+			}
+			memcpy(s->text + t->slice_offsets[f], t->text + t->offsets[f], len);
+		}
+	}
+	for (int f = 0; ok && f < family_count; f++) {
+		ok = !pack[f] || pack_slice(e, chunk, first, last, f);
+	}
+
+	// Packed again as a whole on the next render
+	e->slice_targets[chunk] = ok ? last - first : 0;
+	return ok;
+}
+
+// Must hold render_lock, chunks is set to the chunks holding targets
+static bool render(wsping_exporter_t* e, uint32_t* chunks)
+{
+	uint32_t count = wsp_atomic_load(&e->num_targets);
+	*chunks = (count + TARGET_CHUNK_SIZE - 1) / TARGET_CHUNK_SIZE;
+	for (uint32_t c = 0; c < *chunks; c++) {
+		if (!render_chunk(e, c, count)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Room for the pieces listed for the chunks
+static uint32_t max_pieces(uint32_t chunks)
+{
+	return family_count * (chunks + 1) + 1;
+}
+
+// The exposition in order, must hold render_lock. Returns the
+// number of pieces
+static uint32_t list_pieces(wsping_exporter_t* e, uint32_t chunks, export_piece_t* pieces)
+{
+	static const char eof[] = "# EOF\n";
+	uint32_t n = 0;
+	for (int f = 0; f < family_count; f++) {
+		pieces[n].data = family_headers[f];
+		pieces[n].size = strlen(family_headers[f]);
+		pieces[n++].slice = NULL;
+		for (uint32_t c = 0; c < chunks; c++) {
+			export_slice_t* s = e->slices[c][f];
+			if (s->size != 0) {
+				pieces[n].data = s->text;
+				pieces[n].size = s->size;
+				pieces[n++].slice = s;
+			}
+		}
+	}
+	pieces[n].data = eof;
+	pieces[n].size = sizeof(eof) - 1;
+	pieces[n++].slice = NULL;
+	return n;
+}
+
+size_t wsping_exporter_render(wsping_exporter_t* e, wsping_writefunc_t func, void* udata)
+{
+	uint32_t chunks;
+	size_t size = 0;
+	assert(e);
+	assert(func);
+
+	wsp_mutex_lock(&e->render_lock);
+	bool ok = render(e, &chunks);
+	if (ok && max_pieces(chunks) > e->pieces_cap) {
+		export_piece_t* pieces = (export_piece_t*)realloc(e->pieces, max_pieces(chunks) * sizeof(export_piece_t));
+		if (pieces) {
+			e->pieces = pieces;
+			e->pieces_cap = max_pieces(chunks);
+		}
+		ok = pieces != NULL;
+	}
+	if (ok) {
+		uint32_t n = list_pieces(e, chunks, e->pieces);
+		for (uint32_t i = 0; i < n; i++) {
+			func(udata, e->pieces[i].data, e->pieces[i].size);
+			size += e->pieces[i].size;
+		}
+	}
+	wsp_mutex_unlock(&e->render_lock);
+	if (!ok) {
+		e->err_cb(e->userdata, "Not enough resources available");
+	}
+	return size;
+}
+
+/*---------------*
+ | HTTP Listener |
+ *---------------*/
+
+static const char not_found[] =
+	"HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot Found\n";
+
+static bool set_nonblocking(socket_t sock)
+{
+#ifdef _WIN32
+	u_long on = 1;
+	return ioctlsocket(sock, FIONBIO, &on) == 0;
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static bool would_block()
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Answer a complete request. The render lock is only held to render
+// and take the slices, they are sent after it is released
+static bool respond(wsping_exporter_t* e, export_client_t* c)
+{
+	bool head = strncmp(c->request, "HEAD ", 5) == 0;
+	const char* path = head ? c->request + 5 : strncmp(c->request, "GET ", 4) == 0 ? c->request + 4 : NULL;
+	if (!path || (strncmp(path, "/metrics ", 9) != 0 && strncmp(path, "/metrics?", 9) != 0)) {
+		c->pieces = (export_piece_t*)malloc(sizeof(export_piece_t));
+		if (!c->pieces) {
+			return false;
+		}
+		c->pieces[0].data = not_found;
+		c->pieces[0].size = sizeof(not_found) - 1;
+		c->pieces[0].slice = NULL;
+		c->num_pieces = 1;
+		return true;
+	}
+
+	uint32_t chunks = 0;
+	size_t size = 0;
+	wsp_mutex_lock(&e->render_lock);
+	bool ok = render(e, &chunks);
+	c->pieces = (export_piece_t*)malloc((1 + max_pieces(ok ? chunks : 0)) * sizeof(export_piece_t));
+	if (c->pieces) {
+		c->num_pieces = 1;
+		if (ok) {
+			uint32_t n = list_pieces(e, chunks, c->pieces + 1);
+			for (uint32_t i = 1; i <= n; i++) {
+				size += c->pieces[i].size;
+			}
+			if (!head) {
+				for (uint32_t i = 1; i <= n; i++) {
+					if (c->pieces[i].slice) {
+						c->pieces[i].slice->refs++;
+					}
+				}
+				c->num_pieces += n;
+			}
+		}
+	}
+	wsp_mutex_unlock(&e->render_lock);
+	if (!c->pieces) {
+		return false;
+	}
+
+	int len = snprintf(c->header, sizeof(c->header),
+		"HTTP/1.1 %s\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+		"Content-Length: %llu\r\nConnection: close\r\n\r\n",
+		ok ? "200 OK" : "500 Internal Server Error", (unsigned long long)size);
+	c->pieces[0].data = c->header;
+	c->pieces[0].size = (size_t)len;
+	c->pieces[0].slice = NULL;
+	return true;
+}
+
+// Read the request or send more of the response, one request per
+// connection is all a scraper needs. Returns false once the client
+// is done or failed
+static bool serve_client(wsping_exporter_t* e, export_client_t* c, uint64_t now)
+{
+	if (!c->pieces) {
+		int got = (int)recv(c->sock, c->request + c->request_len, (int)(sizeof(c->request) - 1 - c->request_len), 0);
+		if (got <= 0) {
+			return got < 0 && would_block();
+		}
+		c->request_len += (size_t)got;
+		c->request[c->request_len] = 0;
+		c->deadline = now + CLIENT_TIMEOUT_MS;
+		bool complete = strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n") ||
+			c->request_len == sizeof(c->request) - 1;
+		if (!complete) {
+			return true;
+		}
+		if (!respond(e, c)) {
+			return false;
+		}
+	}
+
+	while (c->piece < c->num_pieces) {
+		const export_piece_t* p = &c->pieces[c->piece];
+		size_t left = p->size - c->offset;
+		int sent = (int)send(c->sock, p->data + c->offset, (int)(left > SEND_CHUNK_SIZE ? SEND_CHUNK_SIZE : left), SEND_FLAGS);
+		if (sent < 0) {
+			return would_block();
+		}
+		c->offset += (size_t)sent;
+		c->deadline = now + CLIENT_TIMEOUT_MS;
+		if (c->offset == p->size) {
+			c->piece++;
+			c->offset = 0;
+		}
+	}
+	return false;
+}
+
+static void accept_client(wsping_exporter_t* e, uint64_t now)
+{
+	socket_t sock = accept(e->listener, NULL, NULL);
+	if (sock == INVALID_SOCKET) {
+		return;
+	}
+	if (!set_nonblocking(sock)) {
+		close_socket(sock);
+		return;
+	}
+	export_client_t* c = &e->clients[e->num_clients++];
+	memset(c, 0, sizeof(*c));
+	c->sock = sock;
+	c->deadline = now + CLIENT_TIMEOUT_MS;
+}
+
+// Close a client and give back its slices, the last client
+// takes its place
+static void drop_client(wsping_exporter_t* e, int index)
+{
+	export_client_t* c = &e->clients[index];
+	close_socket(c->sock);
+	if (c->pieces) {
+		wsp_mutex_lock(&e->render_lock);
+		for (uint32_t i = 0; i < c->num_pieces; i++) {
+			release_slice(c->pieces[i].slice);
+		}
+		wsp_mutex_unlock(&e->render_lock);
+		free(c->pieces);
+	}
+	if (index != --e->num_clients) {
+		*c = e->clients[e->num_clients];
+	}
+}
+
+// Serves every connected scraper at once, a slow one only holds
+// its own slot until it timed out
+static void listener_main(void* arg)
+{
+	wsping_exporter_t* e = (wsping_exporter_t*)arg;
+	struct pollfd pfds[MAX_CLIENTS + 1];
+
+	while (!wsp_atomic_load(&e->stopping)) {
+		int n = e->num_clients;
+		for (int i = 0; i < n; i++) {
+			pfds[i].fd = e->clients[i].sock;
+			pfds[i].events = e->clients[i].pieces ? POLLOUT : POLLIN;
+			pfds[i].revents = 0;
+		}
+
+		// New scrapers wait in the backlog while every slot is taken
+		bool accepting = n < MAX_CLIENTS;
+		if (accepting) {
+			pfds[n].fd = e->listener;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+		}
+		int ready = poll(pfds, n + (accepting ? 1 : 0), LISTEN_POLL_MS);
+		uint64_t now = wsp_clock_ms();
+
+		// Back to front, so the client moved into a dropped one's
+		// place was already served
+		for (int i = n - 1; i >= 0; i--) {
+			bool keep = ready > 0 && pfds[i].revents != 0 ?
+				serve_client(e, &e->clients[i], now) : now < e->clients[i].deadline;
+			if (!keep) {
+				drop_client(e, i);
+			}
+		}
+		if (accepting && ready > 0 && (pfds[n].revents & POLLIN)) {
+			accept_client(e, now);
+		}
+	}
+
+	while (e->num_clients > 0) {
+		drop_client(e, e->num_clients - 1);
+	}
+}
+
+static bool open_listener(wsping_exporter_t* e, char* err)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo* info = NULL;
+	char port[8];
+	snprintf(port, sizeof(port), "%u", (unsigned)e->options.port);
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+	if (getaddrinfo(e->options.address, port, &hints, &info) != 0) {
+		wsping_sprintf(err, "Invalid metrics listen address %s", e->options.address);
+		return false;
+	}
+
+	int on = 1;
+	e->listener = socket(info->ai_family, SOCK_STREAM, IPPROTO_TCP);
+	bool ok = e->listener != INVALID_SOCKET &&
+		setsockopt(e->listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on)) == 0 &&
+		bind(e->listener, info->ai_addr, (int)info->ai_addrlen) == 0 &&
+		listen(e->listener, 16) == 0;
+	freeaddrinfo(info);
+	if (!ok) {
+		wsping_sprintf(err, "Could not listen on %s port %s for metrics", e->options.address, port);
+	}
+	return ok;
+}
+
+/*---------------*
+ | Exporter Core |
+ *---------------*/
+
+wsping_exporter_t* wsping_exporter_create(const wsping_exporter_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	wsping_exporter_t* e = (wsping_exporter_t*)calloc(1, sizeof(wsping_exporter_t));
+	if (!e) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	e->err_cb = err_func;
+	e->userdata = udata;
+	e->listener = INVALID_SOCKET;
+	if (opt) {
+		e->options = *opt;
+	}
+	e->options.address = wsping_defval(e->options.address, "127.0.0.1");
+	e->options.port = wsping_defval(e->options.port, DEFAULT_EXPORTER_PORT);
+	wsp_mutex_init(&e->targets_lock);
+	wsp_mutex_init(&e->render_lock);
+
+#ifdef _WIN32
+	e->wsa_status = WSAStartup(MAKEWORD(2, 2), &e->wsa_data);
+	if (e->wsa_status != 0) {
+		e->err_cb(e->userdata, "WSAStartup failed");
+		wsping_exporter_destroy(e);
+		return NULL;
+	}
+#endif
+
+	char err[WSPING_BUF_SIZE] = {0};
+	if (!open_listener(e, err)) {
+		e->err_cb(e->userdata, err);
+		wsping_exporter_destroy(e);
+		return NULL;
+	}
+	if (!wsp_thread_start(&e->thread, listener_main, e)) {
+		e->err_cb(e->userdata, "Could not start the metrics listener");
+		wsping_exporter_destroy(e);
+		return NULL;
+	}
+	e->thread_running = true;
+	return e;
+}
+
+void wsping_exporter_destroy(wsping_exporter_t* e)
+{
+	if (!e) {
+		return;
+	}
+	if (e->thread_running) {
+		wsp_atomic_store(&e->stopping, 1);
+		wsp_thread_join(&e->thread);
+	}
+	if (e->listener != INVALID_SOCKET) {
+		close_socket(e->listener);
+	}
+#ifdef _WIN32
+	if (e->wsa_status == 0) {
+		WSACleanup();
+	}
+#endif
+
+	for (uint32_t i = 0; i < e->num_targets; i++) {
+		export_target_t* t = target_at(e, i);
+		wsp_mutex_destroy(&t->lock);
+		free(t->labels);
+		free(t->text);
+	}
+	for (int c = 0; c < MAX_TARGET_CHUNKS; c++) {
+		free(e->chunks[c]);
+	}
+	for (int c = 0; c < MAX_TARGET_CHUNKS; c++) {
+		for (int f = 0; f < family_count; f++) {
+			release_slice(e->slices[c][f]);
+		}
+	}
+	free(e->ids);
+	free(e->pieces);
+	wsp_mutex_destroy(&e->targets_lock);
+	wsp_mutex_destroy(&e->render_lock);
+	free(e);
+}
@@ -0,0 +1,145 @@
+#include <string.h>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "wsping_priv.h"
+
+// Log-linear (HDR style) layout: values below 2^(SUB_BITS + 1) get a
+// bucket each, above that every power of two is split into 2^SUB_BITS
+// linear sub-buckets. A value is found by its highest set bit and the
+// SUB_BITS bits below it, so recording is a few instructions.
+
+enum
+{
+	SUB_COUNT = 1 << WSPING_HIST_SUB_BITS
+};
+
+// Largest value with a bucket of its own, larger ones saturate. Too
+// wide for an enumerator, which has to fit in an int
+#define WSP_HIST_MAX_VALUE ((1ULL << WSPING_HIST_MAX_BITS) - 1)
+
+// Index of the highest set bit, value must not be 0
+static int highest_bit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+static int bucket_index(uint64_t value)
+{
+	if (value > WSP_HIST_MAX_VALUE) {
+		value = WSP_HIST_MAX_VALUE;
+	}
+	if (value < 2 * SUB_COUNT) {
+		return (int)value;
+	}
+	int shift = highest_bit(value) - WSPING_HIST_SUB_BITS;
+	return (shift << WSPING_HIST_SUB_BITS) + (int)(value >> shift);
+}
+
+static void bucket_range(int index, uint64_t* low, uint64_t* high)
+{
+	if (index < 2 * SUB_COUNT) {
+		*low = *high = (uint64_t)index;
+		return;
+	}
+	int shift = (index >> WSPING_HIST_SUB_BITS) - 1;
+	*low = (uint64_t)(SUB_COUNT + (index & (SUB_COUNT - 1))) << shift;
+	*high = *low + ((uint64_t)1 << shift) - 1;
+}
+
+void wsping_histogram_reset(wsping_histogram_t* h)
+{
+	assert(h);
+	memset(h, 0, sizeof(*h));
+}
+
+void wsping_histogram_record(wsping_histogram_t* h, uint64_t value)
+{
+	h->buckets[bucket_index(value)]++;
+	if (h->count == 0 || value < h->min) {
+		h->min = value;
+	}
+	if (value > h->max) {
+		h->max = value;
+	}
+	h->count++;
+}
+
+void wsping_histogram_merge(wsping_histogram_t* dst, const wsping_histogram_t* src)
+{
+	assert(dst);
+	assert(src);
+	if (src->count == 0) {
+		return;
+	}
+	for (int i = 0; i < WSPING_HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	if (dst->count == 0 || src->min < dst->min) {
+		dst->min = src->min;
+	}
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+	dst->count += src->count;
+}
+
+// Highest value of the bucket holding the given rank, kept inside
+// the recorded min and max like HdrHistogram does
+uint64_t wsping_histogram_percentile(const wsping_histogram_t* h, double percentile)
+{
+	assert(h);
+	if (h->count == 0) {
+		return 0;
+	}
+	if (percentile <= 0.0) {
+		return h->min;
+	}
+	if (percentile >= 100.0) {
+		return h->max;
+	}
+
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (int i = 0; i < WSPING_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			uint64_t low, high;
+			bucket_range(i, &low, &high);
+			if (high > h->max) {
+				high = h->max;
+			}
+			return high < h->min ? h->min : high;
+		}
+	}
+	return h->max;
+}
+
+bool wsping_histogram_next(const wsping_histogram_t* h, int* iter, wsping_histogram_bucket_t* bucket)
+{
+	assert(h);
+	assert(iter);
+	assert(bucket);
+	for (int i = *iter; i < WSPING_HIST_BUCKETS; i++) {
+		if (h->buckets[i] != 0) {
+			bucket_range(i, &bucket->low, &bucket->high);
+			bucket->count = h->buckets[i];
+			*iter = i + 1;
+			return true;
+		}
+	}
+	*iter = WSPING_HIST_BUCKETS;
+	return false;
+}
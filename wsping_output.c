@@ -0,0 +1,332 @@
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Lines are formatted straight into the buffer, numbers through a two
+// digit table and strings with only the escaping their format needs.
+// Names and addresses are cut to MAX_FIELD bytes, so a line always
+// fits in LINE_MAX_SIZE and the buffer never has to grow.
+
+enum
+{
+	DEFAULT_BUFFER_SIZE = 64 * 1024,
+	DEFAULT_FLUSH_INTERVAL = 100,
+	MAX_FIELD = 256,
+	LINE_MAX_SIZE = 2 * 6 * MAX_FIELD + 256,   // JSON escapes a byte into at most 6
+	MIN_BUFFER_SIZE = 2 * LINE_MAX_SIZE
+};
+
+struct _wsping_output
+{
+	wsping_output_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+	FILE* stream;
+
+	wsp_mutex_t lock;
+	char* buffer;
+	size_t used;
+	uint64_t pending_ns;   // Record time of the oldest buffered line, 0 for none
+	uint64_t count;
+	bool failed;
+};
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char* put_u64(char* dst, uint64_t value)
+{
+	char digits[20];
+	char* p = digits + sizeof(digits);
+	while (value >= 100) {
+		uint32_t pair = (uint32_t)(value % 100) * 2;
+		value /= 100;
+		*--p = digit_pairs[pair + 1];
+		*--p = digit_pairs[pair];
+	}
+	if (value >= 10) {
+		*--p = digit_pairs[value * 2 + 1];
+		*--p = digit_pairs[value * 2];
+	} else {
+		*--p = (char)('0' + value);
+	}
+	size_t len = (size_t)(digits + sizeof(digits) - p);
+	memcpy(dst, p, len);
+	return dst + len;
+}
+
+// Wall clock as seconds with microseconds, exact as a double
+static char* put_time(char* dst, uint64_t time_ns)
+{
+	uint32_t us = (uint32_t)(time_ns / 1000 % 1000000);
+	dst = put_u64(dst, time_ns / 1000000000);
+	*dst++ = '.';
+	memcpy(dst, digit_pairs + us / 10000 * 2, 2);
+	memcpy(dst + 2, digit_pairs + us / 100 % 100 * 2, 2);
+	memcpy(dst + 4, digit_pairs + us % 100 * 2, 2);
+	return dst + 6;
+}
+
+#define put_lit(dst, lit) (memcpy(dst, lit, sizeof(lit) - 1), (dst) + sizeof(lit) - 1)
+
+// Quoted JSON string, or null
+static char* put_json_string(char* dst, const char* src)
+{
+	if (!src) {
+		return put_lit(dst, "null");
+	}
+	*dst++ = '"';
+	for (int i = 0; i < MAX_FIELD && src[i]; i++) {
+		uint8_t c = (uint8_t)src[i];
+		if (c == '"' || c == '\\') {
+			*dst++ = '\\';
+			*dst++ = (char)c;
+		} else if (c < 0x20) {
+			dst = put_lit(dst, "\\u00");
+			*dst++ = hex_digits[c >> 4];
+			*dst++ = hex_digits[c & 15];
+		} else {
+			*dst++ = (char)c;
+		}
+	}
+	*dst++ = '"';
+	return dst;
+}
+
+// CSV field, quoted only when it has to be (RFC 4180)
+static char* put_csv_field(char* dst, const char* src)
+{
+	if (!src) {
+		return dst;
+	}
+	size_t len = strlen(src);
+	len = len < MAX_FIELD ? len : MAX_FIELD;
+	if (strcspn(src, ",\"\r\n") >= len) {
+		memcpy(dst, src, len);
+		return dst + len;
+	}
+	*dst++ = '"';
+	for (size_t i = 0; i < len; i++) {
+		if (src[i] == '"') {
+			*dst++ = '"';
+		}
+		*dst++ = src[i];
+	}
+	*dst++ = '"';
+	return dst;
+}
+
+static char* format_json(char* p, const wsping_record_t* r, const char* target, const char* address)
+{
+	const char* status = wsp_status_name(r->status);
+	p = put_lit(p, "{\"time\":");
+	p = put_time(p, r->time_ns);
+	p = put_lit(p, ",\"id\":");
+	p = put_u64(p, r->target);
+	p = put_lit(p, ",\"target\":");
+	p = put_json_string(p, target);
+	p = put_lit(p, ",\"address\":");
+	p = put_json_string(p, address);
+	p = put_lit(p, ",\"seq\":");
+	p = put_u64(p, r->sequence);
+	p = put_lit(p, ",\"status\":\"");
+	memcpy(p, status, strlen(status));
+	p += strlen(status);
+	p = put_lit(p, "\",\"rtt_ns\":");
+	p = put_u64(p, r->rtt_ns);
+	p = put_lit(p, ",\"ttl\":");
+	p = put_u64(p, r->ttl);
+	p = put_lit(p, ",\"size\":");
+	p = put_u64(p, r->size);
+	return put_lit(p, "}\n");
+}
+
+static char* format_csv(char* p, const wsping_record_t* r, const char* target, const char* address)
+{
+	const char* status = wsp_status_name(r->status);
+	p = put_time(p, r->time_ns);
+	*p++ = ',';
+	p = put_u64(p, r->target);
+	*p++ = ',';
+	p = put_csv_field(p, target);
+	*p++ = ',';
+	p = put_csv_field(p, address);
+	*p++ = ',';
+	p = put_u64(p, r->sequence);
+	*p++ = ',';
+	memcpy(p, status, strlen(status));
+	p += strlen(status);
+	*p++ = ',';
+	p = put_u64(p, r->rtt_ns);
+	*p++ = ',';
+	p = put_u64(p, r->ttl);
+	*p++ = ',';
+	p = put_u64(p, r->size);
+	*p++ = '\n';
+	return p;
+}
+
+// Must hold the lock, returns false when the stream failed
+static bool flush_buffer(wsping_output_t* o)
+{
+	o->pending_ns = 0;
+	if (o->used == 0 || o->failed) {
+		return !o->failed;
+	}
+	size_t used = o->used;
+	o->used = 0;
+	if (fwrite(o->buffer, 1, used, o->stream) != used || fflush(o->stream) != 0) {
+		o->failed = true;
+		return false;
+	}
+	return true;
+}
+
+// Must hold the lock, whether the oldest buffered line has waited
+// flush_interval by the wall clock time now_ns
+static bool flush_due(const wsping_output_t* o, uint64_t now_ns)
+{
+	// A clock set back flushes too
+	return o->pending_ns != 0 &&
+		(now_ns < o->pending_ns || now_ns - o->pending_ns >= (uint64_t)o->options.flush_interval * 1000000);
+}
+
+/*-------------*
+ | Output Core |
+ *-------------*/
+
+wsping_output_t* wsping_output_create(FILE* stream, const wsping_output_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	assert(stream);
+
+	wsping_output_t* o = (wsping_output_t*)calloc(1, sizeof(wsping_output_t));
+	if (!o) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	o->err_cb = err_func;
+	o->userdata = udata;
+	o->stream = stream;
+	if (opt) {
+		o->options = *opt;
+	}
+	o->options.buffer_size = wsping_defval(o->options.buffer_size, DEFAULT_BUFFER_SIZE);
+	o->options.flush_interval = wsping_defval(o->options.flush_interval, DEFAULT_FLUSH_INTERVAL);
+	if (o->options.buffer_size < MIN_BUFFER_SIZE) {
+		o->options.buffer_size = MIN_BUFFER_SIZE;
+	}
+
+	o->buffer = (char*)malloc(o->options.buffer_size);
+	if (!o->buffer) {
+		free(o);
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+	wsp_mutex_init(&o->lock);
+
+	if (o->options.format == wsping_output_csv) {
+		static const char header[] = "time,id,target,address,seq,status,rtt_ns,ttl,size\n";
+		memcpy(o->buffer, header, sizeof(header) - 1);
+		o->used = sizeof(header) - 1;
+	}
+	return o;
+}
+
+void wsping_output_destroy(wsping_output_t* o)
+{
+	if (!o) {
+		return;
+	}
+	wsping_output_flush(o);
+	wsp_mutex_destroy(&o->lock);
+	free(o->buffer);
+	free(o);
+}
+
+bool wsping_output_write(wsping_output_t* o, const wsping_record_t* record, const char* target, const char* address)
+{
+	assert(o);
+	assert(record);
+
+	wsp_mutex_lock(&o->lock);
+	if (o->failed) {
+		wsp_mutex_unlock(&o->lock);
+		return false;
+	}
+
+	bool ok = true;
+	if (o->used + LINE_MAX_SIZE > o->options.buffer_size) {
+		ok = flush_buffer(o);
+	}
+	if (ok) {
+		char* p = o->buffer + o->used;
+		p = o->options.format == wsping_output_csv ?
+			format_csv(p, record, target, address) : format_json(p, record, target, address);
+		o->used = (size_t)(p - o->buffer);
+		o->count++;
+
+		// The record times tell how long lines have been waiting,
+		// which saves reading a clock for every line
+		if (o->pending_ns == 0) {
+			o->pending_ns = record->time_ns;
+		} else if (flush_due(o, record->time_ns)) {
+			ok = flush_buffer(o);
+		}
+	}
+	wsp_mutex_unlock(&o->lock);
+
+	// Reported once, the output stays failed
+	if (!ok) {
+		o->err_cb(o->userdata, "Could not write the results");
+	}
+	return ok;
+}
+
+bool wsping_output_flush(wsping_output_t* o)
+{
+	assert(o);
+	wsp_mutex_lock(&o->lock);
+	bool was_failed = o->failed;
+	bool ok = flush_buffer(o);
+	wsp_mutex_unlock(&o->lock);
+	if (!ok && !was_failed) {
+		o->err_cb(o->userdata, "Could not write the results");
+	}
+	return ok;
+}
+
+uint64_t wsping_output_get_count(const wsping_output_t* o)
+{
+	assert(o);
+	wsping_output_t* w = (wsping_output_t*)o;
+	wsp_mutex_lock(&w->lock);
+	uint64_t count = o->count;
+	wsp_mutex_unlock(&w->lock);
+	return count;
+}
+
+// Lines only go out on the next write or here, so sessions and sweeps
+// call this on every wakeup with the wall clock read for it
+void wsp_output_tick(wsping_output_t* o, uint64_t now_ns)
+{
+	wsp_mutex_lock(&o->lock);
+	bool was_failed = o->failed;
+	bool ok = !flush_due(o, now_ns) || flush_buffer(o);
+	wsp_mutex_unlock(&o->lock);
+	if (!ok && !was_failed) {
+		o->err_cb(o->userdata, "Could not write the results");
+	}
+}
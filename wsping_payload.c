@@ -0,0 +1,228 @@
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PAYLOAD_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define PAYLOAD_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PAYLOAD_NEON
+#include <arm_neon.h>
+#endif
+
+// Echoed data is checked a whole vector at a time. Four vectors are
+// folded together before the branch, so the loop mostly streams loads,
+// and only a block that differs is searched for its first bad byte.
+
+/*----------*
+ | Patterns |
+ *----------*/
+
+void wsping_payload_fill(uint8_t* dst, size_t size, wsping_payload_t pattern, uint32_t seed, const uint8_t* data, size_t length)
+{
+	assert(dst || size == 0);
+	switch (pattern) {
+		case wsping_payload_increment:
+			for (size_t i = 0; i < size; i++) {
+				dst[i] = (uint8_t)i;
+			}
+			break;
+		case wsping_payload_random: {
+			// xorshift32, which must not start from 0
+			uint32_t x = seed != 0 ? seed : 2463534242u;
+			for (size_t i = 0; i < size; i += 4) {
+				x ^= x << 13;
+				x ^= x >> 17;
+				x ^= x << 5;
+				size_t n = size - i < 4 ? size - i : 4;
+				memcpy(dst + i, &x, n);
+			}
+			break;
+		}
+		case wsping_payload_custom:
+			if (data && length > 0) {
+				// Double the copied prefix until it fills the buffer
+				size_t filled = length < size ? length : size;
+				memcpy(dst, data, filled);
+				while (filled < size) {
+					size_t n = filled < size - filled ? filled : size - filled;
+					memcpy(dst + filled, dst, n);
+					filled += n;
+				}
+				break;
+			}
+			memset(dst, 0, size);
+			break;
+		default:
+			memset(dst, 0, size);
+			break;
+	}
+}
+
+/*--------------*
+ | Verification |
+ *--------------*/
+
+// Index of the lowest set bit, mask must not be 0
+static int lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Eight bytes at a time, the tail and the differing word byte by byte
+static size_t mismatch_scalar(const uint8_t* a, const uint8_t* b, size_t offset, size_t size)
+{
+	size_t i = offset;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) {
+			break;
+		}
+	}
+	for (; i < size; i++) {
+		if (a[i] != b[i]) {
+			return i;
+		}
+	}
+	return size;
+}
+
+#ifdef PAYLOAD_SSE2
+static size_t mismatch_sse2(const uint8_t* a, const uint8_t* b, size_t size)
+{
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		__m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		__m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+		__m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+		__m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+		__m128i any = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xffff) {
+			break;
+		}
+	}
+	for (; i + 16 <= size; i += 16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(eq) ^ 0xffff;
+		if (mask != 0) {
+			return i + lowest_bit(mask);
+		}
+	}
+	return mismatch_scalar(a, b, i, size);
+}
+#endif
+
+#ifdef PAYLOAD_AVX2
+#ifdef __GNUC__
+__attribute__((target("avx2")))
+#endif
+static size_t mismatch_avx2(const uint8_t* a, const uint8_t* b, size_t size)
+{
+	size_t i = 0;
+	for (; i + 128 <= size; i += 128) {
+		__m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+		__m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 32)), _mm256_loadu_si256((const __m256i*)(b + i + 32)));
+		__m256i d2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 64)), _mm256_loadu_si256((const __m256i*)(b + i + 64)));
+		__m256i d3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 96)), _mm256_loadu_si256((const __m256i*)(b + i + 96)));
+		__m256i any = _mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3));
+		if (!_mm256_testz_si256(any, any)) {
+			break;
+		}
+	}
+	for (; i + 32 <= size; i += 32) {
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(eq);
+		if (mask != 0) {
+			return i + lowest_bit(mask);
+		}
+	}
+	return mismatch_scalar(a, b, i, size);
+}
+#endif
+
+#ifdef PAYLOAD_NEON
+static size_t mismatch_neon(const uint8_t* a, const uint8_t* b, size_t size)
+{
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		uint8x16_t d0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		uint8x16_t d1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+		uint8x16_t d2 = veorq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+		uint8x16_t d3 = veorq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+		if (vmaxvq_u8(vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3))) != 0) {
+			break;
+		}
+	}
+	for (; i + 16 <= size; i += 16) {
+		if (vmaxvq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0) {
+			break;
+		}
+	}
+	return mismatch_scalar(a, b, i, size);
+}
+#endif
+
+// AVX2 is picked at run time, the library itself is built for the
+// baseline instruction set
+bool wsp_cpu_has_avx2()
+{
+#if defined(PAYLOAD_AVX2) && defined(_MSC_VER)
+	static volatile int cached = -1;
+	if (cached < 0) {
+		int regs[4];
+		bool avx2 = false;
+		__cpuid(regs, 0);
+		if (regs[0] >= 7) {
+			__cpuid(regs, 1);
+			// OSXSAVE and AVX, and the OS saves the YMM registers
+			if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+				__cpuidex(regs, 7, 0);
+				avx2 = (regs[1] & (1 << 5)) != 0;
+			}
+		}
+		cached = avx2 ? 1 : 0;
+	}
+	return cached == 1;
+#elif defined(PAYLOAD_AVX2)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+size_t wsping_payload_mismatch(const void* expected, const void* actual, size_t size)
+{
+	const uint8_t* a = (const uint8_t*)expected;
+	const uint8_t* b = (const uint8_t*)actual;
+	assert((a && b) || size == 0);
+#ifdef PAYLOAD_AVX2
+	if (size >= 128 && wsp_cpu_has_avx2()) {
+		return mismatch_avx2(a, b, size);
+	}
+#endif
+#if defined(PAYLOAD_SSE2)
+	return mismatch_sse2(a, b, size);
+#elif defined(PAYLOAD_NEON)
+	return mismatch_neon(a, b, size);
+#else
+	return mismatch_scalar(a, b, 0, size);
+#endif
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+/*********************************************************
+ * Internal helpers shared by the wsping sources,        *
+ * not part of the public API                            *
+ *********************************************************/
+
+#include "wsping.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Macro for set default value
+#define wsping_defval(param, def) ((param) != 0) ? (param) : (def)
+
+// A wise way to prevent Visual Studio's sprintf warning is using fixed
+// buffer size, instead of defining _CRT_SECURE_NO_WARNINGS
+#ifdef _MSC_VER
+#define wsping_sprintf(dst, fmt, ...) sprintf_s(dst, WSPING_BUF_SIZE, fmt, __VA_ARGS__)
+#else
+#define wsping_sprintf(dst, fmt, ...) snprintf(dst, WSPING_BUF_SIZE, fmt, __VA_ARGS__)
+#endif
+
+enum
+{
+	WSPING_BUF_SIZE = 1024,
+	ICMP_ERROR_SIZE = 8,
+	IO_STATUS_BLOCK = 8,
+	ICMP_HEADER_SIZE = 8,
+	ADDRESS_SIZE = WSPING_ADDRESS_SIZE,
+	DEFAULT_TIMEOUT = 1000,
+	MAX_SEND_SIZE = 65500,
+	WORKER_STEP = 100,
+	DEFAULT_RECENT_COUNT = 100
+};
+
+// Monotonic clock in milliseconds
+uint64_t wsp_clock_ms();
+
+// Monotonic clock in nanoseconds
+uint64_t wsp_clock_ns();
+
+// Minimal threads, the thread struct must stay put while it runs
+typedef struct _wsp_thread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void (*func)(void*);
+	void* arg;
+}
+wsp_thread_t;
+
+bool wsp_thread_start(wsp_thread_t* t, void (*func)(void*), void* arg);
+void wsp_thread_join(wsp_thread_t* t);
+void wsp_sleep_ms(uint32_t ms);
+
+// Mutex and condition variable, neither needs to be destroyed on Windows
+#ifdef _WIN32
+typedef SRWLOCK wsp_mutex_t;
+typedef CONDITION_VARIABLE wsp_cond_t;
+#else
+typedef pthread_mutex_t wsp_mutex_t;
+typedef pthread_cond_t wsp_cond_t;
+#endif
+
+void wsp_mutex_init(wsp_mutex_t* m);
+void wsp_mutex_destroy(wsp_mutex_t* m);
+void wsp_mutex_lock(wsp_mutex_t* m);
+void wsp_mutex_unlock(wsp_mutex_t* m);
+void wsp_cond_init(wsp_cond_t* c);
+void wsp_cond_destroy(wsp_cond_t* c);
+void wsp_cond_wait(wsp_cond_t* c, wsp_mutex_t* m);
+void wsp_cond_signal(wsp_cond_t* c);
+void wsp_cond_broadcast(wsp_cond_t* c);
+
+// Just enough atomics for a single writer publishing to readers on
+// other threads
+#ifdef _WIN32
+#define wsp_atomic_load(p) ((uint32_t)InterlockedCompareExchange((volatile LONG*)(p), 0, 0))
+#define wsp_atomic_store(p, v) InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#define wsp_atomic_fence() MemoryBarrier()
+#define wsp_cpu_relax() YieldProcessor()
+#else
+#define wsp_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define wsp_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define wsp_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#if defined(__x86_64__) || defined(__i386__)
+#define wsp_cpu_relax() __builtin_ia32_pause()
+#else
+#define wsp_cpu_relax() ((void)0)
+#endif
+#endif
+
+// Seqlock publication of a struct (size must be a multiple of 4),
+// writes come from one thread, reads never block the writer. Data can
+// also be changed in place between begin and end
+void wsp_seqlock_begin(uint32_t* seq);
+void wsp_seqlock_end(uint32_t* seq);
+void wsp_seqlock_write(uint32_t* seq, void* dst, const void* src, size_t size);
+void wsp_seqlock_read(const uint32_t* seq, void* dst, const void* src, size_t size);
+
+// Stats over the most recent probes, bounded by sample count and
+// optionally by age
+typedef struct _wsp_recent_sample
+{
+	uint64_t time_ns;
+	uint64_t rtt_ns;
+	bool ok;
+}
+wsp_recent_sample_t;
+
+typedef struct _wsp_recent
+{
+	wsp_recent_sample_t* samples;
+	uint64_t* min_ids;
+	uint64_t* max_ids;
+	uint32_t capacity;
+	uint64_t window_ns;
+	uint64_t head, tail;
+	uint64_t min_head, min_tail;
+	uint64_t max_head, max_tail;
+	uint32_t successful;
+	uint64_t rtt_sum;
+}
+wsp_recent_t;
+
+bool wsp_recent_init(wsp_recent_t* w, uint32_t capacity, uint32_t window_ms);
+void wsp_recent_free(wsp_recent_t* w);
+void wsp_recent_reset(wsp_recent_t* w);
+void wsp_recent_push(wsp_recent_t* w, uint64_t now_ns, bool ok, uint64_t rtt_ns);
+void wsp_recent_fill(const wsp_recent_t* w, wsping_stats_t* stats);
+
+// Binary IPv4 / IPv6 address, cheap to copy and compare on the probe
+// path and only turned into text when somebody asks for it
+typedef struct _wsp_address
+{
+	uint8_t length;   // 4 or 16, 0 when unset
+	uint8_t bytes[16];
+}
+wsp_address_t;
+
+// Format like inet_ntop() into ADDRESS_SIZE bytes, returns the length
+int wsp_format_address(const wsp_address_t* a, char* dst);
+
+// ICMP echo request template, header at packet followed by the data
+// already in place. Only the sequence number changes between probes,
+// and the checksum follows it incrementally
+void wsp_echo_init(uint8_t* packet, uint8_t type, uint16_t ident, size_t size);
+void wsp_echo_set_sequence(uint8_t* packet, uint16_t seq);
+
+// Probe log layout, see wsping_recorder.c. A log is a sequence of
+// WSP_LOG_BLOCK_SIZE blocks where block 0 holds the file header and
+// every other block decodes on its own, the last one may be short.
+// Integers are little endian, records are varints
+#define WSP_LOG_MAGIC "WSPLOG\0\1"
+
+enum
+{
+	WSP_LOG_VERSION = 1,
+	WSP_LOG_HEADER_SIZE = 32,      // Magic, version, block size, creation time
+	WSP_LOG_BLOCK_SIZE = 65536,
+	WSP_LOG_BLOCK_HEADER = 16,     // Base time, bytes used, record count
+	WSP_LOG_RECORD_MAX = 40,       // Longest encoded record
+	WSP_LOG_TAG = 0x80             // First byte of a record, or'ed with the status
+};
+
+// Wall clock in nanoseconds since 1970, for probe logs
+uint64_t wsp_clock_wall_ns();
+
+// Processors available to the process
+uint32_t wsp_cpu_count();
+
+// Whether the CPU and OS support AVX2, checked at run time since the
+// library is built for the baseline instruction set
+bool wsp_cpu_has_avx2();
+
+// Short name of a reply status, like "timed_out", for machine readable output
+const char* wsp_status_name(wsping_reply_status_t status);
+
+// Write out the lines of a result stream that waited flush_interval,
+// now_ns is the wall clock
+void wsp_output_tick(wsping_output_t* o, uint64_t now_ns);
+
+#ifndef _WIN32
+// Map ICMP error type and code into the backend independent reply status
+wsping_reply_status_t wsp_map_icmp_error(int family, int type, int code);
+
+// Whether a failed send may only have reported the ICMP error of an
+// earlier request, which the socket hands out once. Worth one retry
+bool wsp_pending_icmp_error(int err);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
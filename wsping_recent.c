@@ -0,0 +1,112 @@
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Samples live in a ring indexed by an ever increasing sample id, the
+// oldest one is dropped once the ring is full or it got too old. Two
+// monotonic deques of sample ids keep the window minimum and maximum
+// at their fronts, so every update is O(1) amortized.
+
+#define SAMPLE(w, id) (&(w)->samples[(id) % (w)->capacity])
+
+bool wsp_recent_init(wsp_recent_t* w, uint32_t capacity, uint32_t window_ms)
+{
+	memset(w, 0, sizeof(*w));
+	w->samples = (wsp_recent_sample_t*)calloc(capacity, sizeof(wsp_recent_sample_t));
+	w->min_ids = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+	w->max_ids = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+	if (!w->samples || !w->min_ids || !w->max_ids) {
+		wsp_recent_free(w);
+		return false;
+	}
+	w->capacity = capacity;
+	w->window_ns = (uint64_t)window_ms * 1000000;
+	return true;
+}
+
+void wsp_recent_free(wsp_recent_t* w)
+{
+	free(w->samples);
+	free(w->min_ids);
+	free(w->max_ids);
+	memset(w, 0, sizeof(*w));
+}
+
+void wsp_recent_reset(wsp_recent_t* w)
+{
+	w->head = w->tail = 0;
+	w->min_head = w->min_tail = 0;
+	w->max_head = w->max_tail = 0;
+	w->successful = 0;
+	w->rtt_sum = 0;
+}
+
+static void drop_oldest(wsp_recent_t* w)
+{
+	const wsp_recent_sample_t* oldest = SAMPLE(w, w->head);
+	if (oldest->ok) {
+		w->successful--;
+		w->rtt_sum -= oldest->rtt_ns;
+		if (w->min_ids[w->min_head % w->capacity] == w->head) {
+			w->min_head++;
+		}
+		if (w->max_ids[w->max_head % w->capacity] == w->head) {
+			w->max_head++;
+		}
+	}
+	w->head++;
+}
+
+void wsp_recent_push(wsp_recent_t* w, uint64_t now_ns, bool ok, uint64_t rtt_ns)
+{
+	if (w->capacity == 0) {
+		return;
+	}
+
+	if (w->tail - w->head == w->capacity) {
+		drop_oldest(w);
+	}
+	if (w->window_ns != 0) {
+		while (w->head < w->tail && now_ns - SAMPLE(w, w->head)->time_ns > w->window_ns) {
+			drop_oldest(w);
+		}
+	}
+
+	uint64_t id = w->tail++;
+	wsp_recent_sample_t* sample = SAMPLE(w, id);
+	sample->time_ns = now_ns;
+	sample->rtt_ns = rtt_ns;
+	sample->ok = ok;
+	if (!ok) {
+		return;
+	}
+
+	w->successful++;
+	w->rtt_sum += rtt_ns;
+
+	// Samples that can never be the minimum (maximum) again leave the back
+	while (w->min_tail > w->min_head && SAMPLE(w, w->min_ids[(w->min_tail - 1) % w->capacity])->rtt_ns >= rtt_ns) {
+		w->min_tail--;
+	}
+	w->min_ids[w->min_tail++ % w->capacity] = id;
+	while (w->max_tail > w->max_head && SAMPLE(w, w->max_ids[(w->max_tail - 1) % w->capacity])->rtt_ns <= rtt_ns) {
+		w->max_tail--;
+	}
+	w->max_ids[w->max_tail++ % w->capacity] = id;
+}
+
+void wsp_recent_fill(const wsp_recent_t* w, wsping_stats_t* stats)
+{
+	stats->recent_probes = (uint32_t)(w->tail - w->head);
+	stats->recent_successful = w->successful;
+	if (w->successful == 0) {
+		stats->recent_rtt_min_ns = 0;
+		stats->recent_rtt_max_ns = 0;
+		stats->recent_rtt_mean_ns = 0.0;
+		return;
+	}
+	stats->recent_rtt_min_ns = SAMPLE(w, w->min_ids[w->min_head % w->capacity])->rtt_ns;
+	stats->recent_rtt_max_ns = SAMPLE(w, w->max_ids[w->max_head % w->capacity])->rtt_ns;
+	stats->recent_rtt_mean_ns = (double)w->rtt_sum / w->successful;
+}
@@ -0,0 +1,467 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Block 0 starts with the file header, "WSPLOG\0\1", the version and
+// block size as u32 and the creation time as u64. Every other block
+// starts with its base time (u64), the bytes used including the block
+// header (u32) and its record count (u32). A record is
+//
+//   tag       WSP_LOG_TAG | status
+//   ttl       one byte
+//   time      zigzag varint, ns after the record before or the base time
+//   target    varint
+//   sequence  varint
+//   rtt_ns    varint
+//   size      varint
+//
+// Records never span blocks, and the block header is only updated
+// after a record is complete, so a log cut short by a crash still
+// reads up to its last whole record. Blocks past the end of the
+// records are zero filled (used is 0) until the log is closed.
+
+enum
+{
+	DEFAULT_PREALLOCATE_MB = 64
+};
+
+struct _wsping_recorder
+{
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+	wsping_recorder_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+	wsp_mutex_t lock;
+	bool failed;   // Out of disk space or address space, appends fail
+
+	// Mapped chunk of the file, the file is preallocated
+	// up to file_size which is a multiple of the chunk size
+	uint64_t chunk_size;
+	uint64_t file_size;
+	uint64_t map_offset;
+	uint8_t* map;
+
+	// Block being written, NULL until the first record after opening
+	// the log, end is where the records stop when block is NULL
+	uint8_t* block;
+	uint64_t block_offset;
+	uint32_t used;
+	uint32_t block_count;
+	uint64_t last_time;
+	uint64_t end;
+
+	uint64_t records;
+};
+
+static void store_u32(uint8_t* dst, uint32_t value)
+{
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+	dst[2] = (uint8_t)(value >> 16);
+	dst[3] = (uint8_t)(value >> 24);
+}
+
+static void store_u64(uint8_t* dst, uint64_t value)
+{
+	store_u32(dst, (uint32_t)value);
+	store_u32(dst + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t load_u32(const uint8_t* src)
+{
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint8_t* put_varint(uint8_t* dst, uint64_t value)
+{
+	while (value >= 0x80) {
+		*dst++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*dst++ = (uint8_t)value;
+	return dst;
+}
+
+/*--------------*
+ | File Mapping |
+ *--------------*/
+
+#ifdef _WIN32
+static bool open_file(wsping_recorder_t* r, const char* path, char* err)
+{
+	WCHAR wpath[MAX_PATH];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH) == 0) {
+		wsping_sprintf(err, "Could not open probe log %s", path);
+		return false;
+	}
+	r->file = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		r->options.append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (r->file == INVALID_HANDLE_VALUE) {
+		wsping_sprintf(err, "Could not open probe log %s (Code %lu)", path, GetLastError());
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(r->file, &size);
+	r->file_size = (uint64_t)size.QuadPart;
+	return true;
+}
+
+static void close_file(wsping_recorder_t* r)
+{
+	if (r->file != INVALID_HANDLE_VALUE) {
+		CloseHandle(r->file);
+	}
+}
+
+static bool read_at(wsping_recorder_t* r, void* dst, uint32_t size, uint64_t offset)
+{
+	OVERLAPPED ov = {0};
+	DWORD read = 0;
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	return ReadFile(r->file, dst, size, &read, &ov) && read == size;
+}
+
+static void unmap_chunk(wsping_recorder_t* r)
+{
+	if (r->map) {
+		UnmapViewOfFile(r->map);
+		r->map = NULL;
+	}
+	if (r->mapping) {
+		CloseHandle(r->mapping);
+		r->mapping = NULL;
+	}
+}
+
+// A mapping covers the whole file, so a larger file needs a new one
+static bool map_chunk(wsping_recorder_t* r, uint64_t offset)
+{
+	uint64_t end = offset + r->chunk_size;
+	unmap_chunk(r);
+	if (end > r->file_size) {
+		LARGE_INTEGER size;
+		size.QuadPart = (LONGLONG)end;
+		if (!SetFilePointerEx(r->file, size, NULL, FILE_BEGIN) || !SetEndOfFile(r->file)) {
+			return false;
+		}
+		r->file_size = end;
+	}
+	r->mapping = CreateFileMappingW(r->file, NULL, PAGE_READWRITE, (DWORD)(r->file_size >> 32), (DWORD)r->file_size, NULL);
+	if (!r->mapping) {
+		return false;
+	}
+	r->map = (uint8_t*)MapViewOfFile(r->mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)r->chunk_size);
+	r->map_offset = offset;
+	return r->map != NULL;
+}
+
+static void flush_range(wsping_recorder_t* r, uint8_t* start, size_t size)
+{
+	(void)r;
+	FlushViewOfFile(start, size);
+}
+
+static void cut_file(wsping_recorder_t* r, uint64_t size)
+{
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)size;
+	if (SetFilePointerEx(r->file, end, NULL, FILE_BEGIN)) {
+		SetEndOfFile(r->file);
+	}
+}
+#else
+static bool open_file(wsping_recorder_t* r, const char* path, char* err)
+{
+	r->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | (r->options.append ? 0 : O_TRUNC), 0644);
+	if (r->fd < 0) {
+		wsping_sprintf(err, "Could not open probe log %s: %s", path, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(r->fd, &st) != 0) {
+		wsping_sprintf(err, "Could not open probe log %s: %s", path, strerror(errno));
+		return false;
+	}
+	r->file_size = (uint64_t)st.st_size;
+	return true;
+}
+
+static void close_file(wsping_recorder_t* r)
+{
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+}
+
+static bool read_at(wsping_recorder_t* r, void* dst, uint32_t size, uint64_t offset)
+{
+	return pread(r->fd, dst, size, (off_t)offset) == (ssize_t)size;
+}
+
+static void unmap_chunk(wsping_recorder_t* r)
+{
+	if (r->map) {
+		munmap(r->map, (size_t)r->chunk_size);
+		r->map = NULL;
+	}
+}
+
+// Reserve the disk blocks up front where the file system can, so a
+// full disk fails here and not with SIGBUS on a store into the map
+static bool map_chunk(wsping_recorder_t* r, uint64_t offset)
+{
+	uint64_t end = offset + r->chunk_size;
+	unmap_chunk(r);
+	if (end > r->file_size) {
+#ifdef __linux__
+		int rc = posix_fallocate(r->fd, (off_t)r->file_size, (off_t)(end - r->file_size));
+		if (rc == EOPNOTSUPP || rc == EINVAL) {
+			rc = ftruncate(r->fd, (off_t)end);
+		}
+		if (rc != 0) {
+			return false;
+		}
+#else
+		if (ftruncate(r->fd, (off_t)end) != 0) {
+			return false;
+		}
+#endif
+		r->file_size = end;
+	}
+	void* map = mmap(NULL, (size_t)r->chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, (off_t)offset);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+	r->map = (uint8_t*)map;
+	r->map_offset = offset;
+	return true;
+}
+
+static void flush_range(wsping_recorder_t* r, uint8_t* start, size_t size)
+{
+	(void)r;
+	msync(start, size, MS_ASYNC);
+}
+
+static void cut_file(wsping_recorder_t* r, uint64_t size)
+{
+	if (ftruncate(r->fd, (off_t)size) != 0) {
+		r->err_cb(r->userdata, "Could not cut the probe log to size");
+	}
+}
+#endif
+
+/*-----------------*
+ | Recorder Core   |
+ *-----------------*/
+
+// Find where an existing log ends. Logs that were not closed have
+// zero filled blocks after the records, so look for the last block
+// that has any
+static bool find_end(wsping_recorder_t* r, const char* path, char* err)
+{
+	uint8_t header[WSP_LOG_HEADER_SIZE];
+	if (!read_at(r, header, sizeof(header), 0) || memcmp(header, WSP_LOG_MAGIC, 8) != 0 ||
+		load_u32(header + 8) != WSP_LOG_VERSION || load_u32(header + 12) != WSP_LOG_BLOCK_SIZE) {
+		wsping_sprintf(err, "%s is not a probe log", path);
+		return false;
+	}
+
+	uint64_t blocks = (r->file_size + WSP_LOG_BLOCK_SIZE - 1) / WSP_LOG_BLOCK_SIZE;
+	r->end = WSP_LOG_HEADER_SIZE;
+	for (uint64_t i = blocks - 1; i > 0; i--) {
+		uint8_t block[WSP_LOG_BLOCK_HEADER];
+		uint64_t offset = i * WSP_LOG_BLOCK_SIZE;
+		if (!read_at(r, block, sizeof(block), offset)) {
+			continue;
+		}
+		uint32_t used = load_u32(block + 8);
+		if (used > WSP_LOG_BLOCK_HEADER && used <= WSP_LOG_BLOCK_SIZE) {
+			r->end = offset + used;
+			break;
+		}
+	}
+	return true;
+}
+
+wsping_recorder_t* wsping_recorder_create(const char* path, const wsping_recorder_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	assert(path);
+	wsping_recorder_t* r = (wsping_recorder_t*)calloc(1, sizeof(wsping_recorder_t));
+	if (!r) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	r->err_cb = err_func;
+	r->userdata = udata;
+#ifdef _WIN32
+	r->file = INVALID_HANDLE_VALUE;
+#else
+	r->fd = -1;
+#endif
+	if (opt) {
+		r->options = *opt;
+	}
+	r->options.preallocate = wsping_defval(r->options.preallocate, DEFAULT_PREALLOCATE_MB);
+	r->chunk_size = (uint64_t)r->options.preallocate << 20;
+	wsp_mutex_init(&r->lock);
+
+	char err[WSPING_BUF_SIZE] = {0};
+	if (!open_file(r, path, err)) {
+		r->err_cb(r->userdata, err);
+		wsping_recorder_destroy(r);
+		return NULL;
+	}
+
+	if (r->file_size != 0) {
+		if (!find_end(r, path, err)) {
+			r->err_cb(r->userdata, err);
+			wsping_recorder_destroy(r);
+			return NULL;
+		}
+		return r;
+	}
+
+	// A new log, the header goes through the map like everything else
+	if (!map_chunk(r, 0)) {
+		wsping_sprintf(err, "Could not preallocate probe log %s", path);
+		r->err_cb(r->userdata, err);
+		wsping_recorder_destroy(r);
+		return NULL;
+	}
+	memcpy(r->map, WSP_LOG_MAGIC, 8);
+	store_u32(r->map + 8, WSP_LOG_VERSION);
+	store_u32(r->map + 12, WSP_LOG_BLOCK_SIZE);
+	store_u64(r->map + 16, wsp_clock_wall_ns());
+	r->end = WSP_LOG_HEADER_SIZE;
+	return r;
+}
+
+void wsping_recorder_destroy(wsping_recorder_t* r)
+{
+	if (!r) {
+		return;
+	}
+	uint64_t end = r->block ? r->block_offset + r->used : r->end;
+	unmap_chunk(r);
+	if (end != 0 && end < r->file_size) {
+		cut_file(r, end);
+	}
+	close_file(r);
+	wsp_mutex_destroy(&r->lock);
+	free(r);
+}
+
+// Start a new block at the block boundary after the records, the
+// first record of a block is timed against its base time
+static bool next_block(wsping_recorder_t* r, uint64_t base_time)
+{
+	uint64_t end = r->block ? r->block_offset + r->used : r->end;
+	uint64_t offset = (end + WSP_LOG_BLOCK_SIZE - 1) / WSP_LOG_BLOCK_SIZE * WSP_LOG_BLOCK_SIZE;
+
+	if (!r->map || offset < r->map_offset || offset >= r->map_offset + r->chunk_size) {
+		r->end = end;
+		r->block = NULL;
+		if (!map_chunk(r, offset - offset % r->chunk_size)) {
+			return false;
+		}
+	}
+
+	r->block = r->map + (offset - r->map_offset);
+	r->block_offset = offset;
+	r->used = WSP_LOG_BLOCK_HEADER;
+	r->block_count = 0;
+	r->last_time = base_time;
+	store_u64(r->block, base_time);
+	store_u32(r->block + 8, r->used);
+	store_u32(r->block + 12, 0);
+	return true;
+}
+
+bool wsping_recorder_append(wsping_recorder_t* r, const wsping_record_t* record)
+{
+	assert(r);
+	assert(record);
+
+	wsp_mutex_lock(&r->lock);
+	if (r->failed) {
+		wsp_mutex_unlock(&r->lock);
+		return false;
+	}
+	if (!r->block || r->used + WSP_LOG_RECORD_MAX > WSP_LOG_BLOCK_SIZE) {
+		if (!next_block(r, record->time_ns)) {
+			r->failed = true;
+			wsp_mutex_unlock(&r->lock);
+			r->err_cb(r->userdata, "Could not grow the probe log, records are dropped from now on");
+			return false;
+		}
+	}
+
+	// Zigzag keeps a wall clock that stepped back small
+	int64_t delta = (int64_t)(record->time_ns - r->last_time);
+	uint8_t* start = r->block + r->used;
+	uint8_t* p = start;
+	*p++ = (uint8_t)(WSP_LOG_TAG | (record->status & 0x7f));
+	*p++ = record->ttl;
+	p = put_varint(p, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+	p = put_varint(p, record->target);
+	p = put_varint(p, record->sequence);
+	p = put_varint(p, record->rtt_ns);
+	p = put_varint(p, record->size);
+
+	r->last_time = record->time_ns;
+	r->used += (uint32_t)(p - start);
+	r->block_count++;
+	r->records++;
+	store_u32(r->block + 8, r->used);
+	store_u32(r->block + 12, r->block_count);
+	wsp_mutex_unlock(&r->lock);
+	return true;
+}
+
+void wsping_recorder_flush(wsping_recorder_t* r)
+{
+	assert(r);
+	wsp_mutex_lock(&r->lock);
+	if (r->map && r->block) {
+		flush_range(r, r->map, (size_t)(r->block_offset - r->map_offset) + r->used);
+	}
+	wsp_mutex_unlock(&r->lock);
+}
+
+uint64_t wsping_recorder_get_count(const wsping_recorder_t* r)
+{
+	wsping_recorder_t* w = (wsping_recorder_t*)r;
+	wsp_mutex_lock(&w->lock);
+	uint64_t count = r->records;
+	wsp_mutex_unlock(&w->lock);
+	return count;
+}
+
+uint64_t wsping_recorder_get_size(const wsping_recorder_t* r)
+{
+	wsping_recorder_t* w = (wsping_recorder_t*)r;
+	wsp_mutex_lock(&w->lock);
+	uint64_t size = r->block ? r->block_offset + r->used : r->end;
+	wsp_mutex_unlock(&w->lock);
+	return size;
+}
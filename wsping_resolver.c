@@ -0,0 +1,614 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Lookups wait in a FIFO until one of the resolver threads picks them
+// up, so no more than options.threads of them hit the system resolver
+// at once. Answers go into a chained hash table keyed by lookup kind,
+// address family and query. When the table is full the expired entries
+// are purged, then the one closest to expiry makes room.
+
+enum
+{
+	DEFAULT_RESOLVER_THREADS = 8,
+	DEFAULT_CACHE_TTL = 60,
+	DEFAULT_NEGATIVE_TTL = 5,
+	DEFAULT_CACHE_SIZE = 1024
+};
+
+typedef enum _lookup_kind
+{
+	lookup_forward,
+	lookup_reverse
+}
+lookup_kind_t;
+
+typedef struct _resolver_job
+{
+	struct _resolver_job* next;
+	lookup_kind_t kind;
+	int family;
+	char* query;
+	wsping_resolvefunc_t func;
+	void* udata;
+}
+resolver_job_t;
+
+typedef struct _cache_entry
+{
+	struct _cache_entry* next;
+	uint32_t hash;
+	lookup_kind_t kind;
+	int family;
+	char* query;
+	bool ok;
+	uint64_t expires;   // wsp_clock_ms() time
+	char address[ADDRESS_SIZE];
+	char name[NI_MAXHOST];
+}
+cache_entry_t;
+
+struct _wsping_resolver
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	int wsa_status;
+#endif
+	wsping_resolver_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+
+	wsp_mutex_t lock;
+	wsp_cond_t work_ready;
+	wsp_cond_t idle;
+	bool stopping;
+
+	// Queued lookups, pending also counts the running ones
+	resolver_job_t* queue_head;
+	resolver_job_t* queue_tail;
+	uint32_t pending;
+
+	cache_entry_t** buckets;
+	uint32_t bucket_mask;
+	uint32_t entries;
+
+	wsp_thread_t* threads;
+	uint32_t num_threads;
+};
+
+static char* copy_string(const char* src)
+{
+	size_t size = strlen(src) + 1;
+	char* dst = (char*)malloc(size);
+	if (dst) {
+		memcpy(dst, src, size);
+	}
+	return dst;
+}
+
+static int to_family(wsping_ip_version_t version)
+{
+	return version == wsping_ipv6 ? AF_INET6 : AF_INET;
+}
+
+/*-----------------*
+ | System Lookups  |
+ *-----------------*/
+
+#ifdef _WIN32
+// The wide API is the one that handles internationalized names
+static bool resolve_forward(const char* query, int family, char* address, char* name, size_t name_size)
+{
+	WCHAR wquery[NI_MAXHOST];
+	WCHAR waddress[ADDRESS_SIZE];
+	ADDRINFOW hints = {0};
+	PADDRINFOW info = NULL;
+
+	name[0] = 0;
+	if (MultiByteToWideChar(CP_UTF8, 0, query, -1, wquery, NI_MAXHOST) == 0) {
+		return false;
+	}
+
+	hints.ai_family = family;
+	hints.ai_flags = AI_NUMERICHOST;
+	bool numeric = GetAddrInfoW(wquery, NULL, &hints, &info) == 0;
+	if (!numeric) {
+		hints.ai_flags = AI_CANONNAME;
+		if (GetAddrInfoW(wquery, NULL, &hints, &info) != 0) {
+			return false;
+		}
+	}
+
+	bool ok = GetNameInfoW(info->ai_addr, (socklen_t)info->ai_addrlen, waddress, ADDRESS_SIZE, NULL, 0, NI_NUMERICHOST) == 0 &&
+		WideCharToMultiByte(CP_UTF8, 0, waddress, -1, address, ADDRESS_SIZE, NULL, NULL) != 0;
+	if (ok && !numeric && info->ai_canonname &&
+		WideCharToMultiByte(CP_UTF8, 0, info->ai_canonname, -1, name, (int)name_size, NULL, NULL) == 0) {
+		name[0] = 0;
+	}
+	FreeAddrInfoW(info);
+	return ok;
+}
+
+static bool resolve_reverse(const char* query, int family, char* address, char* name, size_t name_size)
+{
+	WCHAR wquery[ADDRESS_SIZE];
+	WCHAR wname[NI_MAXHOST];
+	ADDRINFOW hints = {0};
+	PADDRINFOW info = NULL;
+
+	(void)family;
+	name[0] = 0;
+	if (MultiByteToWideChar(CP_UTF8, 0, query, -1, wquery, ADDRESS_SIZE) == 0) {
+		return false;
+	}
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags = AI_NUMERICHOST;
+	if (GetAddrInfoW(wquery, NULL, &hints, &info) != 0) {
+		return false;
+	}
+
+	bool ok = GetNameInfoW(info->ai_addr, (socklen_t)info->ai_addrlen, wname, NI_MAXHOST, NULL, 0, NI_NAMEREQD) == 0 &&
+		WideCharToMultiByte(CP_UTF8, 0, wname, -1, name, (int)name_size, NULL, NULL) != 0;
+	FreeAddrInfoW(info);
+	if (ok) {
+		snprintf(address, ADDRESS_SIZE, "%s", query);
+	}
+	return ok;
+}
+#else
+static bool resolve_forward(const char* query, int family, char* address, char* name, size_t name_size)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo* info = NULL;
+
+	name[0] = 0;
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	bool numeric = getaddrinfo(query, NULL, &hints, &info) == 0;
+	if (!numeric) {
+		hints.ai_flags = AI_CANONNAME;
+		if (getaddrinfo(query, NULL, &hints, &info) != 0) {
+			return false;
+		}
+	}
+
+	bool ok = getnameinfo(info->ai_addr, info->ai_addrlen, address, ADDRESS_SIZE, NULL, 0, NI_NUMERICHOST) == 0;
+	if (ok && !numeric && info->ai_canonname) {
+		snprintf(name, name_size, "%s", info->ai_canonname);
+	}
+	freeaddrinfo(info);
+	return ok;
+}
+
+static bool resolve_reverse(const char* query, int family, char* address, char* name, size_t name_size)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo* info = NULL;
+
+	(void)family;
+	name[0] = 0;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	if (getaddrinfo(query, NULL, &hints, &info) != 0) {
+		return false;
+	}
+
+	bool ok = getnameinfo(info->ai_addr, info->ai_addrlen, name, (socklen_t)name_size, NULL, 0, NI_NAMEREQD) == 0;
+	freeaddrinfo(info);
+	if (ok) {
+		snprintf(address, ADDRESS_SIZE, "%s", query);
+	}
+	return ok;
+}
+#endif
+
+static bool resolve(lookup_kind_t kind, const char* query, int family, char* address, char* name, size_t name_size)
+{
+	address[0] = 0;
+	if (kind == lookup_reverse) {
+		return resolve_reverse(query, family, address, name, name_size);
+	}
+	return resolve_forward(query, family, address, name, name_size);
+}
+
+/*-------*
+ | Cache |
+ *-------*/
+
+// FNV-1a over the query, mixed with kind and family
+static uint32_t hash_query(lookup_kind_t kind, int family, const char* query)
+{
+	uint32_t hash = 2166136261u ^ ((uint32_t)kind << 8) ^ (uint32_t)family;
+	for (const char* p = query; *p; p++) {
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
+	}
+	return hash;
+}
+
+// Find an answer that did not expire yet, the lock must be held
+static cache_entry_t* cache_find(wsping_resolver_t* r, uint32_t hash, lookup_kind_t kind, int family, const char* query, uint64_t now)
+{
+	for (cache_entry_t* e = r->buckets[hash & r->bucket_mask]; e; e = e->next) {
+		if (e->hash == hash && e->kind == kind && e->family == family && strcmp(e->query, query) == 0) {
+			return e->expires > now ? e : NULL;
+		}
+	}
+	return NULL;
+}
+
+static void cache_unlink(wsping_resolver_t* r, cache_entry_t** link)
+{
+	cache_entry_t* e = *link;
+	*link = e->next;
+	free(e->query);
+	free(e);
+	r->entries--;
+}
+
+// Drop the expired answers, or the one closest to expiry
+// when none expired
+static void cache_evict(wsping_resolver_t* r, uint64_t now)
+{
+	cache_entry_t** oldest = NULL;
+	for (uint32_t i = 0; i <= r->bucket_mask; i++) {
+		cache_entry_t** link = &r->buckets[i];
+		while (*link) {
+			if ((*link)->expires <= now) {
+				cache_unlink(r, link);
+				oldest = NULL;
+				continue;
+			}
+			if (!oldest || (*link)->expires < (*oldest)->expires) {
+				oldest = link;
+			}
+			link = &(*link)->next;
+		}
+	}
+	if (r->entries >= r->options.cache_size && oldest) {
+		cache_unlink(r, oldest);
+	}
+}
+
+// Store an answer, replacing the previous one of the same query.
+// The lock must be held, failing to allocate just skips the cache
+static void cache_store(wsping_resolver_t* r, uint32_t hash, lookup_kind_t kind, int family, const char* query,
+	bool ok, const char* address, const char* name, uint64_t now)
+{
+	cache_entry_t** link = &r->buckets[hash & r->bucket_mask];
+	for (; *link; link = &(*link)->next) {
+		if ((*link)->hash == hash && (*link)->kind == kind && (*link)->family == family && strcmp((*link)->query, query) == 0) {
+			cache_unlink(r, link);
+			break;
+		}
+	}
+	if (r->entries >= r->options.cache_size) {
+		cache_evict(r, now);
+	}
+
+	cache_entry_t* e = (cache_entry_t*)malloc(sizeof(cache_entry_t));
+	if (!e) {
+		return;
+	}
+	e->query = copy_string(query);
+	if (!e->query) {
+		free(e);
+		return;
+	}
+	e->hash = hash;
+	e->kind = kind;
+	e->family = family;
+	e->ok = ok;
+	e->expires = now + (uint64_t)(ok ? r->options.cache_ttl : r->options.negative_ttl) * 1000;
+	snprintf(e->address, sizeof(e->address), "%s", address);
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->next = r->buckets[hash & r->bucket_mask];
+	r->buckets[hash & r->bucket_mask] = e;
+	r->entries++;
+}
+
+// Look up through the cache on the calling thread
+static bool lookup_cached(wsping_resolver_t* r, lookup_kind_t kind, int family, const char* query,
+	char* address, char* name, size_t name_size, bool* cached)
+{
+	uint32_t hash = hash_query(kind, family, query);
+	bool ok;
+
+	wsp_mutex_lock(&r->lock);
+	cache_entry_t* e = cache_find(r, hash, kind, family, query, wsp_clock_ms());
+	if (e) {
+		ok = e->ok;
+		snprintf(address, ADDRESS_SIZE, "%s", e->address);
+		snprintf(name, name_size, "%s", e->name);
+		wsp_mutex_unlock(&r->lock);
+		*cached = true;
+		return ok;
+	}
+	wsp_mutex_unlock(&r->lock);
+
+	*cached = false;
+	ok = resolve(kind, query, family, address, name, name_size);
+
+	wsp_mutex_lock(&r->lock);
+	cache_store(r, hash, kind, family, query, ok, address, name, wsp_clock_ms());
+	wsp_mutex_unlock(&r->lock);
+	return ok;
+}
+
+/*------------------*
+ | Resolver Threads |
+ *------------------*/
+
+static void resolver_main(void* arg)
+{
+	wsping_resolver_t* r = (wsping_resolver_t*)arg;
+	char address[ADDRESS_SIZE];
+	char name[NI_MAXHOST];
+
+	wsp_mutex_lock(&r->lock);
+	for (;;) {
+		while (!r->queue_head && !r->stopping) {
+			wsp_cond_wait(&r->work_ready, &r->lock);
+		}
+		if (r->stopping) {
+			break;
+		}
+
+		resolver_job_t* job = r->queue_head;
+		r->queue_head = job->next;
+		if (!r->queue_head) {
+			r->queue_tail = NULL;
+		}
+		wsp_mutex_unlock(&r->lock);
+
+		// Another job may have cached the same query meanwhile
+		wsping_resolution_t res = {0};
+		res.query = job->query;
+		res.address = address;
+		res.name = name;
+		res.ok = lookup_cached(r, job->kind, job->family, job->query, address, name, sizeof(name), &res.cached);
+		job->func(job->udata, &res);
+		free(job->query);
+		free(job);
+
+		wsp_mutex_lock(&r->lock);
+		if (--r->pending == 0) {
+			wsp_cond_broadcast(&r->idle);
+		}
+	}
+	wsp_mutex_unlock(&r->lock);
+}
+
+wsping_resolver_t* wsping_resolver_create(const wsping_resolver_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	assert(opt);
+	wsping_resolver_t* r = (wsping_resolver_t*)calloc(1, sizeof(wsping_resolver_t));
+	if (!r) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	r->err_cb = err_func;
+	r->userdata = udata;
+	r->options = *opt;
+	r->options.threads = wsping_defval(r->options.threads, DEFAULT_RESOLVER_THREADS);
+	r->options.cache_ttl = wsping_defval(r->options.cache_ttl, DEFAULT_CACHE_TTL);
+	r->options.negative_ttl = wsping_defval(r->options.negative_ttl, DEFAULT_NEGATIVE_TTL);
+	r->options.cache_size = wsping_defval(r->options.cache_size, DEFAULT_CACHE_SIZE);
+
+#ifdef _WIN32
+	r->wsa_status = WSAStartup(MAKEWORD(2, 2), &r->wsa_data);
+	if (r->wsa_status != 0) {
+		char err[WSPING_BUF_SIZE] = {0};
+		wsping_sprintf(err, "Failed to initialize WinSock: %i", r->wsa_status);
+		r->err_cb(r->userdata, err);
+		free(r);
+		return NULL;
+	}
+#endif
+
+	wsp_mutex_init(&r->lock);
+	wsp_cond_init(&r->work_ready);
+	wsp_cond_init(&r->idle);
+
+	// About two buckets per cached answer
+	uint32_t buckets = 16;
+	while (buckets < r->options.cache_size * 2 && buckets < (1u << 24)) {
+		buckets <<= 1;
+	}
+	r->bucket_mask = buckets - 1;
+	r->buckets = (cache_entry_t**)calloc(buckets, sizeof(cache_entry_t*));
+	r->threads = (wsp_thread_t*)calloc(r->options.threads, sizeof(wsp_thread_t));
+	if (!r->buckets || !r->threads) {
+		r->err_cb(r->userdata, "Not enough resources available");
+		wsping_resolver_destroy(r);
+		return NULL;
+	}
+
+	for (; r->num_threads < r->options.threads; r->num_threads++) {
+		if (!wsp_thread_start(&r->threads[r->num_threads], resolver_main, r)) {
+			r->err_cb(r->userdata, "Could not start the resolver threads");
+			wsping_resolver_destroy(r);
+			return NULL;
+		}
+	}
+
+	return r;
+}
+
+void wsping_resolver_destroy(wsping_resolver_t* r)
+{
+	if (!r) {
+		return;
+	}
+
+	wsp_mutex_lock(&r->lock);
+	r->stopping = true;
+	wsp_cond_broadcast(&r->work_ready);
+	wsp_mutex_unlock(&r->lock);
+	for (uint32_t i = 0; i < r->num_threads; i++) {
+		wsp_thread_join(&r->threads[i]);
+	}
+
+	// Lookups that never started call back as failed, so whoever
+	// owns their udata gets it back
+	while (r->queue_head) {
+		resolver_job_t* job = r->queue_head;
+		r->queue_head = job->next;
+		if (!r->queue_head) {
+			r->queue_tail = NULL;
+		}
+		wsping_resolution_t res = {0};
+		res.query = job->query;
+		res.address = "";
+		res.name = "";
+		job->func(job->udata, &res);
+		free(job->query);
+		free(job);
+		r->pending--;
+	}
+	for (uint32_t i = 0; r->buckets && i <= r->bucket_mask; i++) {
+		while (r->buckets[i]) {
+			cache_unlink(r, &r->buckets[i]);
+		}
+	}
+
+	wsp_cond_destroy(&r->idle);
+	wsp_cond_destroy(&r->work_ready);
+	wsp_mutex_destroy(&r->lock);
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	free(r->buckets);
+	free(r->threads);
+	free(r);
+}
+
+// Answer from the cache right away or queue the lookup
+static bool queue_lookup(wsping_resolver_t* r, lookup_kind_t kind, int family, const char* query, wsping_resolvefunc_t func, void* udata)
+{
+	char address[ADDRESS_SIZE];
+	char name[NI_MAXHOST];
+	uint32_t hash = hash_query(kind, family, query);
+
+	wsp_mutex_lock(&r->lock);
+	cache_entry_t* e = cache_find(r, hash, kind, family, query, wsp_clock_ms());
+	if (e) {
+		wsping_resolution_t res = {0};
+		res.query = query;
+		res.address = address;
+		res.name = name;
+		res.ok = e->ok;
+		res.cached = true;
+		snprintf(address, sizeof(address), "%s", e->address);
+		snprintf(name, sizeof(name), "%s", e->name);
+		wsp_mutex_unlock(&r->lock);
+		func(udata, &res);
+		return true;
+	}
+	wsp_mutex_unlock(&r->lock);
+
+	resolver_job_t* job = (resolver_job_t*)calloc(1, sizeof(resolver_job_t));
+	if (job) {
+		job->query = copy_string(query);
+	}
+	if (!job || !job->query) {
+		free(job);
+		r->err_cb(r->userdata, "Not enough resources available");
+		return false;
+	}
+	job->kind = kind;
+	job->family = family;
+	job->func = func;
+	job->udata = udata;
+
+	wsp_mutex_lock(&r->lock);
+	if (r->queue_tail) {
+		r->queue_tail->next = job;
+	} else {
+		r->queue_head = job;
+	}
+	r->queue_tail = job;
+	r->pending++;
+	wsp_cond_signal(&r->work_ready);
+	wsp_mutex_unlock(&r->lock);
+	return true;
+}
+
+bool wsping_resolver_lookup(wsping_resolver_t* r, const char* name, wsping_ip_version_t version, wsping_resolvefunc_t func, void* udata)
+{
+	assert(r);
+	assert(func);
+	if (!name || strlen(name) == 0) {
+		r->err_cb(r->userdata, "Target address must be specified");
+		return false;
+	}
+	return queue_lookup(r, lookup_forward, to_family(version), name, func, udata);
+}
+
+bool wsping_resolver_reverse(wsping_resolver_t* r, const char* address, wsping_resolvefunc_t func, void* udata)
+{
+	assert(r);
+	assert(func);
+	if (!address || strlen(address) == 0) {
+		r->err_cb(r->userdata, "Target address must be specified");
+		return false;
+	}
+	return queue_lookup(r, lookup_reverse, AF_UNSPEC, address, func, udata);
+}
+
+void wsping_resolver_wait(wsping_resolver_t* r)
+{
+	assert(r);
+	wsp_mutex_lock(&r->lock);
+	while (r->pending > 0) {
+		wsp_cond_wait(&r->idle, &r->lock);
+	}
+	wsp_mutex_unlock(&r->lock);
+}
+
+bool wsping_resolver_resolve(wsping_resolver_t* r, const char* name, wsping_ip_version_t version, char* address, char* canon_name, size_t canon_size)
+{
+	char canon[NI_MAXHOST];
+	bool cached;
+
+	assert(r);
+	assert(address);
+	if (!name || strlen(name) == 0) {
+		return false;
+	}
+	bool ok = lookup_cached(r, lookup_forward, to_family(version), name, address, canon, sizeof(canon), &cached);
+	if (canon_name && canon_size > 0) {
+		snprintf(canon_name, canon_size, "%s", canon);
+	}
+	return ok;
+}
+
+bool wsping_resolver_resolve_reverse(wsping_resolver_t* r, const char* address, char* name, size_t size)
+{
+	char numeric[ADDRESS_SIZE];
+	char host[NI_MAXHOST];
+	bool cached;
+
+	assert(r);
+	assert(name);
+	if (!address || strlen(address) == 0) {
+		return false;
+	}
+	bool ok = lookup_cached(r, lookup_reverse, AF_UNSPEC, address, numeric, host, sizeof(host), &cached);
+	snprintf(name, size, "%s", host);
+	return ok;
+}
@@ -0,0 +1,782 @@
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+#else
+#include <poll.h>
+#endif
+#include <string.h>
+#include <assert.h>
+
+#include "wsping_priv.h"
+
+// Raw socket option of linux/icmp.h, which clashes with netinet/ip_icmp.h
+#if defined(__linux__) && !defined(ICMP_FILTER)
+#define ICMP_FILTER 1
+#endif
+
+// Sweep mode pings every target through a few shared ICMP datagram
+// sockets. The kernel only filters replies by socket identifier, so
+// replies are matched back to their target by sequence number, with
+// one probe table of 65536 entries per socket.
+//
+// Every socket keeps an echo request template with the data in place,
+// a probe only patches the sequence number and adjusts the checksum.
+// Raw IPv4 sockets pick their own identifier and need that checksum,
+// they also see every ICMP packet of the host and filter by identifier.
+
+enum
+{
+	SWEEP_SEQ_SPACE = 65536,
+	SWEEP_MAX_EVENTS = 64,
+	SWEEP_SEND_BURST = 256,
+	SWEEP_RCVBUF_SIZE = 4 * 1024 * 1024,
+	SWEEP_IP_HEADER_MAX = 60
+};
+
+typedef struct _sweep_target
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int sock_index;
+	char address[ADDRESS_SIZE];
+	int export_id;   // Target in options.exporter, -1 until the first run
+	wsping_sweep_result_t result;
+}
+sweep_target_t;
+
+// Probe in flight, indexed by sequence number
+typedef struct _sweep_probe
+{
+	uint32_t target;   // Target index + 1, zero when the entry is free
+	uint64_t sent_at;  // Milliseconds, for the timeout
+	uint64_t sent_ns;  // Nanoseconds, for the round trip time
+}
+sweep_probe_t;
+
+typedef struct _sweep_socket
+{
+	int fd;
+	int family;
+	bool raw;
+	uint16_t ident;
+	uint16_t sequence;
+	uint8_t* packet;   // Echo request template
+	sweep_probe_t* probes;
+}
+sweep_socket_t;
+
+// Probes expire in the order they were sent, so a FIFO
+// of send times is enough to find the timed out ones
+typedef struct _sweep_expiry
+{
+	uint32_t sock_index;
+	uint16_t sequence;
+	uint64_t sent_at;
+}
+sweep_expiry_t;
+
+struct _wsping_sweep
+{
+	wsping_sweep_options_t options;
+	wsping_errfunc_t err_cb;
+	void* userdata;
+
+	sweep_target_t* targets;
+	int num_targets;
+	int cap_targets;
+
+	sweep_socket_t* sockets;
+	int num_sockets;
+	int poll_fd;
+
+	sweep_expiry_t* expiry;
+	size_t expiry_cap;
+	size_t expiry_head;
+	size_t expiry_tail;
+
+	uint8_t* packet;   // Receive buffer, room for an IPv4 header too
+	uint64_t completed;
+	double probe_rate;
+};
+
+wsping_sweep_t* wsping_sweep_create(const wsping_sweep_options_t* opt, wsping_errfunc_t err_func, void* udata)
+{
+	assert(opt);
+	wsping_sweep_t* sw = (wsping_sweep_t*)calloc(1, sizeof(wsping_sweep_t));
+	if (!sw) {
+		err_func(udata, "Not enough resources available");
+		return NULL;
+	}
+
+	sw->err_cb = err_func;
+	sw->userdata = udata;
+	sw->poll_fd = -1;
+	sw->options = *opt;
+	sw->options.timeout = wsping_defval(sw->options.timeout, DEFAULT_TIMEOUT);
+	sw->options.request_size = wsping_defval(sw->options.request_size, 32);
+	sw->options.ttl = wsping_defval(sw->options.ttl, 128);
+	sw->options.count = wsping_defval(sw->options.count, 1);
+	sw->options.interval = wsping_defval(sw->options.interval, 1000);
+	sw->options.sockets = wsping_defval(sw->options.sockets, 1);
+
+	if (sw->options.request_size > MAX_SEND_SIZE) {
+		sw->err_cb(sw->userdata, "Send buffer size is too large");
+		free(sw);
+		return NULL;
+	}
+
+	// One socket set per IP version
+	sw->num_sockets = (int)sw->options.sockets * 2;
+	sw->sockets = (sweep_socket_t*)calloc(sw->num_sockets, sizeof(sweep_socket_t));
+	sw->packet = (uint8_t*)calloc(1, SWEEP_IP_HEADER_MAX + ICMP_HEADER_SIZE + MAX_SEND_SIZE);
+	if (!sw->sockets || !sw->packet) {
+		sw->err_cb(sw->userdata, "Not enough resources available");
+		wsping_sweep_destroy(sw);
+		return NULL;
+	}
+	for (int i = 0; i < sw->num_sockets; i++) {
+		sw->sockets[i].fd = -1;
+		sw->sockets[i].family = i < (int)sw->options.sockets ? AF_INET : AF_INET6;
+	}
+
+	return sw;
+}
+
+void wsping_sweep_destroy(wsping_sweep_t* sw)
+{
+	if (!sw) {
+		return;
+	}
+	for (int i = 0; sw->sockets && i < sw->num_sockets; i++) {
+		if (sw->sockets[i].fd >= 0) {
+			close(sw->sockets[i].fd);
+		}
+		free(sw->sockets[i].probes);
+		free(sw->sockets[i].packet);
+	}
+	if (sw->poll_fd >= 0) {
+		close(sw->poll_fd);
+	}
+	for (int i = 0; i < sw->num_targets; i++) {
+		free((char*)sw->targets[i].result.target);
+	}
+	free(sw->targets);
+	free(sw->sockets);
+	free(sw->expiry);
+	free(sw->packet);
+	free(sw);
+}
+
+// Append a resolved target
+static bool append_target(wsping_sweep_t* sw, const char* target, const struct addrinfo* info)
+{
+	if (sw->num_targets == sw->cap_targets) {
+		int cap = sw->cap_targets ? sw->cap_targets * 2 : 64;
+		sweep_target_t* targets = (sweep_target_t*)realloc(sw->targets, cap * sizeof(sweep_target_t));
+		if (!targets) {
+			sw->err_cb(sw->userdata, "Not enough resources available");
+			return false;
+		}
+		sw->targets = targets;
+		sw->cap_targets = cap;
+	}
+
+	// Spread the targets over the sockets of their IP version
+	sweep_target_t* t = &sw->targets[sw->num_targets];
+	memset(t, 0, sizeof(*t));
+	memcpy(&t->addr, info->ai_addr, info->ai_addrlen);
+	t->addrlen = info->ai_addrlen;
+	t->sock_index = sw->num_targets % (int)sw->options.sockets;
+	if (info->ai_family == AF_INET6) {
+		t->sock_index += (int)sw->options.sockets;
+	}
+	getnameinfo(info->ai_addr, info->ai_addrlen, t->address, sizeof(t->address), NULL, 0, NI_NUMERICHOST);
+	t->export_id = -1;
+
+	t->result.target = strdup(target);
+	if (!t->result.target) {
+		sw->err_cb(sw->userdata, "Not enough resources available");
+		return false;
+	}
+	sw->num_targets++;
+	return true;
+}
+
+// Parse a numeric address of the sweep IP version
+static bool parse_address(wsping_sweep_t* sw, const char* address, struct addrinfo** info)
+{
+	struct addrinfo hints = {0};
+	hints.ai_family = sw->options.ip_version == wsping_ipv6 ? AF_INET6 : AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	return getaddrinfo(address, NULL, &hints, info) == 0;
+}
+
+static void report_unknown_host(wsping_sweep_t* sw, const char* target)
+{
+	char err[WSPING_BUF_SIZE] = {0};
+	wsping_sprintf(err, "Could not find host %s. Please check the name and try again", target);
+	sw->err_cb(sw->userdata, err);
+}
+
+bool wsping_sweep_add_target(wsping_sweep_t* sw, const char* target)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo* info = NULL;
+	char address[ADDRESS_SIZE];
+
+	assert(sw);
+	if (!target || strlen(target) == 0) {
+		sw->err_cb(sw->userdata, "Target address must be specified");
+		return false;
+	}
+
+	if (!parse_address(sw, target, &info)) {
+		bool found;
+		if (sw->options.resolver) {
+			found = wsping_resolver_resolve(sw->options.resolver, target, sw->options.ip_version, address, NULL, 0) &&
+				parse_address(sw, address, &info);
+		} else {
+			hints.ai_family = sw->options.ip_version == wsping_ipv6 ? AF_INET6 : AF_INET;
+			hints.ai_socktype = SOCK_DGRAM;
+			found = getaddrinfo(target, NULL, &hints, &info) == 0;
+		}
+		if (!found) {
+			report_unknown_host(sw, target);
+			return false;
+		}
+	}
+
+	bool added = append_target(sw, target, info);
+	freeaddrinfo(info);
+	return added;
+}
+
+// Answer of a target name, written by a resolver thread
+typedef struct _sweep_lookup
+{
+	char address[ADDRESS_SIZE];
+	bool ok;
+}
+sweep_lookup_t;
+
+static void store_lookup(void* udata, const wsping_resolution_t* res)
+{
+	sweep_lookup_t* lookup = (sweep_lookup_t*)udata;
+	lookup->ok = res->ok;
+	snprintf(lookup->address, sizeof(lookup->address), "%s", res->address);
+}
+
+bool wsping_sweep_add_targets(wsping_sweep_t* sw, const char* const* targets, int count)
+{
+	wsping_resolver_options_t defaults = {0};
+	wsping_resolver_t* resolver = sw->options.resolver;
+	struct addrinfo* info = NULL;
+	bool ok = true;
+
+	assert(sw);
+	assert(targets || count == 0);
+
+	// Addresses are added as they are, only names go to the resolver
+	sweep_lookup_t* lookups = (sweep_lookup_t*)calloc(count > 0 ? count : 1, sizeof(sweep_lookup_t));
+	if (!lookups) {
+		sw->err_cb(sw->userdata, "Not enough resources available");
+		return false;
+	}
+	for (int i = 0; i < count; i++) {
+		if (!targets[i] || strlen(targets[i]) == 0 || !parse_address(sw, targets[i], &info)) {
+			continue;
+		}
+		freeaddrinfo(info);
+		snprintf(lookups[i].address, sizeof(lookups[i].address), "%s", targets[i]);
+		lookups[i].ok = true;
+	}
+
+	for (int i = 0; ok && i < count; i++) {
+		if (lookups[i].ok || !targets[i] || strlen(targets[i]) == 0) {
+			continue;
+		}
+		if (!resolver) {
+			resolver = wsping_resolver_create(&defaults, sw->err_cb, sw->userdata);
+			if (!resolver) {
+				ok = false;
+				break;
+			}
+		}
+		ok = wsping_resolver_lookup(resolver, targets[i], sw->options.ip_version, store_lookup, &lookups[i]);
+	}
+	if (resolver) {
+		wsping_resolver_wait(resolver);
+		if (resolver != sw->options.resolver) {
+			wsping_resolver_destroy(resolver);
+		}
+	}
+
+	// Targets keep their order, the first one that failed stops the batch
+	for (int i = 0; ok && i < count; i++) {
+		if (!targets[i] || strlen(targets[i]) == 0) {
+			sw->err_cb(sw->userdata, "Target address must be specified");
+			ok = false;
+		} else if (!lookups[i].ok || !parse_address(sw, lookups[i].address, &info)) {
+			report_unknown_host(sw, targets[i]);
+			ok = false;
+		} else {
+			ok = append_target(sw, targets[i], info);
+			freeaddrinfo(info);
+		}
+	}
+
+	free(lookups);
+	return ok;
+}
+
+// Create the sockets used by the targets, the poll set,
+// probe tables and the expiry FIFO
+static bool open_sockets(wsping_sweep_t* sw)
+{
+	char err[WSPING_BUF_SIZE] = {0};
+	int on = 1;
+	int ttl = sw->options.ttl;
+	int rcvbuf = SWEEP_RCVBUF_SIZE;
+	size_t in_use = 0;
+
+#ifdef __linux__
+	if (sw->poll_fd < 0) {
+		sw->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (sw->poll_fd < 0) {
+			wsping_sprintf(err, "epoll_create1 failed: %s", strerror(errno));
+			sw->err_cb(sw->userdata, err);
+			return false;
+		}
+	}
+#endif
+
+	for (int i = 0; i < sw->num_targets; i++) {
+		sweep_socket_t* sock = &sw->sockets[sw->targets[i].sock_index];
+		if (sock->fd >= 0) {
+			continue;
+		}
+
+		// ICMPv6 checksums cover the IP addresses and are always
+		// filled in by the kernel, so raw sockets are IPv4 only
+		sock->raw = sw->options.raw_sockets && sock->family == AF_INET;
+		if (sock->family == AF_INET6) {
+			sock->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_ICMPV6);
+		} else {
+			sock->fd = socket(AF_INET, (sock->raw ? SOCK_RAW : SOCK_DGRAM) | SOCK_NONBLOCK, IPPROTO_ICMP);
+		}
+		if (sock->fd < 0) {
+			wsping_sprintf(err, "Could not create ICMP socket: %s", strerror(errno));
+			sw->err_cb(sw->userdata, err);
+			return false;
+		}
+
+		setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		if (sock->family == AF_INET6) {
+			setsockopt(sock->fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+#ifdef IPV6_RECVERR
+			setsockopt(sock->fd, IPPROTO_IPV6, IPV6_RECVERR, &on, sizeof(on));
+#endif
+		} else {
+			setsockopt(sock->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+#ifdef IP_RECVERR
+			setsockopt(sock->fd, IPPROTO_IP, IP_RECVERR, &on, sizeof(on));
+#endif
+		}
+#ifdef ICMP_FILTER
+		if (sock->raw) {
+			// Only echo replies, errors still come through the error queue
+			uint32_t filter = ~(1u << ICMP_ECHOREPLY);
+			setsockopt(sock->fd, SOL_RAW, ICMP_FILTER, &filter, sizeof(filter));
+		}
+#endif
+
+		sock->probes = (sweep_probe_t*)calloc(SWEEP_SEQ_SPACE, sizeof(sweep_probe_t));
+		sock->packet = (uint8_t*)calloc(1, ICMP_HEADER_SIZE + sw->options.request_size);
+		if (!sock->probes || !sock->packet) {
+			sw->err_cb(sw->userdata, "Not enough resources available");
+			return false;
+		}
+
+		// Datagram sockets get their identifier and checksum from the
+		// kernel, it is only the template of a raw socket that needs them
+		sock->ident = sock->raw ? (uint16_t)(getpid() + (sock - sw->sockets)) : 0;
+		wsp_echo_init(sock->packet, sock->family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO, sock->ident,
+			ICMP_HEADER_SIZE + sw->options.request_size);
+
+#ifdef __linux__
+		struct epoll_event ev = {0};
+		ev.events = EPOLLIN;
+		ev.data.u32 = (uint32_t)(sock - sw->sockets);
+		if (epoll_ctl(sw->poll_fd, EPOLL_CTL_ADD, sock->fd, &ev) != 0) {
+			wsping_sprintf(err, "epoll_ctl failed: %s", strerror(errno));
+			sw->err_cb(sw->userdata, err);
+			return false;
+		}
+#endif
+	}
+
+	// Every socket can hold at most SWEEP_SEQ_SPACE probes in flight
+	for (int i = 0; i < sw->num_sockets; i++) {
+		if (sw->sockets[i].fd >= 0) {
+			in_use++;
+		}
+	}
+	if (sw->expiry_cap < in_use * SWEEP_SEQ_SPACE) {
+		free(sw->expiry);
+		sw->expiry_cap = in_use * SWEEP_SEQ_SPACE;
+		sw->expiry = (sweep_expiry_t*)malloc(sw->expiry_cap * sizeof(sweep_expiry_t));
+		if (!sw->expiry) {
+			sw->expiry_cap = 0;
+			sw->err_cb(sw->userdata, "Not enough resources available");
+			return false;
+		}
+	}
+	sw->expiry_head = 0;
+	sw->expiry_tail = 0;
+	return true;
+}
+
+// Account a completed probe to its target, log, stream and export it
+static void complete_probe(wsping_sweep_t* sw, sweep_target_t* t, uint16_t seq, wsping_reply_status_t status, uint64_t rtt_ns)
+{
+	wsping_sweep_result_t* r = &t->result;
+	if (sw->options.recorder || sw->options.output) {
+		wsping_record_t record;
+		record.time_ns = wsp_clock_wall_ns();
+		record.target = (uint32_t)(t - sw->targets);
+		record.sequence = seq;
+		record.rtt_ns = rtt_ns;
+		record.ttl = 0;
+		record.status = status;
+		record.size = sw->options.request_size;
+		if (sw->options.recorder) {
+			wsping_recorder_append(sw->options.recorder, &record);
+		}
+		if (sw->options.output) {
+			wsping_output_write(sw->options.output, &record, r->target, t->address);
+		}
+	}
+	if (t->export_id >= 0) {
+		wsping_exporter_observe(sw->options.exporter, t->export_id, status, rtt_ns);
+	}
+	r->status = status;
+	if (status != wsping_reply_timed_out && status != wsping_reply_failed) {
+		r->received++;
+	}
+	if (status == wsping_reply_ok) {
+		r->successful++;
+		if (rtt_ns < r->rtt_min_ns || r->rtt_min_ns == 0) {
+			r->rtt_min_ns = rtt_ns;
+		}
+		if (rtt_ns > r->rtt_max_ns) {
+			r->rtt_max_ns = rtt_ns;
+		}
+		r->rtt_total_ns += rtt_ns;
+	}
+	sw->completed++;
+}
+
+// Check the source of an echo reply against the probed target
+static bool same_address(const sweep_target_t* t, const struct sockaddr_storage* from)
+{
+	if (from->ss_family != t->addr.ss_family) {
+		return false;
+	}
+	if (from->ss_family == AF_INET6) {
+		return memcmp(&((const struct sockaddr_in6*)from)->sin6_addr, &((const struct sockaddr_in6*)&t->addr)->sin6_addr, sizeof(struct in6_addr)) == 0;
+	}
+	return ((const struct sockaddr_in*)from)->sin_addr.s_addr == ((const struct sockaddr_in*)&t->addr)->sin_addr.s_addr;
+}
+
+// Read every reply and ICMP error queued on a socket
+static void drain_socket(wsping_sweep_t* sw, sweep_socket_t* sock, int flags)
+{
+	uint8_t control[512];
+	struct sockaddr_storage from;
+	struct iovec iov = { sw->packet, SWEEP_IP_HEADER_MAX + ICMP_HEADER_SIZE + MAX_SEND_SIZE };
+	struct msghdr msg = {0};
+	uint8_t reply_type = sock->family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY;
+
+	for (;;) {
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t len = recvmsg(sock->fd, &msg, flags | MSG_DONTWAIT);
+		if (len < 0) {
+			return;
+		}
+
+		// Replies on a raw socket start with the IP header, queued
+		// errors carry our own ICMP header either way
+		const uint8_t* icmp = sw->packet;
+		if (sock->raw && !(flags & MSG_ERRQUEUE)) {
+			size_t ihl = len > 0 ? (size_t)(sw->packet[0] & 0x0f) * 4 : 0;
+			icmp += ihl;
+			len -= (ssize_t)ihl;
+		}
+		if (len < ICMP_HEADER_SIZE) {
+			continue;
+		}
+		if (sock->raw && ((icmp[4] << 8) | icmp[5]) != sock->ident) {
+			continue;
+		}
+
+		uint16_t seq = (uint16_t)((icmp[6] << 8) | icmp[7]);
+		sweep_probe_t* probe = &sock->probes[seq];
+		if (probe->target == 0) {
+			continue;
+		}
+
+		sweep_target_t* t = &sw->targets[probe->target - 1];
+		uint64_t rtt_ns = wsp_clock_ns() - probe->sent_ns;
+		wsping_reply_status_t status = wsping_reply_failed;
+
+#if defined(IP_RECVERR)
+		if (flags & MSG_ERRQUEUE) {
+			for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+				if ((c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_RECVERR) ||
+					(c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+					struct sock_extended_err* ee = (struct sock_extended_err*)CMSG_DATA(c);
+					if (ee->ee_origin == SO_EE_ORIGIN_ICMP || ee->ee_origin == SO_EE_ORIGIN_ICMP6) {
+						status = wsp_map_icmp_error(sock->family, ee->ee_type, ee->ee_code);
+					}
+				}
+			}
+		} else
+#endif
+		if (icmp[0] == reply_type && same_address(t, &from)) {
+			status = wsping_reply_ok;
+		} else {
+			continue;
+		}
+
+		probe->target = 0;
+		complete_probe(sw, t, seq, status, rtt_ns);
+	}
+}
+
+// Complete the probes older than the timeout as timed out
+static void expire_probes(wsping_sweep_t* sw, uint64_t now)
+{
+	while (sw->expiry_head != sw->expiry_tail) {
+		sweep_expiry_t* e = &sw->expiry[sw->expiry_head % sw->expiry_cap];
+		if (e->sent_at + sw->options.timeout > now) {
+			break;
+		}
+		sweep_probe_t* probe = &sw->sockets[e->sock_index].probes[e->sequence];
+		if (probe->target != 0 && probe->sent_at == e->sent_at) {
+			complete_probe(sw, &sw->targets[probe->target - 1], e->sequence, wsping_reply_timed_out, 0);
+			probe->target = 0;
+		}
+		sw->expiry_head++;
+	}
+}
+
+// Send one probe to a target, returns false when the probe has to
+// wait (sequence space, expiry FIFO or socket buffer exhausted)
+static bool send_probe(wsping_sweep_t* sw, int index, uint64_t now)
+{
+	sweep_target_t* t = &sw->targets[index];
+	sweep_socket_t* sock = &sw->sockets[t->sock_index];
+	uint16_t seq = (uint16_t)(sock->sequence + 1);
+	sweep_probe_t* probe = &sock->probes[seq];
+	if (probe->target != 0) {
+		return false;
+	}
+
+	// Entries leave the expiry FIFO only by age, answered or not, so
+	// a full FIFO has to wait like an exhausted sequence space
+	if (sw->expiry_tail - sw->expiry_head == sw->expiry_cap) {
+		return false;
+	}
+
+	wsp_echo_set_sequence(sock->packet, seq);
+
+	uint64_t sent_ns = wsp_clock_ns();
+	ssize_t sent = sendto(sock->fd, sock->packet, ICMP_HEADER_SIZE + sw->options.request_size, 0, (struct sockaddr*)&t->addr, t->addrlen);
+	if (sent < 0 && wsp_pending_icmp_error(errno)) {
+		// A pending ICMP error of another target fails the next send once
+		sent = sendto(sock->fd, sock->packet, ICMP_HEADER_SIZE + sw->options.request_size, 0, (struct sockaddr*)&t->addr, t->addrlen);
+	}
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+		return false;
+	}
+
+	sock->sequence = seq;
+	t->result.sent++;
+	if (sent < 0) {
+		complete_probe(sw, t, seq, wsping_reply_failed, 0);
+		return true;
+	}
+
+	probe->target = (uint32_t)index + 1;
+	probe->sent_at = now;
+	probe->sent_ns = sent_ns;
+	sweep_expiry_t* e = &sw->expiry[sw->expiry_tail % sw->expiry_cap];
+	e->sock_index = (uint32_t)t->sock_index;
+	e->sequence = seq;
+	e->sent_at = now;
+	sw->expiry_tail++;
+	return true;
+}
+
+// Wait for replies on every socket, up to timeout milliseconds
+static void wait_sockets(wsping_sweep_t* sw, int timeout)
+{
+#ifdef __linux__
+	struct epoll_event events[SWEEP_MAX_EVENTS];
+	int ready = epoll_wait(sw->poll_fd, events, SWEEP_MAX_EVENTS, timeout);
+	for (int i = 0; i < ready; i++) {
+		sweep_socket_t* sock = &sw->sockets[events[i].data.u32];
+		if (events[i].events & EPOLLERR) {
+			drain_socket(sw, sock, MSG_ERRQUEUE);
+		}
+		drain_socket(sw, sock, 0);
+	}
+#else
+	struct pollfd fds[SWEEP_MAX_EVENTS];
+	int count = 0;
+	for (int i = 0; i < sw->num_sockets && count < SWEEP_MAX_EVENTS; i++) {
+		if (sw->sockets[i].fd >= 0) {
+			fds[count].fd = sw->sockets[i].fd;
+			fds[count].events = POLLIN;
+			count++;
+		}
+	}
+	poll(fds, count, timeout);
+	for (int i = 0; i < sw->num_sockets; i++) {
+		if (sw->sockets[i].fd >= 0) {
+			drain_socket(sw, &sw->sockets[i], 0);
+		}
+	}
+#endif
+}
+
+bool wsping_sweep_run(wsping_sweep_t* sw)
+{
+	assert(sw);
+	if (sw->num_targets == 0) {
+		sw->err_cb(sw->userdata, "No sweep targets were added");
+		return false;
+	}
+	if (!open_sockets(sw)) {
+		return false;
+	}
+
+	for (int i = 0; i < sw->num_targets; i++) {
+		sweep_target_t* t = &sw->targets[i];
+		const char* target = t->result.target;
+		memset(&t->result, 0, sizeof(t->result));
+		t->result.target = target;
+		t->result.address = t->address;
+		if (sw->options.exporter && t->export_id < 0) {
+			t->export_id = wsping_exporter_add_target(sw->options.exporter, target, t->address);
+			if (t->export_id < 0) {
+				return false;
+			}
+		}
+	}
+
+	uint64_t total = (uint64_t)sw->num_targets * sw->options.count;
+	uint64_t sent = 0;
+	uint64_t start = wsp_clock_ms();
+	uint64_t now = start;
+	uint32_t round = 0;
+	int next = 0;
+	sw->completed = 0;
+
+	while (sw->completed < total) {
+		// Send the probes that are due, rounds are interval apart and
+		// the rate limit is a token bucket refilled every millisecond
+		bool blocked = false;
+		for (int burst = 0; burst < SWEEP_SEND_BURST && round < sw->options.count; burst++) {
+			if (now < start + (uint64_t)round * sw->options.interval) {
+				break;
+			}
+			if (sw->options.rate != 0 && sent >= (now - start) * sw->options.rate / 1000 + 1) {
+				break;
+			}
+			if (!send_probe(sw, next, now)) {
+				blocked = true;
+				break;
+			}
+			sent++;
+			if (++next == sw->num_targets) {
+				next = 0;
+				round++;
+			}
+		}
+
+		// Sleep until the next round, the next rate token or the
+		// oldest probe times out, whichever comes first
+		uint64_t wake = now + sw->options.timeout;
+		if (sw->expiry_head != sw->expiry_tail) {
+			uint64_t oldest = sw->expiry[sw->expiry_head % sw->expiry_cap].sent_at + sw->options.timeout;
+			wake = oldest < wake ? oldest : wake;
+		}
+		if (round < sw->options.count && !blocked) {
+			uint64_t due = start + (uint64_t)round * sw->options.interval;
+			if (sw->options.rate != 0) {
+				uint64_t token = start + sent * 1000 / sw->options.rate;
+				due = token > due ? token : due;
+			}
+			wake = due < wake ? due : wake;
+		}
+		if (blocked) {
+			wake = now + 1;
+		}
+		// Streamed results wait no longer than a worker step
+		if (sw->options.output && wake > now + WORKER_STEP) {
+			wake = now + WORKER_STEP;
+		}
+
+		wait_sockets(sw, wake > now ? (int)(wake - now) : 0);
+		now = wsp_clock_ms();
+		expire_probes(sw, now);
+		if (sw->options.output) {
+			wsp_output_tick(sw->options.output, wsp_clock_wall_ns());
+		}
+	}
+	if (sw->options.output) {
+		wsping_output_flush(sw->options.output);
+	}
+
+	uint64_t elapsed = wsp_clock_ms() - start;
+	sw->probe_rate = (double)sent * 1000.0 / (double)(elapsed ? elapsed : 1);
+	return true;
+}
+
+int wsping_sweep_get_target_count(const wsping_sweep_t* sw)
+{
+	return sw->num_targets;
+}
+
+const wsping_sweep_result_t* wsping_sweep_get_result(const wsping_sweep_t* sw, int index)
+{
+	if (index < 0 || index >= sw->num_targets) {
+		return NULL;
+	}
+	return &sw->targets[index].result;
+}
+
+double wsping_sweep_get_probe_rate(const wsping_sweep_t* sw)
+{
+	return sw->probe_rate;
+}
+
+#endif